@@ -49,6 +49,7 @@ solution "softrender"
   createTestProject("plane")
   createTestProject("pbr")
   createTestProject("deferred")
+  createTestProject("clear")
 
   project "common"
     kind "StaticLib"
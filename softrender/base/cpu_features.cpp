@@ -0,0 +1,95 @@
+#include "cpu_features.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CPU_FEATURES_X86 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace sr
+{
+
+#if CPU_FEATURES_X86
+struct CpuidResult
+{
+	uint32_t eax = 0, ebx = 0, ecx = 0, edx = 0;
+};
+
+static CpuidResult Cpuid(uint32_t leaf, uint32_t subleaf)
+{
+	CpuidResult result;
+#if defined(_MSC_VER)
+	int regs[4];
+	__cpuidex(regs, (int)leaf, (int)subleaf);
+	result.eax = regs[0];
+	result.ebx = regs[1];
+	result.ecx = regs[2];
+	result.edx = regs[3];
+#else
+	__cpuid_count(leaf, subleaf, result.eax, result.ebx, result.ecx, result.edx);
+#endif
+	return result;
+}
+
+static uint64_t ReadXCR0()
+{
+#if defined(_MSC_VER)
+	return _xgetbv(0);
+#else
+	uint32_t eax, edx;
+	__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
+struct CpuFeatureFlags
+{
+	bool avx2 = false;
+	bool avx512f = false;
+
+	CpuFeatureFlags()
+	{
+		uint32_t maxLeaf = Cpuid(0, 0).eax;
+		if (maxLeaf < 1) return;
+
+		CpuidResult leaf1 = Cpuid(1, 0);
+		// the OS has to save the ymm/zmm registers on context switches
+		bool osxsave = (leaf1.ecx & (1u << 27)) != 0;
+		if (!osxsave || maxLeaf < 7) return;
+		uint64_t xcr0 = ReadXCR0();
+		bool osAVX = (xcr0 & 0x6) == 0x6;
+		bool osAVX512 = (xcr0 & 0xE6) == 0xE6;
+
+		CpuidResult leaf7 = Cpuid(7, 0);
+		avx2 = osAVX && (leaf7.ebx & (1u << 5)) != 0;
+		avx512f = osAVX512 && (leaf7.ebx & (1u << 16)) != 0;
+	}
+};
+#else
+struct CpuFeatureFlags
+{
+	bool avx2 = false;
+	bool avx512f = false;
+};
+#endif
+
+static const CpuFeatureFlags& GetFlags()
+{
+	static CpuFeatureFlags flags;
+	return flags;
+}
+
+bool CpuFeatures::HasAVX2()
+{
+	return GetFlags().avx2;
+}
+
+bool CpuFeatures::HasAVX512F()
+{
+	return GetFlags().avx512f;
+}
+
+}
@@ -0,0 +1,18 @@
+#ifndef _BASE_CPU_FEATURES_H_
+#define _BASE_CPU_FEATURES_H_
+
+#include "header.h"
+
+namespace sr
+{
+
+// instruction sets usable at runtime, checked against both CPUID and the OS saved register state
+struct CpuFeatures
+{
+	static bool HasAVX2();
+	static bool HasAVX512F();
+};
+
+}
+
+#endif // !_BASE_CPU_FEATURES_H_
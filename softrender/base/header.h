@@ -17,6 +17,7 @@
 #include <map>
 #include <tuple>
 #include <functional>
+#include <typeinfo>
 #include <algorithm>
 
 #if _USE_OPENMP_
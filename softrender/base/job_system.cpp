@@ -0,0 +1,258 @@
+#include "job_system.h"
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace sr
+{
+
+int JobSystem::threadCount = 1;
+thread_local int JobSystem::threadIndex = -1;
+std::vector<std::thread> JobSystem::workers;
+std::unique_ptr<JobSystem::WorkerQueue[]> JobSystem::queues;
+std::mutex JobSystem::wakeMutex;
+std::condition_variable JobSystem::wakeCondition;
+std::atomic<int> JobSystem::queuedJobCount(0);
+bool JobSystem::quit = false;
+
+// joins the workers before the statics above are destroyed at exit
+static struct JobSystemFinalizer
+{
+	~JobSystemFinalizer() { JobSystem::Finalize(); }
+} jobSystemFinalizer;
+
+static void SetCurrentThreadAffinity(int core)
+{
+#if defined(_WIN32)
+	SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << core);
+#elif defined(__linux__)
+	cpu_set_t cpuSet;
+	CPU_ZERO(&cpuSet);
+	CPU_SET(core, &cpuSet);
+	pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuSet);
+#else
+	// macOS has no hard thread affinity, leave the placement to the scheduler
+	(void)core;
+#endif
+}
+
+void JobSystem::Initialize(int workerCount/* = 0*/, bool affinity/* = false*/)
+{
+	Finalize();
+
+	int coreCount = (int)std::thread::hardware_concurrency();
+	if (coreCount <= 0) coreCount = 1;
+	threadCount = (workerCount > 0) ? workerCount : coreCount;
+
+	threadIndex = 0;
+	if (affinity) SetCurrentThreadAffinity(0);
+
+	queues.reset(new WorkerQueue[threadCount]);
+	queuedJobCount = 0;
+	quit = false;
+	for (int i = 1; i < threadCount; ++i)
+	{
+		workers.emplace_back(&JobSystem::WorkerLoop, i, affinity ? (i % coreCount) : -1);
+	}
+}
+
+void JobSystem::Finalize()
+{
+	{
+		std::lock_guard<std::mutex> lock(wakeMutex);
+		quit = true;
+	}
+	wakeCondition.notify_all();
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+	workers.clear();
+	queues.reset();
+	threadCount = 1;
+}
+
+void JobSystem::ParallelFor(int begin, int end, int grainSize, const ForFunc& func)
+{
+	if (end <= begin) return;
+	if (grainSize < 1) grainSize = 1;
+
+	if (threadCount <= 1 || end - begin <= grainSize)
+	{
+		int index = (threadIndex >= 0) ? threadIndex : 0;
+		for (int i = begin; i < end; ++i) func(i, index);
+		return;
+	}
+
+	TaskGroup group;
+	for (int first = begin; first < end; first += grainSize)
+	{
+		int last = std::min(first + grainSize, end);
+		group.Run([&func, first, last]()
+		{
+			int index = threadIndex;
+			for (int i = first; i < last; ++i) func(i, index);
+		});
+	}
+	group.Wait();
+}
+
+void JobSystem::Push(Job&& job)
+{
+	int index = (threadIndex >= 0) ? threadIndex : 0;
+	{
+		std::lock_guard<std::mutex> lock(queues[index].mutex);
+		queues[index].jobs.push_back(std::move(job));
+	}
+	{
+		std::lock_guard<std::mutex> lock(wakeMutex);
+		++queuedJobCount;
+	}
+	wakeCondition.notify_one();
+}
+
+bool JobSystem::Pop(int index, Job& job)
+{
+	WorkerQueue& queue = queues[index];
+	std::lock_guard<std::mutex> lock(queue.mutex);
+	if (queue.jobs.empty()) return false;
+
+	job = std::move(queue.jobs.back());
+	queue.jobs.pop_back();
+	return true;
+}
+
+bool JobSystem::Steal(int index, Job& job)
+{
+	for (int i = 1; i < threadCount; ++i)
+	{
+		WorkerQueue& queue = queues[(index + i) % threadCount];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.jobs.empty()) continue;
+
+		job = std::move(queue.jobs.front());
+		queue.jobs.pop_front();
+		return true;
+	}
+	return false;
+}
+
+bool JobSystem::RunNextJob(int index)
+{
+	Job job;
+	if (!Pop(index, job) && !Steal(index, job)) return false;
+
+	--queuedJobCount;
+	Execute(job);
+	return true;
+}
+
+void JobSystem::Execute(Job& job)
+{
+	job.func();
+	if (job.group != nullptr) job.group->OnJobDone();
+}
+
+void JobSystem::WorkerLoop(int index, int core)
+{
+	threadIndex = index;
+	if (core >= 0) SetCurrentThreadAffinity(core);
+
+	for (;;)
+	{
+		if (RunNextJob(index)) continue;
+
+		std::unique_lock<std::mutex> lock(wakeMutex);
+		wakeCondition.wait(lock, [] { return quit || queuedJobCount.load() > 0; });
+		if (quit) return;
+	}
+}
+
+void TaskGroup::Run(const JobSystem::JobFunc& func)
+{
+	if (JobSystem::queues == nullptr || JobSystem::threadCount <= 1)
+	{
+		func();
+		return;
+	}
+
+	++pendingCount;
+	JobSystem::Job job;
+	job.func = func;
+	job.group = this;
+	JobSystem::Push(std::move(job));
+}
+
+void TaskGroup::ContinueWith(const JobSystem::JobFunc& func)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (pendingCount.load() > 0)
+		{
+			continuations.push_back(func);
+			return;
+		}
+	}
+	Run(func);
+}
+
+void TaskGroup::Wait()
+{
+	if (JobSystem::threadIndex >= 0 && JobSystem::queues != nullptr)
+	{
+		for (;;)
+		{
+			while (pendingCount.load() > 0)
+			{
+				if (!JobSystem::RunNextJob(JobSystem::threadIndex)) std::this_thread::yield();
+			}
+			// OnJobDone holds the lock from the last decrement until the continuations are counted,
+			// the count read 0 in between when it is back above 0 here
+			std::lock_guard<std::mutex> lock(mutex);
+			if (pendingCount.load() == 0) return;
+		}
+	}
+	else
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		doneCondition.wait(lock, [this] { return pendingCount.load() == 0; });
+	}
+}
+
+void TaskGroup::OnJobDone()
+{
+	std::vector<JobSystem::JobFunc> next;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--pendingCount > 0) return;
+
+		if (continuations.empty())
+		{
+			doneCondition.notify_all();
+			return;
+		}
+		next.swap(continuations);
+		pendingCount += (int)next.size();
+	}
+
+	// the group stays alive until these are done, but must not be touched past this point
+	for (auto& func : next)
+	{
+		JobSystem::Job job;
+		job.func = std::move(func);
+		job.group = this;
+		JobSystem::Push(std::move(job));
+	}
+}
+
+}
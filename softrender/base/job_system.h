@@ -0,0 +1,101 @@
+#ifndef _BASE_JOB_SYSTEM_H_
+#define _BASE_JOB_SYSTEM_H_
+
+#include "header.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+
+namespace sr
+{
+
+class TaskGroup;
+
+// work-stealing scheduler shared by the renderer and the resource code.
+// thread 0 is the thread that called Initialize, workers are 1..N-1.
+// every thread owns a deque: it pops its own jobs LIFO and steals FIFO from the others.
+class JobSystem
+{
+public:
+	typedef std::function<void()> JobFunc;
+	// index: loop index, threadIndex: index of the executing thread
+	typedef std::function<void(int index, int threadIndex)> ForFunc;
+
+	static void Initialize(int workerCount = 0, bool affinity = false); // 0: one thread per hardware core
+	static void Finalize();
+
+	static int GetThreadCount() { return threadCount; }
+	// -1 on threads that do not belong to the job system
+	static int GetThreadIndex() { return threadIndex; }
+
+	// runs func for every index in [begin, end), grainSize indices per job, and waits for them
+	static void ParallelFor(int begin, int end, int grainSize, const ForFunc& func);
+	static void ParallelFor(int count, const ForFunc& func) { ParallelFor(0, count, 1, func); }
+
+private:
+	friend class TaskGroup;
+
+	struct Job
+	{
+		JobFunc func;
+		TaskGroup* group = nullptr;
+	};
+
+	struct WorkerQueue
+	{
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	static void Push(Job&& job);
+	static bool Pop(int index, Job& job);
+	static bool Steal(int index, Job& job);
+	static bool RunNextJob(int index);
+	static void Execute(Job& job);
+	static void WorkerLoop(int index, int core); // core: -1 lets the OS place the thread
+
+	static int threadCount;
+	static thread_local int threadIndex;
+	static std::vector<std::thread> workers;
+	static std::unique_ptr<WorkerQueue[]> queues;
+
+	static std::mutex wakeMutex;
+	static std::condition_variable wakeCondition;
+	static std::atomic<int> queuedJobCount;
+	static bool quit;
+};
+
+// a set of jobs that can be waited on, continuations run once all of them are done
+class TaskGroup
+{
+public:
+	TaskGroup() : pendingCount(0) {}
+	~TaskGroup() { Wait(); }
+
+	TaskGroup(const TaskGroup&) = delete;
+	TaskGroup& operator=(const TaskGroup&) = delete;
+
+	void Run(const JobSystem::JobFunc& func);
+	// scheduled when every job run so far has finished, Wait also waits for it
+	void ContinueWith(const JobSystem::JobFunc& func);
+	// threads of the job system execute other jobs while waiting
+	void Wait();
+
+	bool IsDone() const { return pendingCount.load() == 0; }
+
+private:
+	friend class JobSystem;
+
+	void OnJobDone();
+
+	std::atomic<int> pendingCount;
+	std::vector<JobSystem::JobFunc> continuations;
+	std::mutex mutex;
+	std::condition_variable doneCondition;
+};
+
+}
+
+#endif // !_BASE_JOB_SYSTEM_H_
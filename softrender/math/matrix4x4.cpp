@@ -38,6 +38,11 @@ bool Matrix4x4::IsIdentity()
 	return (memcmp(Matrix4x4::identity.m, m, sizeof(float) * 16) == 0);
 }
 
+bool Matrix4x4::IsAffine() const
+{
+	return m[3] == 0.f && m[7] == 0.f && m[11] == 0.f && m[15] == 1.f;
+}
+
 Matrix4x4 Matrix4x4::Multiply(const Matrix4x4& mat) const
 {
 	Matrix4x4 ret;
@@ -352,6 +357,33 @@ Matrix4x4 Matrix4x4::Inverse() const
 	return mat;
 }
 
+Matrix4x4 Matrix4x4::InverseAffine() const
+{
+	// inverse of the upper 3x3 from its cofactors, the translation is moved back through it
+	Matrix4x4 mat;
+	mat.m[0] = m[5] * m[10] - m[9] * m[6];
+	mat.m[1] = m[9] * m[2] - m[1] * m[10];
+	mat.m[2] = m[1] * m[6] - m[5] * m[2];
+	mat.m[4] = m[8] * m[6] - m[4] * m[10];
+	mat.m[5] = m[0] * m[10] - m[8] * m[2];
+	mat.m[6] = m[4] * m[2] - m[0] * m[6];
+	mat.m[8] = m[4] * m[9] - m[8] * m[5];
+	mat.m[9] = m[8] * m[1] - m[0] * m[9];
+	mat.m[10] = m[0] * m[5] - m[4] * m[1];
+
+	float det = 1.0f / (m[0] * mat.m[0] + m[4] * mat.m[1] + m[8] * mat.m[2]);
+	for (int i = 0; i < 11; ++i) {
+		mat.m[i] *= det;
+	}
+
+	mat.m[3] = mat.m[7] = mat.m[11] = 0.f;
+	mat.m[12] = -(mat.m[0] * m[12] + mat.m[4] * m[13] + mat.m[8] * m[14]);
+	mat.m[13] = -(mat.m[1] * m[12] + mat.m[5] * m[13] + mat.m[9] * m[14]);
+	mat.m[14] = -(mat.m[2] * m[12] + mat.m[6] * m[13] + mat.m[10] * m[14]);
+	mat.m[15] = 1.f;
+	return mat;
+}
+
 Matrix4x4 Matrix4x4::Transpose() const
 {
 	int x, z;
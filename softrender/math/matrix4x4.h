@@ -18,8 +18,12 @@ struct Matrix4x4
 
 	void Identity();
 	bool IsIdentity();
+	// the last row is (0, 0, 0, 1)
+	bool IsAffine() const;
 
 	Matrix4x4 Inverse() const;
+	// inverse of a matrix whose last row is (0, 0, 0, 1), like the TRS ones
+	Matrix4x4 InverseAffine() const;
 	Matrix4x4 Transpose() const;
 
 	Matrix4x4 Multiply(const Matrix4x4& mat) const;
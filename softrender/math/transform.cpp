@@ -9,7 +9,7 @@ Matrix4x4 Transform::localToWorldMatrix() const
 
 Matrix4x4 Transform::worldToLocalMatrix() const
 {
-	return localToWorldMatrix().Inverse();
+	return localToWorldMatrix().InverseAffine();
 }
 
 void Transform::GetAxis(Vector3& xAxis, Vector3& yAxis, Vector3& zAxis) const
@@ -0,0 +1,129 @@
+#ifndef _MATH_VECTORX4_H_
+#define _MATH_VECTORX4_H_
+
+#include "base/header.h"
+#include "math/mathf.h"
+#include "math/vector2.h"
+#include "math/vector3.h"
+#include "math/color.h"
+
+namespace sr
+{
+
+// four floats shaded side by side, one lane per pixel of a quad
+struct Floatx4
+{
+	union
+	{
+#ifdef _MATH_SIMD_INTRINSIC_
+		__m128 m;
+#endif
+		float f[4];
+		uint32_t u[4];
+	};
+
+	Floatx4() = default;
+	Floatx4(float v);
+	Floatx4(float v0, float v1, float v2, float v3);
+#ifdef _MATH_SIMD_INTRINSIC_
+	Floatx4(__m128 _m) : m(_m) {}
+#endif
+
+	float operator[](int index) const { return f[index]; }
+	float& operator[](int index) { return f[index]; }
+
+	inline Floatx4 operator -() const;
+	inline Floatx4 operator +=(const Floatx4& v);
+	inline Floatx4 operator -=(const Floatx4& v);
+	inline Floatx4 operator *=(const Floatx4& v);
+	inline Floatx4 operator /=(const Floatx4& v);
+
+	static inline Floatx4 Min(const Floatx4& a, const Floatx4& b);
+	static inline Floatx4 Max(const Floatx4& a, const Floatx4& b);
+	static inline Floatx4 Clamp01(const Floatx4& v);
+	static inline Floatx4 Sqrt(const Floatx4& v);
+	static inline Floatx4 InvSqrt(const Floatx4& v);
+	static inline Floatx4 Pow(const Floatx4& v, const Floatx4& p);
+	static inline Floatx4 Lerp(const Floatx4& a, const Floatx4& b, const Floatx4& t);
+
+	// lanes of mask are all ones or all zeros, as returned by the comparisons
+	static inline Floatx4 Select(const Floatx4& mask, const Floatx4& a, const Floatx4& b);
+	static inline int MoveMask(const Floatx4& mask);
+};
+
+inline Floatx4 operator +(const Floatx4& a, const Floatx4& b);
+inline Floatx4 operator -(const Floatx4& a, const Floatx4& b);
+inline Floatx4 operator *(const Floatx4& a, const Floatx4& b);
+inline Floatx4 operator /(const Floatx4& a, const Floatx4& b);
+inline Floatx4 operator <(const Floatx4& a, const Floatx4& b);
+inline Floatx4 operator >(const Floatx4& a, const Floatx4& b);
+
+struct Vector2x4
+{
+	Floatx4 x, y;
+
+	Vector2x4() = default;
+	Vector2x4(const Floatx4& _x, const Floatx4& _y) : x(_x), y(_y) {}
+	Vector2x4(const Vector2& v) : x(v.x), y(v.y) {}
+
+	inline Vector2 Get(int index) const;
+	inline void Set(int index, const Vector2& v);
+
+	inline Vector2x4 operator +(const Vector2x4& v) const;
+	inline Vector2x4 operator -(const Vector2x4& v) const;
+	inline Vector2x4 operator *(const Floatx4& f) const;
+};
+
+struct Vector3x4
+{
+	Floatx4 x, y, z;
+
+	Vector3x4() = default;
+	Vector3x4(const Floatx4& _x, const Floatx4& _y, const Floatx4& _z) : x(_x), y(_y), z(_z) {}
+	Vector3x4(const Vector3& v) : x(v.x), y(v.y), z(v.z) {}
+
+	inline Vector3 Get(int index) const;
+	inline void Set(int index, const Vector3& v);
+
+	inline Floatx4 Length() const;
+	inline Floatx4 SqrLength() const;
+	inline Vector3x4 Normalize() const;
+	inline Floatx4 Dot(const Vector3x4& v) const;
+	inline Vector3x4 Cross(const Vector3x4& v) const;
+
+	inline Vector3x4 operator -() const;
+	inline Vector3x4 operator +(const Vector3x4& v) const;
+	inline Vector3x4 operator -(const Vector3x4& v) const;
+	inline Vector3x4 operator *(const Vector3x4& v) const;
+	inline Vector3x4 operator *(const Floatx4& f) const;
+	inline Vector3x4 operator /(const Floatx4& f) const;
+	inline Vector3x4 operator +=(const Vector3x4& v);
+	inline Vector3x4 operator -=(const Vector3x4& v);
+	inline Vector3x4 operator *=(const Floatx4& f);
+
+	static inline Vector3x4 LinearInterp(const Vector3x4& a, const Vector3x4& b, const Floatx4& t);
+	static inline Vector3x4 Select(const Floatx4& mask, const Vector3x4& a, const Vector3x4& b);
+};
+
+struct Colorx4
+{
+	Vector3x4 rgb;
+	Floatx4 a;
+
+	Colorx4() = default;
+	Colorx4(const Vector3x4& _rgb, const Floatx4& _a) : rgb(_rgb), a(_a) {}
+	Colorx4(const Color& color) : rgb(color.rgb), a(color.a) {}
+
+	inline Color Get(int index) const;
+	inline void Set(int index, const Color& color);
+
+	inline Colorx4 operator +(const Colorx4& color) const;
+	inline Colorx4 operator *(const Colorx4& color) const;
+	inline Colorx4 operator *(const Floatx4& f) const;
+};
+
+} // namespace sr
+
+#include "vectorx4.inl"
+
+#endif //!_MATH_VECTORX4_H_
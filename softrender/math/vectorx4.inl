@@ -0,0 +1,207 @@
+#ifndef _MATH_VECTORX4_INLINE_
+#define _MATH_VECTORX4_INLINE_
+
+namespace sr
+{
+
+inline Floatx4::Floatx4(float v)
+{
+#ifdef _MATH_SIMD_INTRINSIC_
+	m = _mm_set1_ps(v);
+#else
+	f[0] = f[1] = f[2] = f[3] = v;
+#endif
+}
+
+inline Floatx4::Floatx4(float v0, float v1, float v2, float v3)
+{
+#ifdef _MATH_SIMD_INTRINSIC_
+	m = _mm_setr_ps(v0, v1, v2, v3);
+#else
+	f[0] = v0; f[1] = v1; f[2] = v2; f[3] = v3;
+#endif
+}
+
+Floatx4 Floatx4::operator -() const { return Floatx4(0.f) - *this; }
+Floatx4 Floatx4::operator +=(const Floatx4& v) { return *this = *this + v; }
+Floatx4 Floatx4::operator -=(const Floatx4& v) { return *this = *this - v; }
+Floatx4 Floatx4::operator *=(const Floatx4& v) { return *this = *this * v; }
+Floatx4 Floatx4::operator /=(const Floatx4& v) { return *this = *this / v; }
+
+Floatx4 operator +(const Floatx4& a, const Floatx4& b)
+{
+#ifdef _MATH_SIMD_INTRINSIC_
+	return _mm_add_ps(a.m, b.m);
+#else
+	return Floatx4(a.f[0] + b.f[0], a.f[1] + b.f[1], a.f[2] + b.f[2], a.f[3] + b.f[3]);
+#endif
+}
+
+Floatx4 operator -(const Floatx4& a, const Floatx4& b)
+{
+#ifdef _MATH_SIMD_INTRINSIC_
+	return _mm_sub_ps(a.m, b.m);
+#else
+	return Floatx4(a.f[0] - b.f[0], a.f[1] - b.f[1], a.f[2] - b.f[2], a.f[3] - b.f[3]);
+#endif
+}
+
+Floatx4 operator *(const Floatx4& a, const Floatx4& b)
+{
+#ifdef _MATH_SIMD_INTRINSIC_
+	return _mm_mul_ps(a.m, b.m);
+#else
+	return Floatx4(a.f[0] * b.f[0], a.f[1] * b.f[1], a.f[2] * b.f[2], a.f[3] * b.f[3]);
+#endif
+}
+
+Floatx4 operator /(const Floatx4& a, const Floatx4& b)
+{
+#ifdef _MATH_SIMD_INTRINSIC_
+	return _mm_div_ps(a.m, b.m);
+#else
+	return Floatx4(a.f[0] / b.f[0], a.f[1] / b.f[1], a.f[2] / b.f[2], a.f[3] / b.f[3]);
+#endif
+}
+
+Floatx4 operator <(const Floatx4& a, const Floatx4& b)
+{
+#ifdef _MATH_SIMD_INTRINSIC_
+	return _mm_cmplt_ps(a.m, b.m);
+#else
+	Floatx4 mask;
+	for (int i = 0; i < 4; ++i) mask.u[i] = (a.f[i] < b.f[i]) ? 0xFFFFFFFF : 0x0;
+	return mask;
+#endif
+}
+
+Floatx4 operator >(const Floatx4& a, const Floatx4& b)
+{
+	return b < a;
+}
+
+Floatx4 Floatx4::Min(const Floatx4& a, const Floatx4& b)
+{
+#ifdef _MATH_SIMD_INTRINSIC_
+	return _mm_min_ps(a.m, b.m);
+#else
+	return Floatx4(Mathf::Min(a.f[0], b.f[0]), Mathf::Min(a.f[1], b.f[1]), Mathf::Min(a.f[2], b.f[2]), Mathf::Min(a.f[3], b.f[3]));
+#endif
+}
+
+Floatx4 Floatx4::Max(const Floatx4& a, const Floatx4& b)
+{
+#ifdef _MATH_SIMD_INTRINSIC_
+	return _mm_max_ps(a.m, b.m);
+#else
+	return Floatx4(Mathf::Max(a.f[0], b.f[0]), Mathf::Max(a.f[1], b.f[1]), Mathf::Max(a.f[2], b.f[2]), Mathf::Max(a.f[3], b.f[3]));
+#endif
+}
+
+Floatx4 Floatx4::Clamp01(const Floatx4& v)
+{
+	return Min(Max(v, Floatx4(0.f)), Floatx4(1.f));
+}
+
+Floatx4 Floatx4::Sqrt(const Floatx4& v)
+{
+#ifdef _MATH_SIMD_INTRINSIC_
+	return _mm_sqrt_ps(v.m);
+#else
+	return Floatx4(Mathf::Sqrt(v.f[0]), Mathf::Sqrt(v.f[1]), Mathf::Sqrt(v.f[2]), Mathf::Sqrt(v.f[3]));
+#endif
+}
+
+Floatx4 Floatx4::InvSqrt(const Floatx4& v)
+{
+#ifdef _MATH_SIMD_INTRINSIC_
+	return _mm_rsqrt_ps(v.m);
+#else
+	return Floatx4(Mathf::InvSqrt(v.f[0]), Mathf::InvSqrt(v.f[1]), Mathf::InvSqrt(v.f[2]), Mathf::InvSqrt(v.f[3]));
+#endif
+}
+
+Floatx4 Floatx4::Pow(const Floatx4& v, const Floatx4& p)
+{
+	return Floatx4(Mathf::Pow(v.f[0], p.f[0]), Mathf::Pow(v.f[1], p.f[1]), Mathf::Pow(v.f[2], p.f[2]), Mathf::Pow(v.f[3], p.f[3]));
+}
+
+Floatx4 Floatx4::Lerp(const Floatx4& a, const Floatx4& b, const Floatx4& t)
+{
+	return a + (b - a) * t;
+}
+
+Floatx4 Floatx4::Select(const Floatx4& mask, const Floatx4& a, const Floatx4& b)
+{
+#ifdef _MATH_SIMD_INTRINSIC_
+	return _mm_blendv_ps(b.m, a.m, mask.m);
+#else
+	Floatx4 ret;
+	for (int i = 0; i < 4; ++i) ret.f[i] = mask.u[i] ? a.f[i] : b.f[i];
+	return ret;
+#endif
+}
+
+int Floatx4::MoveMask(const Floatx4& mask)
+{
+#ifdef _MATH_SIMD_INTRINSIC_
+	return _mm_movemask_ps(mask.m);
+#else
+	return (int)((mask.u[0] >> 31) | ((mask.u[1] >> 31) << 1) | ((mask.u[2] >> 31) << 2) | ((mask.u[3] >> 31) << 3));
+#endif
+}
+
+Vector2 Vector2x4::Get(int index) const { return Vector2(x[index], y[index]); }
+void Vector2x4::Set(int index, const Vector2& v) { x[index] = v.x; y[index] = v.y; }
+
+Vector2x4 Vector2x4::operator +(const Vector2x4& v) const { return Vector2x4(x + v.x, y + v.y); }
+Vector2x4 Vector2x4::operator -(const Vector2x4& v) const { return Vector2x4(x - v.x, y - v.y); }
+Vector2x4 Vector2x4::operator *(const Floatx4& f) const { return Vector2x4(x * f, y * f); }
+
+Vector3 Vector3x4::Get(int index) const { return Vector3(x[index], y[index], z[index]); }
+void Vector3x4::Set(int index, const Vector3& v) { x[index] = v.x; y[index] = v.y; z[index] = v.z; }
+
+Floatx4 Vector3x4::Length() const { return Floatx4::Sqrt(SqrLength()); }
+Floatx4 Vector3x4::SqrLength() const { return x * x + y * y + z * z; }
+// a full sqrt and division, the 12 bits of the rsqrt estimate show in the normals of the lighting
+Vector3x4 Vector3x4::Normalize() const { return this->operator/(Length()); }
+Floatx4 Vector3x4::Dot(const Vector3x4& v) const { return x * v.x + y * v.y + z * v.z; }
+
+Vector3x4 Vector3x4::Cross(const Vector3x4& v) const
+{
+	return Vector3x4(
+		y * v.z - z * v.y,
+		z * v.x - x * v.z,
+		x * v.y - y * v.x);
+}
+
+Vector3x4 Vector3x4::operator -() const { return Vector3x4(-x, -y, -z); }
+Vector3x4 Vector3x4::operator +(const Vector3x4& v) const { return Vector3x4(x + v.x, y + v.y, z + v.z); }
+Vector3x4 Vector3x4::operator -(const Vector3x4& v) const { return Vector3x4(x - v.x, y - v.y, z - v.z); }
+Vector3x4 Vector3x4::operator *(const Vector3x4& v) const { return Vector3x4(x * v.x, y * v.y, z * v.z); }
+Vector3x4 Vector3x4::operator *(const Floatx4& f) const { return Vector3x4(x * f, y * f, z * f); }
+Vector3x4 Vector3x4::operator /(const Floatx4& f) const { return this->operator*(Floatx4(1.f) / f); }
+Vector3x4 Vector3x4::operator +=(const Vector3x4& v) { return *this = *this + v; }
+Vector3x4 Vector3x4::operator -=(const Vector3x4& v) { return *this = *this - v; }
+Vector3x4 Vector3x4::operator *=(const Floatx4& f) { return *this = *this * f; }
+
+Vector3x4 Vector3x4::LinearInterp(const Vector3x4& a, const Vector3x4& b, const Floatx4& t)
+{
+	return Vector3x4(Floatx4::Lerp(a.x, b.x, t), Floatx4::Lerp(a.y, b.y, t), Floatx4::Lerp(a.z, b.z, t));
+}
+
+Vector3x4 Vector3x4::Select(const Floatx4& mask, const Vector3x4& a, const Vector3x4& b)
+{
+	return Vector3x4(Floatx4::Select(mask, a.x, b.x), Floatx4::Select(mask, a.y, b.y), Floatx4::Select(mask, a.z, b.z));
+}
+
+Color Colorx4::Get(int index) const { return Color(rgb.Get(index), a[index]); }
+void Colorx4::Set(int index, const Color& color) { rgb.Set(index, color.rgb); a[index] = color.a; }
+
+Colorx4 Colorx4::operator +(const Colorx4& color) const { return Colorx4(rgb + color.rgb, a + color.a); }
+Colorx4 Colorx4::operator *(const Colorx4& color) const { return Colorx4(rgb * color.rgb, a * color.a); }
+Colorx4 Colorx4::operator *(const Floatx4& f) const { return Colorx4(rgb * f, a * f); }
+
+} // namespace sr
+
+#endif // !_MATH_VECTORX4_INLINE_
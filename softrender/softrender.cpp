@@ -5,23 +5,50 @@ namespace sr
 
 CameraPtr SoftRender::camera = nullptr;
 LightPtr SoftRender::light = nullptr;
+std::vector<LightPtr> SoftRender::lights;
 ShaderPtr SoftRender::shader = nullptr;
+IShader::CloneFunc SoftRender::shaderCloneFunc = nullptr;
+IShader::CopyFunc SoftRender::shaderCopyFunc = nullptr;
 RenderTexturePtr SoftRender::defaultRenderTarget = nullptr;
 RenderTexturePtr SoftRender::renderTarget = nullptr;
 BitmapPtr SoftRender::colorBuffer = nullptr;
-BitmapPtr SoftRender::depthBuffer = nullptr;
-StencilBufferPtr SoftRender::stencilBuffer = nullptr;
+DepthStencilBufferPtr SoftRender::depthStencilBuffer = nullptr;
+HiZBufferPtr SoftRender::hizBuffer = nullptr;
+std::vector<BitmapPtr> SoftRender::clearedBitmaps;
 Matrix4x4 SoftRender::modelMatrix;
+CameraUniforms SoftRender::cameraUniforms;
+ObjectUniforms SoftRender::objectUniforms;
 RenderState SoftRender::renderState;
+PipelineStatePtr SoftRender::pipelineState = nullptr;
+PipelineStatePtr SoftRender::renderStatePipeline = nullptr;
+PipelineStatePtr SoftRender::drawState = nullptr;
+PixelTargets SoftRender::pixelTargets;
 RenderData SoftRender::renderData;
-VaryingDataBuffer SoftRender::varyingDataBuffer;
+std::shared_ptr<VaryingDataBuffer> SoftRender::varyingDataBuffer = nullptr;
 Rasterizer SoftRender::rasterizer;
-
-void SoftRender::Initialize(int width, int height)
+Tiler SoftRender::tiler;
+OcclusionCuller SoftRender::occlusionCuller;
+std::vector<SoftRender::RenderContext> SoftRender::renderContexts;
+std::vector<SoftRender::BinnedTriangle> SoftRender::binnedTriangles;
+bool SoftRender::isVisibilityPass = false;
+VisibilityBufferPtr SoftRender::visibilityBuffer = nullptr;
+std::vector<SoftRender::VisibilityDraw> SoftRender::visibilityDraws;
+LightGrid SoftRender::lightGrid;
+bool SoftRender::isQueryActive = false;
+uint64_t SoftRender::queryPassedSamples = 0;
+
+// rasterizer blocks map to single hierarchical z blocks, and no block is shared between tiles
+static_assert(HiZBuffer::BLOCK_SIZE == Rasterizer::BLOCK_SIZE, "hierarchical z and rasterizer blocks differ");
+static_assert(Tiler::TILE_SIZE % HiZBuffer::BLOCK_SIZE == 0, "tiles must hold whole hierarchical z blocks");
+static_assert(Tiler::TILE_SIZE % Bitmap::TILE_SIZE == 0, "tiles must hold whole tiles of a tiled bitmap");
+
+void SoftRender::Initialize(int width, int height, int workerCount/* = 0*/, bool affinity/* = false*/, Bitmap::Layout layout/* = Bitmap::Layout_Linear*/)
 {
     Texture2D::Initialize();
+	Rasterizer::SelectKernel();
+	JobSystem::Initialize(workerCount, affinity);
 
-	defaultRenderTarget = std::make_shared<RenderTexture>(width, height);
+	defaultRenderTarget = std::make_shared<RenderTexture>(width, height, layout);
 	SetRenderTarget(defaultRenderTarget);
 }
 
@@ -31,7 +58,10 @@ void SoftRender::SetRenderTarget(RenderTexturePtr target)
 	else renderTarget = target;
 
 	colorBuffer = renderTarget->GetColorBuffer();
-	depthBuffer = renderTarget->GetDepthBuffer();
+	depthStencilBuffer = renderTarget->GetDepthStencilBuffer();
+	hizBuffer = renderTarget->GetHiZBuffer();
+	// the depth bitmap may have been written while the target was not bound
+	hizBuffer->Invalidate();
 }
 
 RenderTexturePtr SoftRender::GetRenderTarget()
@@ -41,59 +71,89 @@ RenderTexturePtr SoftRender::GetRenderTarget()
 
 void SoftRender::ClearStencilBuffer(uint8_t stencil)
 {
-	if (stencilBuffer == nullptr)
-	{
-		stencilBuffer = std::make_shared<StencilBuffer>(renderTarget->GetWidth(), renderTarget->GetHeight());
-	}
-	stencilBuffer->Fill(stencil);
+	depthStencilBuffer->ClearStencil(stencil);
+	AddClearedBitmap(depthStencilBuffer);
 }
 
-StencilBufferPtr SoftRender::GetStencilBuffer()
+DepthStencilBufferPtr SoftRender::GetDepthStencilBuffer()
 {
-	return stencilBuffer;
+	return depthStencilBuffer;
 }
 
 void SoftRender::Submit(int startIndex/* = 0*/, int primitiveCount/* = 0*/)
+{
+	DrawStages<IShader>(startIndex, primitiveCount);
+}
+
+bool SoftRender::BeginDraw()
 {
 	assert(camera != nullptr);
+	assert(shader != nullptr);
 
 	int width = renderTarget->GetWidth();
 	int height = renderTarget->GetHeight();
 
-	shader->_WorldToCamera = camera->viewMatrix();
-	shader->_CameraToWorld = camera->transform.localToWorldMatrix();
+	cameraUniforms.Setup(*camera, width, height);
 
-	shader->_MATRIX_P = camera->projectionMatrix();
-	shader->_MATRIX_VP = shader->_MATRIX_P.Multiply(shader->_WorldToCamera);
-	shader->_Object2World = modelMatrix;
-	shader->_World2Object = modelMatrix.Inverse();
-	shader->_MATRIX_MV = shader->_WorldToCamera.Multiply(modelMatrix);
-	shader->_MATRIX_MVP = shader->_MATRIX_VP.Multiply(modelMatrix);
+	// without a bound pipeline state renderState is used, compiled again only when it changed since the last such draw
+	if (pipelineState == nullptr && (renderStatePipeline == nullptr || renderStatePipeline->GetRenderState() != renderState))
+	{
+		renderStatePipeline = PipelineState::Create(renderState);
+	}
+	drawState = (pipelineState != nullptr) ? pipelineState : renderStatePipeline;
+	const RenderState& state = drawState->GetRenderState();
+
+	// a draw hidden behind the occluders can't pass a nearer-wins depth test, skip it before the vertex stage.
+	// unless its hidden pixels write the stencil
+	bool isOcclusionTested = (state.zTest == RenderState::ZTestType_Less
+		|| state.zTest == RenderState::ZTestType_LEqual
+		|| state.zTest == RenderState::ZTestType_Equal)
+		&& !drawState->WritesOnFail();
+	if (isOcclusionTested && renderData.HasBounds()
+		&& occlusionCuller.IsOccluded(renderData.GetBoundsMin(), renderData.GetBoundsMax(), modelMatrix, cameraUniforms.viewProjection))
+	{
+		return false;
+	}
 
-	shader->_WorldSpaceCameraPos = camera->transform.position;
-	shader->_ScreenParams = Vector4((float)width, (float)height, 1.f + 1.f / (float)width, 1.f + 1.f / (float)height);
-	shader->_ZBufferParams = Vector4(camera->zFar(), camera->zNear(), 0.f, 0.f);
+	objectUniforms.Setup(modelMatrix, cameraUniforms, shader->objectUniformUsage);
+	shader->SetUniforms(cameraUniforms, objectUniforms);
 
 	InitShaderLightParams(shader, light);
+	InitShaderLights(shader);
+	shader->_LightGrid = &lightGrid;
+
+	pixelTargets.colorBuffer = colorBuffer.get();
+	for (int k = 0; k < 3; ++k) pixelTargets.gbuffers[k] = renderTarget->GetGBuffer(k).get();
+	pixelTargets.depthStencilBuffer = depthStencilBuffer.get();
+	pixelTargets.hizBuffer = hizBuffer.get();
+	drawState->BindTargets(pixelTargets);
+	ResolveClearsOfSampled();
 
 	rasterizer.Initlize(width, height);
-	varyingDataBuffer.InitVaryingDataBuffer(shader->varyingDataSize);
+	tiler.Initialize(width, height);
+	Clipper::SetGuardBand(width, height);
+	InitRenderContexts();
+	// the draws of a visibility pass keep their varyings until the resolve
+	if (varyingDataBuffer == nullptr || isVisibilityPass) varyingDataBuffer = std::make_shared<VaryingDataBuffer>();
+	varyingDataBuffer->InitVaryingDataBuffer(shader->varyingDataSize, shader->varyingElements);
+	varyingDataBuffer->InitVerticesVaryingData(renderData.GetVertexCount());
+	return true;
+}
 
-	int vertexCount = renderData.GetVertexCount();
-	varyingDataBuffer.InitVerticesVaryingData(vertexCount);
-	for (int i = 0; i < vertexCount; ++i)
-	{
-		VertexVaryingData& varyingData = varyingDataBuffer.GetVertexVaryingData(i);
-		shader->varyingData = varyingData.data;
-		rawptr_t vertexData = renderData.GetVertexData<uint8_t>(i);
-		shader->_VSMain(vertexData);
+void SoftRender::BinTriangles(int startIndex, int primitiveCount)
+{
+	int width = renderTarget->GetWidth();
+	int height = renderTarget->GetHeight();
 
-		varyingData.position = *Buffer::Value<Vector4>(shader->varyingData, 0);
-		varyingData.clipCode = Clipper::CalculateClipCode(varyingData.position);
-	}
+	// clipped vertices are kept alive until the tiles are rendered
+	varyingDataBuffer->InitDynamicVaryingData();
+	varyingDataBuffer->ResetDynamicVaryingData();
+	varyingDataBuffer->InitTrianglePlaneData();
+	varyingDataBuffer->ResetTrianglePlaneData();
+	varyingDataBuffer->InitPixelVaryingData(4 * (int)renderContexts.size());
 
-	varyingDataBuffer.InitDynamicVaryingData();
-	varyingDataBuffer.InitPixelVaryingData(4);
+	binnedTriangles.clear();
+	tiler.Clear();
 
 	if (primitiveCount <= 0) primitiveCount = renderData.GetPrimitiveCount() - startIndex;
 	for (int i = 0; i < primitiveCount; ++i)
@@ -106,33 +166,28 @@ void SoftRender::Submit(int startIndex/* = 0*/, int primitiveCount/* = 0*/)
 			continue;
 		}
 
-		auto v0 = varyingDataBuffer.GetVertexVaryingData(triangleIdx.v0);
-		auto v1 = varyingDataBuffer.GetVertexVaryingData(triangleIdx.v1);
-		auto v2 = varyingDataBuffer.GetVertexVaryingData(triangleIdx.v2);
+		auto v0 = varyingDataBuffer->GetVertexVaryingData(triangleIdx.v0);
+		auto v1 = varyingDataBuffer->GetVertexVaryingData(triangleIdx.v1);
+		auto v2 = varyingDataBuffer->GetVertexVaryingData(triangleIdx.v2);
 
 		//if (renderState.FaceCulling(v0, v1, v2)) continue;
 
-		varyingDataBuffer.ResetDynamicVaryingData();
-		auto triangles = Clipper::ClipTriangle(v0, v1, v2);
-		for (auto& triangle : triangles)
+		// only triangles crossing near/far or the guard band are clipped,
+		// the rasterizer scissors the ones that just cross the viewport sides
+		if (v0.clipCode & v1.clipCode & v2.clipCode) continue;
+		if (0 == ((v0.clipCode | v1.clipCode | v2.clipCode) & Clipper::CLIPPING_MASK))
 		{
-			Triangle<Projection> projection;
-			projection.v0 = Projection::CalculateViewProjection(triangle.v0.position, width, height);
-			projection.v1 = Projection::CalculateViewProjection(triangle.v1.position, width, height);
-			projection.v2 = Projection::CalculateViewProjection(triangle.v2.position, width, height);
-			if (renderState.FaceCullingSimple(projection, triangle)) continue;
-
-			if (camera->projectionMode() == Camera::ProjectionMode_Perspective)
+			BinTriangle(Triangle<VertexVaryingData>(v0, v1, v2), width, height);
+		}
+		else
+		{
+			auto triangles = Clipper::ClipTriangle(v0, v1, v2);
+			for (auto& triangle : triangles)
 			{
-				projection.v0.z = camera->GetLinearDepth(projection.v0.z);
-				projection.v1.z = camera->GetLinearDepth(projection.v1.z);
-				projection.v2.z = camera->GetLinearDepth(projection.v2.z);
+				BinTriangle(triangle, width, height);
 			}
-
-			rasterizer.RasterizerTriangle<Triangle<VertexVaryingData> >(projection, Rasterizer2x2RenderFunc, triangle);
 		}
 
-
 		/* // draw wireframe
 		std::vector<Line<VertexVaryingData> > lines;
 		auto l1 = Clipper::ClipLine(v0, v1);
@@ -154,159 +209,233 @@ void SoftRender::Submit(int startIndex/* = 0*/, int primitiveCount/* = 0*/)
 	/* draw point
 	for (int i = 0; i < vertexCount; ++i)
 	{
-		auto data = varyingDataBuffer.GetVertexVaryingData(i);
+		auto data = varyingDataBuffer->GetVertexVaryingData(i);
 		if (data.clipCode != 0) continue;
 
 		Projection proj = Projection::CalculateViewProjection(data.position, width, height);
 		canvas->SetPixel(proj.x, proj.y, Color::red);
 	}
 	*/
+
 }
 
-void SoftRender::SetShader(ShaderPtr shader)
+void SoftRender::EndDraw()
 {
-	assert(shader != nullptr);
-	SoftRender::shader = shader;
+	if (isQueryActive)
+	{
+		for (auto& context : renderContexts) queryPassedSamples += context.passedSamples;
+	}
 }
 
-void SoftRender::RasterizerRenderFunc(const VertexVaryingData& data, const RasterizerInfo& info)
+void SoftRender::BeginVisibilityPass()
 {
-	int x = info.x;
-	int y = info.y;
-
-	if (!renderState.ZTest(info.depth, depthBuffer->GetAlpha(x, y))) return;
-
-	if (renderState.stencilOn) 
+	assert(!isVisibilityPass);
+	int width = renderTarget->GetWidth();
+	int height = renderTarget->GetHeight();
+	if (visibilityBuffer == nullptr || visibilityBuffer->GetWidth() != width || visibilityBuffer->GetHeight() != height)
 	{
-		uint8_t stencilContent = stencilBuffer->GetStencil(x, y);
-		if (!renderState.StencilTest(stencilContent)) return;
-		stencilBuffer->SetStencil(x, y, renderState.WriteStencil(stencilContent));
+		visibilityBuffer = std::make_shared<VisibilityBuffer>(width, height);
 	}
+	else
+	{
+		visibilityBuffer->Clear();
+	}
+	visibilityDraws.clear();
+	isVisibilityPass = true;
+}
 
-	shader->varyingData = data.data;
-	shader->isClipped = false;
-	shader->SV_Target0 = Color::clear;
-	shader->SV_Target1 = Color::clear;
-	shader->SV_Target2 = Color::clear;
-	shader->SV_Target3 = Color::clear;
-	shader->_PSMain();
-	if (!shader->isClipped)
+void SoftRender::EndVisibilityPass()
+{
+	assert(isVisibilityPass);
+	isVisibilityPass = false;
+	if (visibilityDraws.empty()) return;
+
+	int tileCountX = (visibilityBuffer->GetWidth() + Tiler::TILE_SIZE - 1) >> Tiler::TILE_SIZE_SHIFT;
+	int tileCountY = (visibilityBuffer->GetHeight() + Tiler::TILE_SIZE - 1) >> Tiler::TILE_SIZE_SHIFT;
+	int tileCount = tileCountX * tileCountY;
+	if (visibilityDraws[0].shaders.size() > 1)
 	{
-		if (renderState.alphaBlend)
+		JobSystem::ParallelFor(tileCount, [tileCountX](int index, int threadIndex)
 		{
-			auto buffer = renderTarget->GetColorBuffer();
-			buffer->SetPixel(x, y, renderState.Blend(shader->SV_Target0, buffer->GetPixel(x, y)));
-
-			for (int k = 0; k < 3; ++k)
-			{
-				buffer = renderTarget->GetGBuffer(k);
-				if (buffer)
-				{
-					buffer->SetPixel(x, y, renderState.Blend(ShaderGBufferOutput(shader, k), buffer->GetPixel(x, y)));
-				}
-			}
-		}
-		else
+			ResolveVisibilityTile(threadIndex, (index % tileCountX) << Tiler::TILE_SIZE_SHIFT, (index / tileCountX) << Tiler::TILE_SIZE_SHIFT);
+		});
+	}
+	else
+	{
+		for (int i = 0; i < tileCount; ++i)
 		{
-			auto buffer = renderTarget->GetColorBuffer();
-			buffer->SetPixel(x, y, shader->SV_Target0);
-
-			for (int k = 0; k < 3; ++k)
-			{
-				buffer = renderTarget->GetGBuffer(k);
-				if (buffer)
-				{
-					buffer->SetPixel(x, y, ShaderGBufferOutput(shader, k));
-				}
-			}
+			ResolveVisibilityTile(0, (i % tileCountX) << Tiler::TILE_SIZE_SHIFT, (i / tileCountX) << Tiler::TILE_SIZE_SHIFT);
 		}
-		if (renderState.zWrite) depthBuffer->SetAlpha(x, y, info.depth);
 	}
+	visibilityDraws.clear();
 }
 
-void SoftRender::Rasterizer2x2RenderFunc(const Triangle<VertexVaryingData>& data, const Rasterizer2x2Info& quad)
+void SoftRender::BuildLightGrid(const std::vector<LightPtr>& lights)
 {
-	static int quadX[4] = { 0, 1, 0, 1 };
-	static int quadY[4] = { 0, 0, 1, 1 };
+	assert(camera != nullptr);
+	lightGrid.Build(lights, camera, *hizBuffer, renderTarget->GetWidth(), renderTarget->GetHeight());
+}
 
-	rawptr_t pixelVaryingDataQuad[4];
-	for (int i = 0; i < 4; ++i)
+int SoftRender::VisibilityRenderFunc(int drawIndex, const BinnedTriangle& binned, const Rasterizer2x2Info& quad)
+{
+	static const int quadX[4] = { 0, 1, 0, 1 };
+	static const int quadY[4] = { 0, 0, 1, 1 };
+
+	const PipelineState& state = *drawState;
+	uint8_t liveMask = state.TestQuad(pixelTargets, quad, binned.isBackFace);
+	if (liveMask == 0) return 0;
+
+	uint32_t id = VisibilityBuffer::MakeID(drawIndex, (int)(&binned - binnedTriangles.data()));
+	bool zWrite = state.GetRenderState().zWrite;
+	if (zWrite)
 	{
-		pixelVaryingDataQuad[i] = VertexVaryingData::TriangleInterp(i, data.v0, data.v1, data.v2, quad.wx[i], quad.wy[i], quad.wz[i]);
+		pixelTargets.depthStencilBuffer->WriteQuadDepth(quad.x, quad.y, quad.depth, liveMask);
+		pixelTargets.hizBuffer->OnQuadDepthWrite(quad.x, quad.y, liveMask);
 	}
-	shader->_PassQuad(pixelVaryingDataQuad);
 
+	int passedSamples = 0;
 	for (int i = 0; i < 4; ++i)
 	{
-		if (!(quad.maskCode & (1 << i))) continue;
+		if (!(liveMask & (1 << i))) continue;
 
-		int x = quad.x + quadX[i];
-		int y = quad.y + quadY[i];
-
-		if (!renderState.ZTest(quad.depth[i], depthBuffer->GetAlpha(x, y))) continue;
-
-		if (renderState.stencilOn)
-		{
-			uint8_t stencilContent = stencilBuffer->GetStencil(x, y);
-			if (!renderState.StencilTest(stencilContent)) return;
-			stencilBuffer->SetStencil(x, y, renderState.WriteStencil(stencilContent));
-		}
+		visibilityBuffer->SetID(quad.x + quadX[i], quad.y + quadY[i], id);
+		++passedSamples;
+	}
+	return passedSamples;
+}
 
-		shader->varyingData = pixelVaryingDataQuad[i];
-		shader->isClipped = false;
-		shader->SV_Target0 = Color::clear;
-		shader->SV_Target1 = Color::clear;
-		shader->SV_Target2 = Color::clear;
-		shader->SV_Target3 = Color::clear;
-		shader->_PSMain();
-		if (!shader->isClipped)
+void SoftRender::ResolveVisibilityTile(int threadIndex, int minX, int minY)
+{
+	static const int quadX[4] = { 0, 1, 0, 1 };
+	static const int quadY[4] = { 0, 0, 1, 1 };
+
+	int width = visibilityBuffer->GetWidth();
+	int height = visibilityBuffer->GetHeight();
+	int maxX = Mathf::Min(minX + Tiler::TILE_SIZE, width);
+	int maxY = Mathf::Min(minY + Tiler::TILE_SIZE, height);
+	for (int y = minY; y < maxY; y += 2)
+	{
+		for (int x = minX; x < maxX; x += 2)
 		{
-			if (renderState.alphaBlend)
+			uint32_t ids[4];
+			uint8_t pendingMask = 0x0;
+			for (int i = 0; i < 4; ++i)
 			{
-				auto buffer = renderTarget->GetColorBuffer();
-				buffer->SetPixel(x, y, renderState.Blend(shader->SV_Target0, buffer->GetPixel(x, y)));
-
-				for (int k = 0; k < 3; ++k)
-				{
-					buffer = renderTarget->GetGBuffer(k);
-					if (buffer)
-					{
-						buffer->SetPixel(x, y, renderState.Blend(ShaderGBufferOutput(shader, k), buffer->GetPixel(x, y)));
-					}
-				}
+				int px = x + quadX[i];
+				int py = y + quadY[i];
+				ids[i] = (px < width && py < height) ? visibilityBuffer->GetID(px, py) : VisibilityBuffer::INVALID_ID;
+				if (ids[i] != VisibilityBuffer::INVALID_ID) pendingMask |= (1 << i);
 			}
-			else
-			{
-				auto buffer = renderTarget->GetColorBuffer();
-				buffer->SetPixel(x, y, shader->SV_Target0);
 
-				for (int k = 0; k < 3; ++k)
+			// the pixels of a quad won by the same triangle are shaded together, the others are its helper lanes
+			while (pendingMask != 0)
+			{
+				int first = 0;
+				while (!(pendingMask & (1 << first))) ++first;
+				uint32_t id = ids[first];
+				uint8_t liveMask = 0x0;
+				for (int i = 0; i < 4; ++i)
 				{
-					buffer = renderTarget->GetGBuffer(k);
-					if (buffer)
-					{
-						buffer->SetPixel(x, y, ShaderGBufferOutput(shader, k));
-					}
+					if ((pendingMask & (1 << i)) && ids[i] == id) liveMask |= (1 << i);
 				}
+				pendingMask &= ~liveMask;
+
+				const VisibilityDraw& draw = visibilityDraws[VisibilityBuffer::GetDraw(id)];
+				const BinnedTriangle& binned = draw.binnedTriangles[VisibilityBuffer::GetTriangle(id)];
+				Rasterizer2x2Info quad;
+				Rasterizer::InterpolateQuad(binned.projection, x, y, quad);
+				quad.maskCode = liveMask;
+				draw.resolveFunc(draw, threadIndex, binned, quad);
 			}
-			if (renderState.zWrite) depthBuffer->SetAlpha(x, y, quad.depth[i]);
 		}
 	}
 }
 
-const Color& SoftRender::ShaderGBufferOutput(ShaderPtr& shader, int index)
+void SoftRender::BeginQuery()
+{
+	assert(!isQueryActive);
+	isQueryActive = true;
+	queryPassedSamples = 0;
+}
+
+uint64_t SoftRender::EndQuery()
+{
+	assert(isQueryActive);
+	isQueryActive = false;
+	return queryPassedSamples;
+}
+
+void SoftRender::BinTriangle(Triangle<VertexVaryingData> triangle, int width, int height)
+{
+	Triangle<Projection> projection;
+	projection.v0 = Projection::CalculateViewProjection(triangle.v0.position, width, height);
+	projection.v1 = Projection::CalculateViewProjection(triangle.v1.position, width, height);
+	projection.v2 = Projection::CalculateViewProjection(triangle.v2.position, width, height);
+	bool isBackFace = false;
+	if (drawState->GetRenderState().FaceCullingSimple(projection, triangle, isBackFace)) return;
+
+	if (camera->projectionMode() == Camera::ProjectionMode_Perspective)
+	{
+		projection.v0.z = camera->GetLinearDepth(projection.v0.z);
+		projection.v1.z = camera->GetLinearDepth(projection.v1.z);
+		projection.v2.z = camera->GetLinearDepth(projection.v2.z);
+	}
+
+	int minX = Mathf::Max(Mathf::Min(projection.v0.x, projection.v1.x, projection.v2.x), 0);
+	int minY = Mathf::Max(Mathf::Min(projection.v0.y, projection.v1.y, projection.v2.y), 0);
+	int maxX = Mathf::Min(Mathf::Max(projection.v0.x, projection.v1.x, projection.v2.x), width - 1);
+	int maxY = Mathf::Min(Mathf::Max(projection.v0.y, projection.v1.y, projection.v2.y), height - 1);
+	if (maxX < minX || maxY < minY) return;
+
+	tiler.Bin((int)binnedTriangles.size(), minX, minY, maxX, maxY);
+	binnedTriangles.emplace_back();
+	BinnedTriangle& binned = binnedTriangles.back();
+	binned.projection = projection;
+	binned.triangle = triangle;
+	binned.isBackFace = isBackFace;
+	binned.planes = varyingDataBuffer->CreateTrianglePlaneData();
+	varyingDataBuffer->SetupTrianglePlaneData(binned.planes, triangle);
+}
+
+void SoftRender::InitRenderContexts()
+{
+	// the calling thread renders with the shader itself, workers with their own copies. the copies are kept
+	// across draws and get the uniforms of each draw copied over, SetShader drops them for another shader
+	int threadCount = (shaderCloneFunc != nullptr) ? JobSystem::GetThreadCount() : 1;
+	static bool isSingleThreadReported = false;
+	if (threadCount < JobSystem::GetThreadCount() && !isSingleThreadReported)
+	{
+		isSingleThreadReported = true;
+		printf("%s is shaded on one thread, bind it to SetShader as a std::shared_ptr of its type\n", typeid(*shader).name());
+	}
+	renderContexts.resize(threadCount);
+	for (int i = 0; i < threadCount; ++i)
+	{
+		RenderContext& context = renderContexts[i];
+		context.threadIndex = i;
+		context.passedSamples = 0;
+		if (i == 0) context.shader = shader;
+		else if (context.shader == nullptr) context.shader = shaderCloneFunc(*shader);
+		else shaderCopyFunc(*context.shader, *shader);
+	}
+}
+
+void SoftRender::SetPipelineState(PipelineStatePtr state)
+{
+	pipelineState = state;
+}
+
+void SoftRender::SetShader(ShaderPtr shader)
 {
-	switch (index)
+	assert(shader != nullptr);
+	// the workers' copies may be of another shader type
+	if (shader != SoftRender::shader)
 	{
-	case 0:
-		return shader->SV_Target1;
-	case 1:
-		return shader->SV_Target2;
-	case 2:
-		return shader->SV_Target3;
-	default:
-		throw std::out_of_range("g-buffer index out of range!");
+		for (size_t i = 1; i < renderContexts.size(); ++i) renderContexts[i].shader = nullptr;
 	}
+	SoftRender::shader = shader;
+	SoftRender::shaderCloneFunc = nullptr;
+	SoftRender::shaderCopyFunc = nullptr;
 }
 
 bool SoftRender::InitShaderLightParams(ShaderPtr shader, const LightPtr& light)
@@ -318,41 +447,155 @@ bool SoftRender::InitShaderLightParams(ShaderPtr shader, const LightPtr& light)
 		return false;
 	}
 
-	light->Initilize();
-	if (light->type == Light::LightType_Directional)
+	LightData data = light->GetLightData();
+	shader->_WorldSpaceLightPos = data.worldSpacePos;
+	shader->_LightColor = data.color;
+	shader->_LightAtten = data.atten;
+	shader->_SpotLightDir = data.spotDir;
+	shader->_SpotLightParams = data.spotParams;
+	return true;
+}
+
+void SoftRender::InitShaderLights(ShaderPtr shader)
+{
+	shader->_LightCount = 0;
+	if (lights.empty()) return;
+
+	// world space box of the drawn object
+	bool hasBounds = renderData.HasBounds();
+	Vector3 boundsMin(Mathf::inifinity, Mathf::inifinity, Mathf::inifinity);
+	Vector3 boundsMax(-Mathf::inifinity, -Mathf::inifinity, -Mathf::inifinity);
+	if (hasBounds)
 	{
-		shader->_WorldSpaceLightPos = Vector4(light->transform.forward(), 0.f);
+		const Vector3& localMin = renderData.GetBoundsMin();
+		const Vector3& localMax = renderData.GetBoundsMax();
+		for (int i = 0; i < 8; ++i)
+		{
+			Vector3 corner((i & 1) ? localMax.x : localMin.x, (i & 2) ? localMax.y : localMin.y, (i & 4) ? localMax.z : localMin.z);
+			corner = modelMatrix.MultiplyPoint3x4(corner);
+			boundsMin = Vector3::Min(boundsMin, corner);
+			boundsMax = Vector3::Max(boundsMax, corner);
+		}
 	}
-	else
+
+	// influence of every light on the nearest point of the box, lights out of range are dropped.
+	// the strongest are inserted into _Lights in order, the weakest falling off the end
+	float influences[IShader::MAX_LIGHT_COUNT];
+	int count = 0;
+	for (auto& light : lights)
 	{
-		shader->_WorldSpaceLightPos = Vector4(light->transform.position, 1.f);
-		if (light->type == Light::LightType_Spot)
+		LightData data = light->GetLightData();
+		float influence = Mathf::Max(data.color.r, Mathf::Max(data.color.g, data.color.b));
+		if (hasBounds && !Mathf::Approximately(data.worldSpacePos.w, 0.f))
 		{
-			shader->_SpotLightDir = Vector3(light->transform.forward());
-			shader->_SpotLightParams = Vector3(light->cosHalfPhi, light->cosHalfTheta, light->falloff);
+			Vector3 closest = Vector3::Max(boundsMin, Vector3::Min(data.worldSpacePos.xyz, boundsMax));
+			float distance = (closest - data.worldSpacePos.xyz).Length();
+			if (distance > data.atten.w) continue;
+			influence /= data.atten.x + data.atten.y * distance + data.atten.z * distance * distance;
 		}
-		else
+		if (count == IShader::MAX_LIGHT_COUNT && influence <= influences[count - 1]) continue;
+
+		int i = (count < IShader::MAX_LIGHT_COUNT) ? count++ : count - 1;
+		for (; i > 0 && influences[i - 1] < influence; --i)
 		{
-			shader->_SpotLightParams = Vector3(-1.f, -1.f, 0.f);
+			influences[i] = influences[i - 1];
+			shader->_Lights[i] = shader->_Lights[i - 1];
 		}
+		influences[i] = influence;
+		shader->_Lights[i] = data;
 	}
-	shader->_LightColor = light->color;
-	shader->_LightColor *= light->intensity;
-	shader->_LightAtten = Vector4(light->atten0, light->atten1, light->atten2, light->range);
-	return true;
+	shader->_LightCount = count;
 }
 
 void SoftRender::Clear(bool clearColor, bool clearDepth, const Color& backgroundColor, float depth /*= 1.0f*/)
 {
-	if (clearColor) colorBuffer->Fill(backgroundColor);
-	if (clearDepth) depthBuffer->Fill(Color(depth, 0.f, 0.f, 0.f));
+	Clear(0, 0, renderTarget->GetWidth() - 1, renderTarget->GetHeight() - 1, clearColor, clearDepth, backgroundColor, depth);
+}
+
+void SoftRender::Clear(int minX, int minY, int maxX, int maxY, bool clearColor, bool clearDepth, const Color& backgroundColor, float depth /*= 1.0f*/)
+{
+	if (clearColor)
+	{
+		colorBuffer->Clear(backgroundColor, minX, minY, maxX, maxY);
+		AddClearedBitmap(colorBuffer);
+		for (int k = 0; k < 3; ++k)
+		{
+			BitmapPtr gbuffer = renderTarget->GetGBuffer(k);
+			if (gbuffer == nullptr) continue;
+			gbuffer->Clear(backgroundColor, minX, minY, maxX, maxY);
+			AddClearedBitmap(gbuffer);
+		}
+	}
+	if (clearDepth)
+	{
+		depthStencilBuffer->ClearDepth(depth, minX, minY, maxX, maxY);
+		AddClearedBitmap(depthStencilBuffer);
+		bool isWholeTarget = minX <= 0 && minY <= 0 && maxX >= renderTarget->GetWidth() - 1 && maxY >= renderTarget->GetHeight() - 1;
+		if (isWholeTarget) hizBuffer->Clear(depth);
+		else hizBuffer->Invalidate();
+		// the occluders stood in front of the depth that was cleared
+		occlusionCuller.Initialize(renderTarget->GetWidth(), renderTarget->GetHeight());
+		occlusionCuller.Clear();
+	}
+}
+
+void SoftRender::AddClearedBitmap(const BitmapPtr& bitmap)
+{
+	if (std::find(clearedBitmaps.begin(), clearedBitmaps.end(), bitmap) == clearedBitmaps.end()) clearedBitmaps.push_back(bitmap);
+}
+
+void SoftRender::ResolveClearsOfSampled()
+{
+	// the targets the draw renders to are resolved tile by tile as it reaches them. a depth buffer
+	// the draw only tests may be sampled by it, like one it doesn't use at all
+	for (auto it = clearedBitmaps.begin(); it != clearedBitmaps.end();)
+	{
+		const Bitmap* bitmap = it->get();
+		bool isTarget = bitmap == pixelTargets.colorBuffer
+			|| bitmap == pixelTargets.gbuffers[0] || bitmap == pixelTargets.gbuffers[1] || bitmap == pixelTargets.gbuffers[2]
+			|| (bitmap == pixelTargets.depthStencilBuffer && drawState->WritesDepthStencil());
+		if (isTarget && bitmap->HasPendingClears())
+		{
+			++it;
+			continue;
+		}
+		bitmap->ResolveClears();
+		it = clearedBitmaps.erase(it);
+	}
+}
+
+void SoftRender::ResolveTargetClears(const Tile& tile)
+{
+	pixelTargets.colorBuffer->ResolveClears(tile.minX, tile.minY, tile.maxX, tile.maxY);
+	for (int k = 0; k < 3; ++k)
+	{
+		if (pixelTargets.gbuffers[k]) pixelTargets.gbuffers[k]->ResolveClears(tile.minX, tile.minY, tile.maxX, tile.maxY);
+	}
+	pixelTargets.depthStencilBuffer->ResolveClears(tile.minX, tile.minY, tile.maxX, tile.maxY);
+}
+
+void SoftRender::AddOccluder(const Mesh& mesh)
+{
+	assert(camera != nullptr);
+	occlusionCuller.Initialize(renderTarget->GetWidth(), renderTarget->GetHeight());
+	occlusionCuller.AddOccluder(mesh.vertices, mesh.indices, modelMatrix, camera->projectionMatrix().Multiply(camera->viewMatrix()));
 }
 
 void SoftRender::Present()
 {
+	for (auto& bitmap : clearedBitmaps) bitmap->ResolveClears();
+	clearedBitmaps.clear();
+
 	int width = colorBuffer->GetWidth();
 	int height = colorBuffer->GetHeight();
 	rawptr_t bytes = colorBuffer->GetBytes();
+	if (colorBuffer->GetLayout() != Bitmap::Layout_Linear)
+	{
+		static std::vector<uint8_t> linearBytes;
+		linearBytes.resize(width * height * 4);
+		colorBuffer->ResolveTo(linearBytes.data());
+		bytes = linearBytes.data();
+	}
 	glDrawPixels(width, height, GL_RGBA, GL_UNSIGNED_BYTE, bytes);
 	glFlush();
 }
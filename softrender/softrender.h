@@ -4,6 +4,7 @@
 #include "base/header.h"
 #include "base/application.h"
 #include "base/input.h"
+#include "base/job_system.h"
 
 #include "math/mathf.h"
 #include "math/transform.h"
@@ -12,7 +13,6 @@
 #include "softrender/mesh.h"
 #include "softrender/texture2d.h"
 #include "softrender/cubemap.h"
-#include "softrender/stencil.hpp"
 #include "softrender/render_texture.h"
 #include "softrender/render_state.hpp"
 #include "softrender/render_data.hpp"
@@ -24,6 +24,11 @@
 #include "softrender/shaderf.hpp"
 #include "softrender/pbsf.hpp"
 #include "softrender/rasterizer.hpp"
+#include "softrender/tiler.h"
+#include "softrender/occlusion_culler.h"
+#include "softrender/pipeline_state.h"
+#include "softrender/visibility_buffer.hpp"
+#include "softrender/light_grid.h"
 
 namespace sr
 {
@@ -36,36 +41,193 @@ struct SoftRender
 	static Matrix4x4 modelMatrix;
 	static CameraPtr camera;
     static LightPtr light;
+	// lights of the single pass forward shaders, every draw gets the ones reaching its bounds in _Lights.
+	// a light is initialized by whoever sets it up, the draws only read it
+	static std::vector<LightPtr> lights;
 
-	static void Initialize(int width, int height);
+	// workerCount: threads of the job system including the calling one, 0 for one per hardware core
+	// affinity: pin every thread to its own core
+	static void Initialize(int width, int height, int workerCount = 0, bool affinity = false, Bitmap::Layout layout = Bitmap::Layout_Linear);
 	static void SetRenderTarget(RenderTexturePtr target);
 	static RenderTexturePtr GetRenderTarget();
+	// the stencil of the render target, packed with its depth, keeping the depth
 	static void ClearStencilBuffer(uint8_t stencil);
-	static StencilBufferPtr GetStencilBuffer();
+	static DepthStencilBufferPtr GetDepthStencilBuffer();
+	// a shader bound through the plain ShaderPtr can't be copied for the workers, its draws run
+	// their vertex and pixel stages on the calling thread alone. the first such draw says so once
 	static void SetShader(ShaderPtr shader);
+	// the bound state is used by the following draws instead of renderState, nullptr goes back to renderState
+	static void SetPipelineState(PipelineStatePtr state);
 
+	// the concrete shader type lets Submit copy the shader for every render thread,
+	// shaders set through a plain ShaderPtr are shaded on the calling thread only
+	template<typename ShaderType>
+	static void SetShader(std::shared_ptr<ShaderType> shader)
+	{
+		SetShader(ShaderPtr(shader));
+		shaderCloneFunc = &IShader::Clone<ShaderType>;
+		shaderCopyFunc = &IShader::Copy<ShaderType>;
+	}
+
+	// fast clears of the color buffer and the bound g-buffers, and of the depth. only the tiles of the
+	// targets get a pending clear, the draws write it to the tiles they render first. the bitmaps cleared
+	// here are resolved whole before a draw that doesn't render to them, which might sample them, and at Present
 	static void Clear(bool clearColor, bool clearDepth, const Color& backgroundColor, float depth = 1.0f);
+	// clears the inclusive pixel rect, only the tiles it overlaps are touched
+	static void Clear(int minX, int minY, int maxX, int maxY, bool clearColor, bool clearDepth, const Color& backgroundColor, float depth = 1.0f);
+	// rasterizes the mesh with modelMatrix and the camera into the occlusion buffer, the mesh still has to be drawn.
+	// occluders are dropped when the depth is cleared, until then Submit skips draws whose bounds they hide
+	static void AddOccluder(const Mesh& mesh);
 	static void Submit(int startIndex = 0, int primitiveCount = 0);
+
+	// Submit for a shader of the concrete type ShaderType, bound with SetShader: vert, frag, passQuad
+	// and fragQuad are called without virtual dispatch and inlined into the vertex and pixel loops
+	template<typename ShaderType>
+	static void Draw(int startIndex = 0, int primitiveCount = 0)
+	{
+		assert(shader != nullptr && typeid(*shader) == typeid(ShaderType));
+		DrawStages<ShaderType>(startIndex, primitiveCount);
+	}
+
+	// visibility buffer mode: the draws until EndVisibilityPass only write depth and the id of their triangle
+	// per pixel, EndVisibilityPass then runs frag once for every visible pixel with the draw that won it.
+	// the draws keep their shader uniforms, state and render target, their shaders have to be set with the
+	// typed SetShader. meant for opaque draws: the shader can't clip, blending and stencil writes happen
+	// once per pixel in the resolve, and queries count the samples passing the depth and stencil tests
+	static void BeginVisibilityPass();
+	static void EndVisibilityPass();
+
+	// bins the lights into the clusters of the render target against the depth drawn so far,
+	// the following draws find them through the _LightGrid uniform
+	static void BuildLightGrid(const std::vector<LightPtr>& lights);
+
+	// occlusion query: EndQuery returns how many samples passed the depth and stencil tests
+	// and were not clipped by the shader in the Submits since BeginQuery
+	static void BeginQuery();
+	static uint64_t EndQuery();
 	static void Present();
 
 private:
+	// vertices shaded per task by the parallel vertex stage
+	static const int VERTEX_BATCH_SIZE = 256;
+	// slack on a triangle's depth range before it is tested against the hierarchical z
+	static constexpr float HIZ_DEPTH_EPSILON = 1e-6f;
+
+	struct RenderContext
+	{
+		int threadIndex = 0;
+		ShaderPtr shader = nullptr;
+		// summed once per tile, reduced at the end of Submit
+		uint64_t passedSamples = 0;
+	};
+
+	struct BinnedTriangle
+	{
+		Triangle<Projection> projection;
+		Triangle<VertexVaryingData> triangle;
+		// attribute planes of the triangle setup, see VaryingDataBuffer::SetupTrianglePlaneData
+		rawptr_t planes;
+		// picks the stencil state of a two sided stencil
+		bool isBackFace;
+	};
+
+	// a draw of a visibility pass, kept until the pass is resolved
+	struct VisibilityDraw;
+	typedef int(*ResolveQuadFunc)(const VisibilityDraw& draw, int threadIndex, const BinnedTriangle& binned, const Rasterizer2x2Info& quad);
+	struct VisibilityDraw
+	{
+		std::shared_ptr<VaryingDataBuffer> varyingDataBuffer;
+		std::vector<BinnedTriangle> binnedTriangles;
+		// one copy per render thread
+		std::vector<ShaderPtr> shaders;
+		PipelineStatePtr state;
+		PixelTargets targets;
+		ResolveQuadFunc resolveFunc;
+	};
+
 	static bool InitShaderLightParams(ShaderPtr shader, const LightPtr& light);
-	static void RasterizerRenderFunc(const VertexVaryingData& data, const RasterizerInfo& info);
-	static void Rasterizer2x2RenderFunc(const Triangle<VertexVaryingData>& data,  const Rasterizer2x2Info& info);
-	static const Color& ShaderGBufferOutput(ShaderPtr& shader, int index);
+	static void InitShaderLights(ShaderPtr shader);
+	static void InitRenderContexts();
+	// setup of a draw, false when the draw is culled
+	static bool BeginDraw();
+	static void BinTriangles(int startIndex, int primitiveCount);
+	static void BinTriangle(Triangle<VertexVaryingData> triangle, int width, int height);
+	static void EndDraw();
 
-	static VaryingDataBuffer varyingDataBuffer;
+	// the bitmap got a fast clear, resolved before a draw not rendering to it
+	static void AddClearedBitmap(const BitmapPtr& bitmap);
+	static void ResolveClearsOfSampled();
+	// resolves the pending clears of the draw's targets in the tile, before the first quad touches them
+	static void ResolveTargetClears(const Tile& tile);
+
+	// stages calling into the shader, see softrender.inl
+	template<typename ShaderType>
+	static void DrawStages(int startIndex, int primitiveCount);
+	template<typename ShaderType>
+	static void ShadeVertices(RenderContext& context, int begin, int end);
+	template<typename ShaderType>
+	static void RenderTiles();
+	template<typename ShaderType>
+	static void RenderTile(RenderContext& context, const Tile& tile);
+	template<typename RenderFuncType>
+	static void RasterizeTile(const Tile& tile, const RenderFuncType& renderFunc);
+	// returns the number of samples written
+	template<typename ShaderType>
+	static int Rasterizer2x2RenderFunc(ShaderType& shader, int threadIndex, const BinnedTriangle& binned, const Rasterizer2x2Info& info);
+	// shades the pixels of liveMask, which passed the depth and stencil tests, and writes them
+	template<typename ShaderType>
+	static int ShadeQuad(ShaderType& shader, const PipelineState& state, const PixelTargets& targets,
+		int threadIndex, const BinnedTriangle& binned, const Rasterizer2x2Info& quad, uint8_t liveMask);
+
+	// geometry pass and resolve of the visibility buffer mode
+	static int VisibilityRenderFunc(int drawIndex, const BinnedTriangle& binned, const Rasterizer2x2Info& quad);
+	template<typename ShaderType>
+	static void RecordVisibilityDraw();
+	template<typename ShaderType>
+	static int ResolveQuad(const VisibilityDraw& draw, int threadIndex, const BinnedTriangle& binned, const Rasterizer2x2Info& quad);
+	static void ResolveVisibilityTile(int threadIndex, int minX, int minY);
+
+	static PipelineStatePtr pipelineState;
+	// renderState compiled for the draws without a bound pipeline state
+	static PipelineStatePtr renderStatePipeline;
+	// uniform blocks of the last draw, kept to skip recomputing them when the camera or model matrix repeats
+	static CameraUniforms cameraUniforms;
+	static ObjectUniforms objectUniforms;
+	// state and buffers of the draw in flight
+	static PipelineStatePtr drawState;
+	static PixelTargets pixelTargets;
+
+	static std::shared_ptr<VaryingDataBuffer> varyingDataBuffer;
 	static ShaderPtr shader;
+	static IShader::CloneFunc shaderCloneFunc;
+	static IShader::CopyFunc shaderCopyFunc;
 
 	static RenderTexturePtr defaultRenderTarget;
 	static RenderTexturePtr renderTarget;
 	static BitmapPtr colorBuffer;
-	static BitmapPtr depthBuffer;
-	static StencilBufferPtr stencilBuffer;
+	static DepthStencilBufferPtr depthStencilBuffer;
+	static HiZBufferPtr hizBuffer;
+	// bitmaps cleared by Clear and ClearStencilBuffer which may still have pending clears
+	static std::vector<BitmapPtr> clearedBitmaps;
 
 	static Rasterizer rasterizer;
+	static Tiler tiler;
+	static OcclusionCuller occlusionCuller;
+	static std::vector<RenderContext> renderContexts;
+	static std::vector<BinnedTriangle> binnedTriangles;
+
+	static bool isVisibilityPass;
+	static VisibilityBufferPtr visibilityBuffer;
+	static std::vector<VisibilityDraw> visibilityDraws;
+
+	static LightGrid lightGrid;
+
+	static bool isQueryActive;
+	static uint64_t queryPassedSamples;
 };
 
 }
 
+#include "softrender.inl"
+
 #endif // !_SOFTRENDER_H_
@@ -0,0 +1,251 @@
+#ifndef _SOFTRENDER_INLINE_
+#define _SOFTRENDER_INLINE_
+
+// the stages of a draw that call into the shader, instantiated for IShader by Submit
+// and for concrete shader types by Draw
+
+namespace sr
+{
+
+template<typename ShaderType>
+void SoftRender::DrawStages(int startIndex, int primitiveCount)
+{
+	if (!BeginDraw()) return;
+
+	int vertexCount = renderData.GetVertexCount();
+	if (renderContexts.size() > 1)
+	{
+		int batchCount = (vertexCount + VERTEX_BATCH_SIZE - 1) / VERTEX_BATCH_SIZE;
+		JobSystem::ParallelFor(batchCount, [vertexCount](int index, int threadIndex)
+		{
+			int begin = index * VERTEX_BATCH_SIZE;
+			ShadeVertices<ShaderType>(renderContexts[threadIndex], begin, Mathf::Min(begin + VERTEX_BATCH_SIZE, vertexCount));
+		});
+	}
+	else
+	{
+		ShadeVertices<ShaderType>(renderContexts[0], 0, vertexCount);
+	}
+
+	BinTriangles(startIndex, primitiveCount);
+	RenderTiles<ShaderType>();
+	if (isVisibilityPass) RecordVisibilityDraw<ShaderType>();
+	EndDraw();
+}
+
+template<typename ShaderType>
+void SoftRender::ShadeVertices(RenderContext& context, int begin, int end)
+{
+	ShaderType& shader = static_cast<ShaderType&>(*context.shader);
+	for (int i = begin; i < end; ++i)
+	{
+		VertexVaryingData& varyingData = varyingDataBuffer->GetVertexVaryingData(i);
+		ShaderStages<ShaderType>::VSMain(shader, renderData.GetVertexData<uint8_t>(i), varyingData.data);
+
+		varyingData.position = *Buffer::Value<Vector4>(varyingData.data, 0);
+		varyingData.clipCode = Clipper::CalculateClipCode(varyingData.position);
+	}
+}
+
+template<typename ShaderType>
+void SoftRender::RenderTiles()
+{
+	int tileCount = tiler.GetActiveTileCount();
+	if (renderContexts.size() > 1)
+	{
+		JobSystem::ParallelFor(tileCount, [](int index, int threadIndex)
+		{
+			RenderTile<ShaderType>(renderContexts[threadIndex], tiler.GetActiveTile(index));
+		});
+	}
+	else
+	{
+		for (int i = 0; i < tileCount; ++i)
+		{
+			RenderTile<ShaderType>(renderContexts[0], tiler.GetActiveTile(i));
+		}
+	}
+}
+
+template<typename ShaderType>
+void SoftRender::RenderTile(RenderContext& context, const Tile& tile)
+{
+	ShaderType& shader = static_cast<ShaderType&>(*context.shader);
+	int threadIndex = context.threadIndex;
+	ResolveTargetClears(tile);
+
+	// counted locally so the render threads don't write a shared line per quad.
+	// passed to the rasterizer as a plain lambda, the pixel loop is instantiated for ShaderType
+	uint64_t passedSamples = 0;
+	if (isVisibilityPass)
+	{
+		int drawIndex = (int)visibilityDraws.size();
+		auto renderFunc = [drawIndex, &passedSamples](const BinnedTriangle& binned, const Rasterizer2x2Info& quad)
+		{
+			passedSamples += VisibilityRenderFunc(drawIndex, binned, quad);
+		};
+		RasterizeTile(tile, renderFunc);
+	}
+	else
+	{
+		auto renderFunc = [&shader, threadIndex, &passedSamples](const BinnedTriangle& binned, const Rasterizer2x2Info& quad)
+		{
+			passedSamples += Rasterizer2x2RenderFunc(shader, threadIndex, binned, quad);
+		};
+		RasterizeTile(tile, renderFunc);
+	}
+	context.passedSamples += passedSamples;
+}
+
+template<typename RenderFuncType>
+void SoftRender::RasterizeTile(const Tile& tile, const RenderFuncType& renderFunc)
+{
+	// primitives of a tile are rasterized in submission order, so blending matches the serial result
+	const RenderState& state = drawState->GetRenderState();
+	// pixels failing the depth test still write their stencil when the state has a depth fail operation
+	bool isHiZTestOn = (state.zTest != RenderState::ZTestType_Always) && !drawState->WritesOnFail();
+	for (int primitive : tile.primitives)
+	{
+		const BinnedTriangle& binned = binnedTriangles[primitive];
+		if (!isHiZTestOn)
+		{
+			rasterizer.RasterizerTriangle(binned.projection, renderFunc, binned, tile.minX, tile.minY, tile.maxX, tile.maxY);
+			continue;
+		}
+
+		// interpolated depths can be off by a few ulps from the vertex range
+		const Triangle<Projection>& p = binned.projection;
+		float zMin = Mathf::Min(p.v0.z, p.v1.z, p.v2.z) - HIZ_DEPTH_EPSILON;
+		float zMax = Mathf::Max(p.v0.z, p.v1.z, p.v2.z) + HIZ_DEPTH_EPSILON;
+		auto mayPass = [&state, zMin, zMax](float bufferMin, float bufferMax)
+		{
+			return state.ZTestRange(zMin, zMax, bufferMin, bufferMax);
+		};
+
+		int minX = Mathf::Max(Mathf::Min(p.v0.x, p.v1.x, p.v2.x), tile.minX);
+		int minY = Mathf::Max(Mathf::Min(p.v0.y, p.v1.y, p.v2.y), tile.minY);
+		int maxX = Mathf::Min(Mathf::Max(p.v0.x, p.v1.x, p.v2.x), tile.maxX);
+		int maxY = Mathf::Min(Mathf::Max(p.v0.y, p.v1.y, p.v2.y), tile.maxY);
+		if (!hizBuffer->TestRect(minX, minY, maxX, maxY, mayPass)) continue;
+
+		Rasterizer::BlockTestFunc blockTest = [&mayPass](int blockX, int blockY)
+		{
+			return hizBuffer->TestBlock(blockX, blockY, mayPass);
+		};
+		rasterizer.RasterizerTriangle(binned.projection, renderFunc, binned, tile.minX, tile.minY, tile.maxX, tile.maxY, blockTest);
+	}
+}
+
+template<typename ShaderType>
+int SoftRender::Rasterizer2x2RenderFunc(ShaderType& shader, int threadIndex, const BinnedTriangle& binned, const Rasterizer2x2Info& quad)
+{
+	// early depth/stencil test, drops occluded pixels before any interpolation or shading.
+	// depth and the stencil pass operation are only written after the shader ran, so pixels it clips
+	// fall back to late-Z. the stencil fail operations of the rejected pixels are written right away
+	const PipelineState& state = *drawState;
+	uint8_t liveMask = state.TestQuad(pixelTargets, quad, binned.isBackFace);
+	if (liveMask == 0) return 0;
+
+	return ShadeQuad(shader, state, pixelTargets, threadIndex, binned, quad, liveMask);
+}
+
+template<typename ShaderType>
+int SoftRender::ShadeQuad(ShaderType& shader, const PipelineState& state, const PixelTargets& targets,
+	int threadIndex, const BinnedTriangle& binned, const Rasterizer2x2Info& quad, uint8_t liveMask)
+{
+	// helper lanes are only needed when the shader takes derivatives across the quad
+	uint8_t interpMask = shader.needsQuadPass ? 0xF : liveMask;
+	rawptr_t pixelVaryingDataQuad[4] = { nullptr, nullptr, nullptr, nullptr };
+	for (int i = 0; i < 4; ++i)
+	{
+		if (!(interpMask & (1 << i))) continue;
+
+		int slot = threadIndex * 4 + i;
+		pixelVaryingDataQuad[i] = VertexVaryingData::TrianglePlaneInterp(slot, binned.triangle, binned.planes, quad.wx[i], quad.wy[i], quad.wz[i]);
+	}
+	if (shader.needsQuadPass) ShaderStages<ShaderType>::PassQuad(shader, pixelVaryingDataQuad);
+
+	// the batched frag runs over all four lanes, the dropped ones shade a copy of a live pixel
+	bool isQuadShaded = false;
+	if (shader.hasQuadFrag)
+	{
+		int firstLive = 0;
+		while (!(liveMask & (1 << firstLive))) ++firstLive;
+		rawptr_t packetVaryingData[4];
+		for (int i = 0; i < 4; ++i)
+		{
+			packetVaryingData[i] = (liveMask & (1 << i)) ? pixelVaryingDataQuad[i] : pixelVaryingDataQuad[firstLive];
+		}
+
+		shader.clipMask = 0x0;
+		shader.SV_Target0x4 = Colorx4(Color::clear);
+		shader.SV_Target1x4 = Colorx4(Color::clear);
+		shader.SV_Target2x4 = Colorx4(Color::clear);
+		shader.SV_Target3x4 = Colorx4(Color::clear);
+		ShaderStages<ShaderType>::PSMainQuad(shader, packetVaryingData, liveMask);
+		isQuadShaded = shader.hasQuadFrag;
+	}
+
+	// the per pixel frag leaves its outputs in the quad lanes, the quad is then written at once
+	uint8_t writeMask = isQuadShaded ? (uint8_t)(liveMask & ~shader.clipMask) : (uint8_t)0x0;
+	if (!isQuadShaded)
+	{
+		for (int i = 0; i < 4; ++i)
+		{
+			if (!(liveMask & (1 << i))) continue;
+
+			shader.varyingData = pixelVaryingDataQuad[i];
+			shader.isClipped = false;
+			shader.SV_Target0 = Color::clear;
+			shader.SV_Target1 = Color::clear;
+			shader.SV_Target2 = Color::clear;
+			shader.SV_Target3 = Color::clear;
+			ShaderStages<ShaderType>::PSMain(shader);
+			if (shader.isClipped) continue;
+
+			shader.SV_Target0x4.Set(i, shader.SV_Target0);
+			shader.SV_Target1x4.Set(i, shader.SV_Target1);
+			shader.SV_Target2x4.Set(i, shader.SV_Target2);
+			shader.SV_Target3x4.Set(i, shader.SV_Target3);
+			writeMask |= (1 << i);
+		}
+	}
+	if (writeMask == 0x0) return 0;
+
+	state.WriteQuad(targets, quad, writeMask, shader, binned.isBackFace);
+	int passedSamples = 0;
+	for (int i = 0; i < 4; ++i) passedSamples += (writeMask >> i) & 1;
+	return passedSamples;
+}
+
+template<typename ShaderType>
+void SoftRender::RecordVisibilityDraw()
+{
+	// the shader of the calling thread gets the uniforms of the next draw
+	assert(shaderCloneFunc != nullptr);
+
+	visibilityDraws.emplace_back();
+	VisibilityDraw& draw = visibilityDraws.back();
+	draw.varyingDataBuffer = varyingDataBuffer;
+	draw.binnedTriangles.swap(binnedTriangles);
+	// the workers' copies are handed to the draw, the next draw clones new ones
+	for (auto& context : renderContexts)
+	{
+		draw.shaders.push_back((context.shader == shader) ? shaderCloneFunc(*shader) : context.shader);
+		if (context.shader != shader) context.shader = nullptr;
+	}
+	draw.state = drawState;
+	draw.targets = pixelTargets;
+	draw.resolveFunc = &ResolveQuad<ShaderType>;
+}
+
+template<typename ShaderType>
+int SoftRender::ResolveQuad(const VisibilityDraw& draw, int threadIndex, const BinnedTriangle& binned, const Rasterizer2x2Info& quad)
+{
+	ShaderType& shader = static_cast<ShaderType&>(*draw.shaders[threadIndex]);
+	return ShadeQuad(shader, *draw.state, draw.targets, threadIndex, binned, quad, quad.maskCode);
+}
+
+} // namespace sr
+
+#endif // !_SOFTRENDER_INLINE_
@@ -1,39 +1,63 @@
 #include "bitmap.h"
+#include "bitmap_view.hpp"
 #include "../thirdpart/freeimage/FreeImage.h"
+#include <thread>
 using namespace sr;
 
-Bitmap::Bitmap(int width, int height, BitmapType type)
+const uint16_t Bitmap::mortonBits[TILE_SIZE] = {
+	0x000, 0x001, 0x004, 0x005, 0x010, 0x011, 0x014, 0x015, 0x040, 0x041, 0x044, 0x045, 0x050, 0x051, 0x054, 0x055,
+	0x100, 0x101, 0x104, 0x105, 0x110, 0x111, 0x114, 0x115, 0x140, 0x141, 0x144, 0x145, 0x150, 0x151, 0x154, 0x155,
+	0x400, 0x401, 0x404, 0x405, 0x410, 0x411, 0x414, 0x415, 0x440, 0x441, 0x444, 0x445, 0x450, 0x451, 0x454, 0x455,
+	0x500, 0x501, 0x504, 0x505, 0x510, 0x511, 0x514, 0x515, 0x540, 0x541, 0x544, 0x545, 0x550, 0x551, 0x554, 0x555,
+};
+
+Bitmap::Bitmap(int width, int height, BitmapType type, Layout layout/* = Layout_Linear*/)
 {
 	this->width = width;
 	this->height = height;
 	this->type = type;
+	this->layout = layout;
+
+	// a linear bitmap has tiles for its clears too
+	tileCountX = (width + TILE_SIZE - 1) >> TILE_SIZE_SHIFT;
+	tileCountY = (height + TILE_SIZE - 1) >> TILE_SIZE_SHIFT;
+	tileClears.reset(new TileClear[tileCountX * tileCountY]);
+	for (int i = 0; i < tileCountX * tileCountY; ++i) tileClears[i].state = TileClearState_None;
+	pendingClearCount = 0;
+
+	pixelCount = width * height;
+	if (layout == Layout_Tiled) pixelCount = (tileCountX * tileCountY) << (TILE_SIZE_SHIFT * 2);
 
-	int size = width * height;
 	switch (type)
 	{
 	case BitmapType_Alpha8:
+		bytesPerPixel = 1;
 		break;
 	case BitmapType_RGB24:
-		size *= 3;
+		bytesPerPixel = 3;
 		break;
 	case BitmapType_RGBA32:
-		size *= 4;
+		bytesPerPixel = 4;
 		break;
 	case BitmapType_AlphaFloat:
-		size *= 4;
+		bytesPerPixel = 4;
 		break;
 	case BitmapType_RGBFloat:
-		size *= 12;
+		bytesPerPixel = 12;
 		break;
 	case BitmapType_RGBAFloat:
-		size *= 16;
+		bytesPerPixel = 16;
+		break;
+	case BitmapType_Depth24Stencil8:
+		bytesPerPixel = 4;
 		break;
 	case BitmapType_Unknown:
+	case BitmapTypeCount:
 		assert(false);
 		return;
 	}
 
-	bytes = new uint8_t[size];
+	bytes = new uint8_t[pixelCount * bytesPerPixel];
 }
 
 Bitmap::~Bitmap()
@@ -45,101 +69,25 @@ Bitmap::~Bitmap()
 	}
 }
 
-uint8_t Bitmap::GetPixel_Alpha8(int x, int y) const
-{
-	return (uint8_t)*(bytes + (y * width + x));
-}
-
-Color32 Bitmap::GetPixel_RGB24(int x, int y) const
-{
-	rawptr_t byte = bytes + (y * width + x) * 3;
-	uint8_t r = *byte;
-	uint8_t g = *(byte + 1);
-	uint8_t b = *(byte + 2);
-	return Color32(255, r, g, b);
-}
-
-Color32 Bitmap::GetPixel_RGBA32(int x, int y) const
-{
-	rawptr_t byte = bytes + (y * width + x) * 4;
-	uint8_t r = *byte;
-	uint8_t g = *(byte + 1);
-	uint8_t b = *(byte + 2);
-	uint8_t a = *(byte + 3);
-	return Color32(a, r, g, b);
-}
-
-float Bitmap::GetPixel_AlphaFloat(int x, int y) const
-{
-	return *(float*)(bytes + (y * width + x) * 4);
-}
-
-Color Bitmap::GetPixel_RGBF(int x, int y) const
-{
-	return Color(*(Vector3*)(bytes + (y * width + x) * 12), 1.f);
-}
-
-Color Bitmap::GetPixel_RGBAF(int x, int y) const
-{
-	return *(Color*)(bytes + (y * width + x) * 16);
-}
-
-void Bitmap::SetPixel_Alpha8(int x, int y, uint8_t val)
-{
-	*(uint8_t*)(bytes + (y * width + x)) = val;
-}
-
-void Bitmap::SetPixel_RGB24(int x, int y, const Color32& color)
-{
-	rawptr_t byte = bytes + (y * width + x) * 3;
-	*byte = color.r;
-	*(byte + 1) = color.g;
-	*(byte + 2) = color.b;
-}
-
-void Bitmap::SetPixel_RGBA32(int x, int y, const Color32& color)
-{
-	rawptr_t byte = bytes + (y * width + x) * 4;
-	*byte = color.r;
-	*(byte + 1) = color.g;
-	*(byte + 2) = color.b;
-	*(byte + 3) = color.a;
-}
-
-void Bitmap::SetPixel_AlphaFloat(int x, int y, float val)
-{
-	*(float*)(bytes + (y * width + x) * 4) = val;
-}
-
-void Bitmap::SetPixel_RGBF(int x, int y, const Color& color)
-{
-	*(Vector3*)(bytes + (y * width + x) * 12) = color.rgb;
-}
-
-void Bitmap::SetPixel_RGBAF(int x, int y, const Color& color)
-{
-	*(Color*)(bytes + (y * width + x) * 16) = color;
-}
-
 Color Bitmap::GetPixel(int x, int y) const
 {
-	assert(x >= 0 && x < width);
-	assert(y >= 0 && y < height);
-
+	ResolveClears(x, y, x, y);
 	switch (type)
 	{
 	case BitmapType_Alpha8:
-		return Color(GetPixel_Alpha8(x, y) / 255.f, 1.f, 1.f, 1.f);
+		return BitmapView<BitmapType_Alpha8>(*this).GetPixel(x, y);
 	case BitmapType_RGB24:
-		return GetPixel_RGB24(x, y);
+		return BitmapView<BitmapType_RGB24>(*this).GetPixel(x, y);
 	case BitmapType_RGBA32:
-		return GetPixel_RGBA32(x, y);
+		return BitmapView<BitmapType_RGBA32>(*this).GetPixel(x, y);
 	case BitmapType_AlphaFloat:
-		return Color(GetPixel_AlphaFloat(x, y), 1.f, 1.f, 1.f);
+		return BitmapView<BitmapType_AlphaFloat>(*this).GetPixel(x, y);
 	case BitmapType_RGBFloat:
-		return GetPixel_RGBF(x, y);
+		return BitmapView<BitmapType_RGBFloat>(*this).GetPixel(x, y);
 	case BitmapType_RGBAFloat:
-		return GetPixel_RGBAF(x, y);
+		return BitmapView<BitmapType_RGBAFloat>(*this).GetPixel(x, y);
+	case BitmapType_Depth24Stencil8:
+		return BitmapView<BitmapType_Depth24Stencil8>(*this).GetPixel(x, y);
 	default:
 		break;
 	}
@@ -148,52 +96,54 @@ Color Bitmap::GetPixel(int x, int y) const
 
 void Bitmap::SetPixel(int x, int y, const Color& color)
 {
-	assert(x >= 0 && x < width);
-	assert(y >= 0 && y < height);
+	ResolveClears(x, y, x, y);
 	switch (type)
 	{
 	case BitmapType_Alpha8:
-		SetPixel_Alpha8(x, y, Color32(color).a);
+		RWBitmapView<BitmapType_Alpha8>(*this).SetPixel(x, y, color);
 		break;
 	case BitmapType_RGB24:
-		SetPixel_RGB24(x, y, color);
+		RWBitmapView<BitmapType_RGB24>(*this).SetPixel(x, y, color);
 		break;
 	case BitmapType_RGBA32:
-		SetPixel_RGBA32(x, y, color);
+		RWBitmapView<BitmapType_RGBA32>(*this).SetPixel(x, y, color);
 		break;
 	case BitmapType_AlphaFloat:
-		SetPixel_AlphaFloat(x, y, color.a);
+		RWBitmapView<BitmapType_AlphaFloat>(*this).SetPixel(x, y, color);
 		break;
 	case BitmapType_RGBFloat:
-		SetPixel_RGBF(x, y, color);
+		RWBitmapView<BitmapType_RGBFloat>(*this).SetPixel(x, y, color);
 		break;
 	case BitmapType_RGBAFloat:
-		SetPixel_RGBAF(x, y, color);
+		RWBitmapView<BitmapType_RGBAFloat>(*this).SetPixel(x, y, color);
+		break;
+	case BitmapType_Depth24Stencil8:
+		RWBitmapView<BitmapType_Depth24Stencil8>(*this).SetPixel(x, y, color);
 		break;
 	default:
 		break;
 	}
 }
 
-
 float Bitmap::GetAlpha(int x, int y) const
 {
-	assert(x >= 0 && x < width);
-	assert(y >= 0 && y < height);
-
+	ResolveClears(x, y, x, y);
 	switch (type)
 	{
 	case BitmapType_Alpha8:
-		return GetPixel_Alpha8(x, y) / 255.f;
+		return BitmapView<BitmapType_Alpha8>(*this).GetAlpha(x, y);
 	case BitmapType_RGB24:
-	case BitmapType_RGBFloat:
-		return 1.f;
+		return BitmapView<BitmapType_RGB24>(*this).GetAlpha(x, y);
 	case BitmapType_RGBA32:
-		return *(uint8_t*)(bytes + (y * width + x) * 4 + 3) / 255.f;
+		return BitmapView<BitmapType_RGBA32>(*this).GetAlpha(x, y);
 	case BitmapType_AlphaFloat:
-		return GetPixel_AlphaFloat(x, y);
+		return BitmapView<BitmapType_AlphaFloat>(*this).GetAlpha(x, y);
+	case BitmapType_RGBFloat:
+		return BitmapView<BitmapType_RGBFloat>(*this).GetAlpha(x, y);
 	case BitmapType_RGBAFloat:
-		return *(float*)(bytes + (y * width + x) * 16 + 12);
+		return BitmapView<BitmapType_RGBAFloat>(*this).GetAlpha(x, y);
+	case BitmapType_Depth24Stencil8:
+		return BitmapView<BitmapType_Depth24Stencil8>(*this).GetAlpha(x, y);
 	default:
 		return 1.f;
 	}
@@ -201,21 +151,23 @@ float Bitmap::GetAlpha(int x, int y) const
 
 void Bitmap::SetAlpha(int x, int y, float alpha)
 {
-	assert(x >= 0 && x < width);
-	assert(y >= 0 && y < height);
+	ResolveClears(x, y, x, y);
 	switch (type)
 	{
 	case BitmapType_Alpha8:
-		SetPixel_Alpha8(x, y, (uint8_t)(Mathf::Clamp01(alpha) * 255.f));
+		RWBitmapView<BitmapType_Alpha8>(*this).SetAlpha(x, y, alpha);
 		break;
 	case BitmapType_RGBA32:
-		*(uint8_t*)(bytes + (y * width + x) * 4 + 3) = (uint8_t)(Mathf::Clamp01(alpha) * 255.f);
+		RWBitmapView<BitmapType_RGBA32>(*this).SetAlpha(x, y, alpha);
 		break;
 	case BitmapType_AlphaFloat:
-		SetPixel_AlphaFloat(x, y, alpha);
+		RWBitmapView<BitmapType_AlphaFloat>(*this).SetAlpha(x, y, alpha);
 		break;
 	case BitmapType_RGBAFloat:
-		*(float*)(bytes + (y * width + x) * 16 + 12) = alpha;
+		RWBitmapView<BitmapType_RGBAFloat>(*this).SetAlpha(x, y, alpha);
+		break;
+	case BitmapType_Depth24Stencil8:
+		RWBitmapView<BitmapType_Depth24Stencil8>(*this).SetAlpha(x, y, alpha);
 		break;
 	case BitmapType_RGB24:
 	case BitmapType_RGBFloat:
@@ -228,16 +180,20 @@ void Bitmap::Fill(const Color& color)
 {
 	assert(bytes != nullptr);
 
+	// every pixel is overwritten, the pending clears are dropped
+	for (int i = 0; i < tileCountX * tileCountY; ++i) tileClears[i].state = TileClearState_None;
+	pendingClearCount = 0;
+
 	switch (type)
 	{
 	case BitmapType_Alpha8:
-		std::memset(bytes, Color32(color).a, width * height);
-		//std::fill_n((uint8_t*)bytes, width * height, Color32(color).a);
+		std::memset(bytes, Color32(color).a, pixelCount);
+		//std::fill_n((uint8_t*)bytes, pixelCount, Color32(color).a);
 		break;
 	case BitmapType_RGB24:
 		{
 			Color32 c32 = color;
-			for (int i = 0; i < width * height; ++i)
+			for (int i = 0; i < pixelCount; ++i)
 			{
 				int offset = i * 3;
 				*(uint8_t*)(bytes + offset) = c32.r;
@@ -247,22 +203,227 @@ void Bitmap::Fill(const Color& color)
 		}
 		break;
 	case BitmapType_RGBA32:
-		std::fill_n((uint32_t*)bytes, width * height, Color32(color).rgba);
+		std::fill_n((uint32_t*)bytes, pixelCount, Color32(color).rgba);
 		break;
 	case BitmapType_AlphaFloat:
-		std::fill_n((float*)bytes, width * height, color.a);
+		std::fill_n((float*)bytes, pixelCount, color.a);
 		break;
 	case BitmapType_RGBFloat:
-		std::fill_n((Vector3*)bytes, width * height, color.rgb);
+		std::fill_n((Vector3*)bytes, pixelCount, color.rgb);
 		break;
 	case BitmapType_RGBAFloat:
-		std::fill_n((Color*)bytes, width * height, color);
+		std::fill_n((Color*)bytes, pixelCount, color);
+		break;
+	case BitmapType_Depth24Stencil8:
+		std::fill_n((uint32_t*)bytes, pixelCount, BitmapFormat<BitmapType_Depth24Stencil8>::Pack(color.a, 0));
 		break;
 	default:
 		break;
 	}
 }
 
+void Bitmap::Clear(const Color& color)
+{
+	Clear(color, 0, 0, width - 1, height - 1);
+}
+
+void Bitmap::Clear(const Color& color, int minX, int minY, int maxX, int maxY)
+{
+	uint8_t value[16];
+	PackPixel(color, value);
+	ClearPacked(value, 0, minX, minY, maxX, maxY);
+}
+
+void Bitmap::PackPixel(const Color& color, uint8_t* value) const
+{
+	memset(value, 0, sizeof(TileClear::value));
+	switch (type)
+	{
+	case BitmapType_Alpha8:
+		BitmapFormat<BitmapType_Alpha8>::Store(value, color);
+		break;
+	case BitmapType_RGB24:
+		BitmapFormat<BitmapType_RGB24>::Store(value, color);
+		break;
+	case BitmapType_RGBA32:
+		BitmapFormat<BitmapType_RGBA32>::Store(value, color);
+		break;
+	case BitmapType_AlphaFloat:
+		BitmapFormat<BitmapType_AlphaFloat>::Store(value, color);
+		break;
+	case BitmapType_RGBFloat:
+		BitmapFormat<BitmapType_RGBFloat>::Store(value, color);
+		break;
+	case BitmapType_RGBAFloat:
+		BitmapFormat<BitmapType_RGBAFloat>::Store(value, color);
+		break;
+	case BitmapType_Depth24Stencil8:
+		BitmapFormat<BitmapType_Depth24Stencil8>::Store(value, color);
+		break;
+	default:
+		break;
+	}
+}
+
+void Bitmap::ClearPacked(const uint8_t* value, uint32_t keepMask, int minX, int minY, int maxX, int maxY)
+{
+	assert(keepMask == 0 || bytesPerPixel == 4);
+	minX = Mathf::Max(minX, 0);
+	minY = Mathf::Max(minY, 0);
+	maxX = Mathf::Min(maxX, width - 1);
+	maxY = Mathf::Min(maxY, height - 1);
+	if (maxX < minX || maxY < minY) return;
+
+	for (int tileY = (minY >> TILE_SIZE_SHIFT); tileY <= (maxY >> TILE_SIZE_SHIFT); ++tileY)
+	{
+		for (int tileX = (minX >> TILE_SIZE_SHIFT); tileX <= (maxX >> TILE_SIZE_SHIFT); ++tileX)
+		{
+			int tileMinX = tileX << TILE_SIZE_SHIFT;
+			int tileMinY = tileY << TILE_SIZE_SHIFT;
+			int tileMaxX = Mathf::Min(tileMinX + TILE_SIZE, width);
+			int tileMaxY = Mathf::Min(tileMinY + TILE_SIZE, height);
+			int rectMinX = Mathf::Max(minX, tileMinX);
+			int rectMinY = Mathf::Max(minY, tileMinY);
+			int rectMaxX = Mathf::Min(maxX + 1, tileMaxX);
+			int rectMaxY = Mathf::Min(maxY + 1, tileMaxY);
+
+			// a tile the rect covers in part is written now
+			if (rectMinX != tileMinX || rectMinY != tileMinY || rectMaxX != tileMaxX || rectMaxY != tileMaxY)
+			{
+				ResolveClearTile(tileX, tileY);
+				FillPacked(value, keepMask, rectMinX, rectMinY, rectMaxX, rectMaxY);
+				continue;
+			}
+
+			TileClear& tileClear = tileClears[tileY * tileCountX + tileX];
+			bool isPending = tileClear.state.load(std::memory_order_relaxed) == TileClearState_Pending;
+			if (isPending && keepMask != 0)
+			{
+				// the kept bits come from the clear still pending
+				uint32_t pending = *(const uint32_t*)tileClear.value;
+				uint32_t cleared = (pending & keepMask) | (*(const uint32_t*)value & ~keepMask);
+				memcpy(tileClear.value, &cleared, sizeof(cleared));
+				tileClear.keepMask &= keepMask;
+				continue;
+			}
+
+			memcpy(tileClear.value, value, sizeof(tileClear.value));
+			tileClear.keepMask = keepMask;
+			if (!isPending) ++pendingClearCount;
+			tileClear.state.store(TileClearState_Pending, std::memory_order_release);
+		}
+	}
+}
+
+void Bitmap::FillPacked(const uint8_t* value, uint32_t keepMask, int minX, int minY, int maxX, int maxY) const
+{
+	if (keepMask != 0)
+	{
+		uint32_t cleared = *(const uint32_t*)value & ~keepMask;
+		for (int y = minY; y < maxY; ++y)
+		{
+			for (int x = minX; x < maxX; ++x)
+			{
+				uint32_t& pixel = ((uint32_t*)bytes)[GetPixelIndex(x, y)];
+				pixel = (pixel & keepMask) | cleared;
+			}
+		}
+		return;
+	}
+
+	// a whole tile of a tiled bitmap is one span with its padding, a row of a linear bitmap is one too.
+	// a span gets its first pixel and then doubles what's written
+	auto fillSpan = [this, value](rawptr_t dst, int count)
+	{
+		if (count <= 0) return;
+		int size = count * bytesPerPixel;
+		int written = bytesPerPixel;
+		memcpy(dst, value, bytesPerPixel);
+		while (written < size)
+		{
+			int chunk = Mathf::Min(written, size - written);
+			memcpy(dst + written, dst, chunk);
+			written += chunk;
+		}
+	};
+
+	if (layout == Layout_Tiled)
+	{
+		bool isWholeTile = ((minX | minY) & (TILE_SIZE - 1)) == 0
+			&& maxX == Mathf::Min(minX + TILE_SIZE, width) && maxY == Mathf::Min(minY + TILE_SIZE, height);
+		if (isWholeTile)
+		{
+			fillSpan(bytes + GetPixelIndex(minX, minY) * bytesPerPixel, TILE_SIZE * TILE_SIZE);
+			return;
+		}
+		for (int y = minY; y < maxY; ++y)
+		{
+			for (int x = minX; x < maxX; ++x) memcpy(bytes + GetPixelIndex(x, y) * bytesPerPixel, value, bytesPerPixel);
+		}
+		return;
+	}
+
+	for (int y = minY; y < maxY; ++y) fillSpan(bytes + GetPixelIndex(minX, y) * bytesPerPixel, maxX - minX);
+}
+
+void Bitmap::ResolveClears() const
+{
+	if (HasPendingClears()) ResolveClearTiles(0, 0, tileCountX - 1, tileCountY - 1);
+}
+
+void Bitmap::ResolveClearTiles(int minTileX, int minTileY, int maxTileX, int maxTileY) const
+{
+	for (int tileY = minTileY; tileY <= maxTileY; ++tileY)
+	{
+		for (int tileX = minTileX; tileX <= maxTileX; ++tileX) ResolveClearTile(tileX, tileY);
+	}
+}
+
+void Bitmap::ResolveClearTile(int tileX, int tileY) const
+{
+	TileClear& tileClear = tileClears[tileY * tileCountX + tileX];
+	int state = tileClear.state.load(std::memory_order_acquire);
+	if (state == TileClearState_None) return;
+
+	if (state == TileClearState_Pending
+		&& tileClear.state.compare_exchange_strong(state, TileClearState_Resolving, std::memory_order_acquire))
+	{
+		int minX = tileX << TILE_SIZE_SHIFT;
+		int minY = tileY << TILE_SIZE_SHIFT;
+		FillPacked(tileClear.value, tileClear.keepMask, minX, minY, Mathf::Min(minX + TILE_SIZE, width), Mathf::Min(minY + TILE_SIZE, height));
+		tileClear.state.store(TileClearState_None, std::memory_order_release);
+		--pendingClearCount;
+		return;
+	}
+
+	// another reader claimed the tile, its pixels are read once that one wrote them
+	while (tileClear.state.load(std::memory_order_acquire) != TileClearState_None) std::this_thread::yield();
+}
+
+void Bitmap::ResolveTo(rawptr_t dst) const
+{
+	ResolveClears();
+	int rowSize = width * bytesPerPixel;
+	if (layout == Layout_Linear)
+	{
+		memcpy(dst, bytes, rowSize * height);
+		return;
+	}
+
+	// an aligned pair of pixels on a row is contiguous in Morton order
+	int pairSize = bytesPerPixel * 2;
+	for (int y = 0; y < height; ++y)
+	{
+		rawptr_t dstRow = dst + y * rowSize;
+		int x = 0;
+		for (; x + 1 < width; x += 2)
+		{
+			memcpy(dstRow + x * bytesPerPixel, bytes + GetPixelIndex(x, y) * bytesPerPixel, pairSize);
+		}
+		if (x < width) memcpy(dstRow + x * bytesPerPixel, bytes + GetPixelIndex(x, y) * bytesPerPixel, bytesPerPixel);
+	}
+}
+
 BitmapPtr Bitmap::LoadFromFile(const std::string& file)
 {
 	return LoadFromFile(file.c_str());
@@ -355,6 +516,26 @@ bool Bitmap::SaveToFile(const std::string& file)
 
 bool Bitmap::SaveToFile(const char* file)
 {
+	ResolveClears();
+	if (layout != Layout_Linear)
+	{
+		Bitmap linear(width, height, type);
+		ResolveTo(linear.bytes);
+		return linear.SaveToFile(file);
+	}
+
+	if (type == BitmapType_Depth24Stencil8)
+	{
+		// saved as the float depth, the stencil is dropped
+		Bitmap depth(width, height, BitmapType_AlphaFloat);
+		const uint32_t* pixels = (const uint32_t*)bytes;
+		for (int i = 0; i < width * height; ++i)
+		{
+			((float*)depth.bytes)[i] = BitmapFormat<BitmapType_Depth24Stencil8>::UnpackDepth(pixels[i]);
+		}
+		return depth.SaveToFile(file);
+	}
+
 	switch (type)
 	{
 	case BitmapType_Unknown:
@@ -2,6 +2,7 @@
 #define _SOFTRENDER_BITMAP_H_
 
 #include "base/header.h"
+#include <atomic>
 #include "math/color.h"
 #include "math/vector3.h"
 
@@ -24,9 +25,25 @@ public:
 		BitmapType_AlphaFloat,
 		BitmapType_RGBFloat,
 		BitmapType_RGBAFloat,
+
+		// 24 bit fixed point depth in the high bits, 8 bit stencil in the low byte
+		BitmapType_Depth24Stencil8,
+		BitmapTypeCount
+	};
+
+	// how the pixels are laid out in memory. a tiled bitmap stores 64x64 macro tiles one after
+	// another, and the pixels of a tile in Morton order: every aligned 2x2 quad, 4x4 and 8x8
+	// micro tile is contiguous, so a rasterized quad touches a single cache line or two
+	enum Layout
+	{
+		Layout_Linear = 0,
+		Layout_Tiled,
 	};
 
-	Bitmap(int width, int height, BitmapType type);
+	static const int TILE_SIZE_SHIFT = 6;
+	static const int TILE_SIZE = (1 << TILE_SIZE_SHIFT);
+
+	Bitmap(int width, int height, BitmapType type, Layout layout = Layout_Linear);
 	virtual ~Bitmap();
 
 	static BitmapPtr LoadFromFile(const char* file);
@@ -38,33 +55,93 @@ public:
 	void SetPixel(int x, int y, const Color& color);
 	float GetAlpha(int x, int y) const;
 	void SetAlpha(int x, int y, float alpha);
+	// writes every pixel now, see Clear
 	void Fill(const Color& color);
 
+	// fast clear: a tile of TILE_SIZE x TILE_SIZE pixels, on either layout, only notes the value
+	// it's cleared to, the pixels are written when the tile is first touched. the pixel accessors,
+	// SaveToFile and ResolveTo resolve the pending clears they read, the draws of SoftRender the tiles
+	// they render, and SoftRender resolves the bitmaps it cleared before they may be sampled.
+	// GetBytes, GetPixelAddress and the views see the storage as it is, call ResolveClears first
+	void Clear(const Color& color);
+	// clears the inclusive pixel rect, the tiles it covers whole are cleared fast
+	void Clear(const Color& color, int minX, int minY, int maxX, int maxY);
+
+	bool HasPendingClears() const { return pendingClearCount.load(std::memory_order_relaxed) > 0; }
+	void ResolveClears() const;
+	// resolves the tiles overlapping the inclusive pixel rect. threads may resolve
+	// at the same time, every tile is written once
+	void ResolveClears(int minX, int minY, int maxX, int maxY) const
+	{
+		if (HasPendingClears()) ResolveClearTiles(minX >> TILE_SIZE_SHIFT, minY >> TILE_SIZE_SHIFT, maxX >> TILE_SIZE_SHIFT, maxY >> TILE_SIZE_SHIFT);
+	}
+
+	// copies the pixels row by row into dst, width * height * bytes per pixel
+	void ResolveTo(rawptr_t dst) const;
+
+	int GetPixelIndex(int x, int y) const
+	{
+		if (layout == Layout_Linear) return y * width + x;
+		int tile = (y >> TILE_SIZE_SHIFT) * tileCountX + (x >> TILE_SIZE_SHIFT);
+		return (tile << (TILE_SIZE_SHIFT * 2)) | mortonBits[x & (TILE_SIZE - 1)] | (mortonBits[y & (TILE_SIZE - 1)] << 1);
+	}
+
+	rawptr_t GetPixelAddress(int x, int y) { return bytes + GetPixelIndex(x, y) * bytesPerPixel; }
+
+	// the raw storage, row-major only for Layout_Linear
 	rawptr_t GetBytes() { return bytes; }
+	const uint8_t* GetBytes() const { return bytes; }
 	int GetWidth() const { return width; }
 	int GetHeight() const { return height; }
 	BitmapType GetType() const { return type; }
+	Layout GetLayout() const { return layout; }
+	int GetBytesPerPixel() const { return bytesPerPixel; }
 
 protected:
-	uint8_t GetPixel_Alpha8(int x, int y) const;
-	void SetPixel_Alpha8(int x, int y, uint8_t val);
-	Color32 GetPixel_RGB24(int x, int y) const;
-	void SetPixel_RGB24(int x, int y, const Color32& color);
-	Color32 GetPixel_RGBA32(int x, int y) const;
-	void SetPixel_RGBA32(int x, int y, const Color32& color);
-	float GetPixel_AlphaFloat(int x, int y) const;
-	void SetPixel_AlphaFloat(int x, int y, float val);
-	Color GetPixel_RGBF(int x, int y) const;
-	void SetPixel_RGBF(int x, int y, const Color& color);
-	Color GetPixel_RGBAF(int x, int y) const;
-	void SetPixel_RGBAF(int x, int y, const Color& color);
+	// the bits of a tile coordinate spread to the even bits of a Morton index
+	static const uint16_t mortonBits[TILE_SIZE];
+
+	enum TileClearState
+	{
+		TileClearState_None = 0,
+		TileClearState_Pending,
+		// a reader claimed the tile and is writing it
+		TileClearState_Resolving,
+	};
+
+	// a pending fast clear of a tile: the packed pixel, and for 4 byte formats the bits of
+	// the old pixels it keeps, so the depth and the stencil of a pixel clear on their own
+	struct TileClear
+	{
+		uint8_t value[16];
+		uint32_t keepMask;
+		std::atomic<int> state;
+	};
+
+	// clears the inclusive pixel rect to the packed pixel value
+	void ClearPacked(const uint8_t* value, uint32_t keepMask, int minX, int minY, int maxX, int maxY);
+	void PackPixel(const Color& color, uint8_t* value) const;
+	// writes the packed pixel value to the pixels of the rect, max exclusive
+	void FillPacked(const uint8_t* value, uint32_t keepMask, int minX, int minY, int maxX, int maxY) const;
+	void ResolveClearTiles(int minTileX, int minTileY, int maxTileX, int maxTileY) const;
+	void ResolveClearTile(int tileX, int tileY) const;
 
-protected:
 	BitmapType type = BitmapType_Unknown;
+	Layout layout = Layout_Linear;
 	int width = 0;
 	int height = 0;
+	int tileCountX = 0;
+	int tileCountY = 0;
+	int bytesPerPixel = 0;
+	// pixels in storage, the tiles of a tiled bitmap are padded to whole tiles
+	int pixelCount = 0;
 
 	rawptr_t bytes = nullptr;
+
+	// resolving a clear doesn't change what the bitmap holds, const readers resolve too.
+	// the reader moving a tile out of pending writes it, the others wait for it
+	mutable std::unique_ptr<TileClear[]> tileClears;
+	mutable std::atomic<int> pendingClearCount;
 };
 
 
@@ -0,0 +1,183 @@
+#ifndef _SOFTRENDER_BITMAP_VIEW_HPP_
+#define _SOFTRENDER_BITMAP_VIEW_HPP_
+
+#include "base/header.h"
+#include "math/mathf.h"
+#include "math/color.h"
+#include "math/vector3.h"
+#include "softrender/bitmap.h"
+
+namespace sr
+{
+
+// how a pixel of a format is read and written, the conversions of Bitmap::GetPixel and SetPixel
+template<Bitmap::BitmapType Format>
+struct BitmapFormat;
+
+template<>
+struct BitmapFormat<Bitmap::BitmapType_Alpha8>
+{
+	static const int BYTES_PER_PIXEL = 1;
+
+	static Color Load(const uint8_t* pixel) { return Color(*pixel / 255.f, 1.f, 1.f, 1.f); }
+	static void Store(uint8_t* pixel, const Color& color) { *pixel = Color32(color).a; }
+	static float LoadAlpha(const uint8_t* pixel) { return *pixel / 255.f; }
+	static void StoreAlpha(uint8_t* pixel, float alpha) { *pixel = (uint8_t)(Mathf::Clamp01(alpha) * 255.f); }
+};
+
+template<>
+struct BitmapFormat<Bitmap::BitmapType_RGB24>
+{
+	static const int BYTES_PER_PIXEL = 3;
+
+	static Color Load(const uint8_t* pixel) { return Color32(255, pixel[0], pixel[1], pixel[2]); }
+	static void Store(uint8_t* pixel, const Color& color)
+	{
+		Color32 c32 = color;
+		pixel[0] = c32.r;
+		pixel[1] = c32.g;
+		pixel[2] = c32.b;
+	}
+	static float LoadAlpha(const uint8_t* pixel) { return 1.f; }
+	static void StoreAlpha(uint8_t* pixel, float alpha) {}
+};
+
+template<>
+struct BitmapFormat<Bitmap::BitmapType_RGBA32>
+{
+	static const int BYTES_PER_PIXEL = 4;
+
+	static Color Load(const uint8_t* pixel) { return Color32(pixel[3], pixel[0], pixel[1], pixel[2]); }
+	static void Store(uint8_t* pixel, const Color& color)
+	{
+		Color32 c32 = color;
+		pixel[0] = c32.r;
+		pixel[1] = c32.g;
+		pixel[2] = c32.b;
+		pixel[3] = c32.a;
+	}
+	static float LoadAlpha(const uint8_t* pixel) { return pixel[3] / 255.f; }
+	static void StoreAlpha(uint8_t* pixel, float alpha) { pixel[3] = (uint8_t)(Mathf::Clamp01(alpha) * 255.f); }
+};
+
+template<>
+struct BitmapFormat<Bitmap::BitmapType_AlphaFloat>
+{
+	static const int BYTES_PER_PIXEL = 4;
+
+	static Color Load(const uint8_t* pixel) { return Color(*(const float*)pixel, 1.f, 1.f, 1.f); }
+	static void Store(uint8_t* pixel, const Color& color) { *(float*)pixel = color.a; }
+	static float LoadAlpha(const uint8_t* pixel) { return *(const float*)pixel; }
+	static void StoreAlpha(uint8_t* pixel, float alpha) { *(float*)pixel = alpha; }
+};
+
+template<>
+struct BitmapFormat<Bitmap::BitmapType_RGBFloat>
+{
+	static const int BYTES_PER_PIXEL = 12;
+
+	static Color Load(const uint8_t* pixel) { return Color(*(const Vector3*)pixel, 1.f); }
+	static void Store(uint8_t* pixel, const Color& color) { *(Vector3*)pixel = color.rgb; }
+	static float LoadAlpha(const uint8_t* pixel) { return 1.f; }
+	static void StoreAlpha(uint8_t* pixel, float alpha) {}
+};
+
+template<>
+struct BitmapFormat<Bitmap::BitmapType_RGBAFloat>
+{
+	static const int BYTES_PER_PIXEL = 16;
+
+	static Color Load(const uint8_t* pixel) { return *(const Color*)pixel; }
+	static void Store(uint8_t* pixel, const Color& color) { *(Color*)pixel = color; }
+	static float LoadAlpha(const uint8_t* pixel) { return ((const float*)pixel)[3]; }
+	static void StoreAlpha(uint8_t* pixel, float alpha) { ((float*)pixel)[3] = alpha; }
+};
+
+template<>
+struct BitmapFormat<Bitmap::BitmapType_Depth24Stencil8>
+{
+	static const int BYTES_PER_PIXEL = 4;
+	static const int DEPTH_SHIFT = 8;
+	static const uint32_t STENCIL_MASK = 0xFF;
+	static const uint32_t MAX_DEPTH = 0xFFFFFF;
+
+	// depth in [0, 1] to 24 bit unsigned normalized, rounded to nearest. 0 and 1 stay exact,
+	// so a cleared far plane reads back as 1, and a depth read back quantizes to the same value
+	static uint32_t QuantizeDepth(float depth)
+	{
+		uint32_t value = (uint32_t)(Mathf::Clamp01(depth) * 16777215.f + 0.5f);
+		return value > MAX_DEPTH ? MAX_DEPTH : value;
+	}
+	static float DequantizeDepth(uint32_t value) { return value / 16777215.f; }
+
+	static uint32_t Pack(float depth, uint8_t stencil) { return (QuantizeDepth(depth) << DEPTH_SHIFT) | stencil; }
+	static float UnpackDepth(uint32_t pixel) { return DequantizeDepth(pixel >> DEPTH_SHIFT); }
+
+	static Color Load(const uint8_t* pixel) { return Color(LoadAlpha(pixel), 1.f, 1.f, 1.f); }
+	static void Store(uint8_t* pixel, const Color& color) { StoreAlpha(pixel, color.a); }
+	static float LoadAlpha(const uint8_t* pixel) { return UnpackDepth(*(const uint32_t*)pixel); }
+	static void StoreAlpha(uint8_t* pixel, float alpha)
+	{
+		uint32_t& value = *(uint32_t*)pixel;
+		value = (QuantizeDepth(alpha) << DEPTH_SHIFT) | (value & STENCIL_MASK);
+	}
+};
+
+// a bitmap read as the format it was checked to have: the accessors inline to the conversion
+// of the format, so code picking the view once, per draw or per sample function, has no
+// per-pixel switch left. a view doesn't keep the bitmap alive
+template<Bitmap::BitmapType Format>
+class BitmapView
+{
+public:
+	typedef BitmapFormat<Format> FormatType;
+
+	explicit BitmapView(const Bitmap& bitmap) : bitmap(&bitmap), bytes(bitmap.GetBytes())
+	{
+		assert(bitmap.GetType() == Format);
+	}
+
+	int GetWidth() const { return bitmap->GetWidth(); }
+	int GetHeight() const { return bitmap->GetHeight(); }
+
+	const uint8_t* GetPixelAddress(int x, int y) const
+	{
+		assert(x >= 0 && x < bitmap->GetWidth());
+		assert(y >= 0 && y < bitmap->GetHeight());
+		return bytes + bitmap->GetPixelIndex(x, y) * FormatType::BYTES_PER_PIXEL;
+	}
+
+	Color GetPixel(int x, int y) const { return FormatType::Load(GetPixelAddress(x, y)); }
+	float GetAlpha(int x, int y) const { return FormatType::LoadAlpha(GetPixelAddress(x, y)); }
+
+protected:
+	const Bitmap* bitmap;
+	const uint8_t* bytes;
+};
+
+// a writable BitmapView
+template<Bitmap::BitmapType Format>
+class RWBitmapView : public BitmapView<Format>
+{
+public:
+	typedef BitmapFormat<Format> FormatType;
+
+	explicit RWBitmapView(Bitmap& bitmap) : BitmapView<Format>(bitmap), mutableBytes(bitmap.GetBytes())
+	{
+	}
+
+	uint8_t* GetPixelAddress(int x, int y) const
+	{
+		return mutableBytes + (BitmapView<Format>::GetPixelAddress(x, y) - this->bytes);
+	}
+
+	void SetPixel(int x, int y, const Color& color) const { FormatType::Store(GetPixelAddress(x, y), color); }
+	void SetAlpha(int x, int y, float alpha) const { FormatType::StoreAlpha(GetPixelAddress(x, y), alpha); }
+
+private:
+	uint8_t* mutableBytes;
+};
+
+} // namespace sr
+
+#endif // !_SOFTRENDER_BITMAP_VIEW_HPP_
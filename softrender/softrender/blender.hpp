@@ -57,6 +57,16 @@ public:
 		this->dstAlphaMode = dstBlendMode;
 	}
 
+	// the custom functions can't be compared, a blender with any of them is equal to none
+	bool operator ==(const Blender& other) const
+	{
+		return !blendOP && !srcBlendFactor && !dstBlendFactor
+			&& !other.blendOP && !other.srcBlendFactor && !other.dstBlendFactor
+			&& colorOP == other.colorOP && srcColorMode == other.srcColorMode && dstColorMode == other.dstColorMode
+			&& alphaOP == other.alphaOP && srcAlphaMode == other.srcAlphaMode && dstAlphaMode == other.dstAlphaMode;
+	}
+	bool operator !=(const Blender& other) const { return !(*this == other); }
+
 	Color Blend(const Color& src, const Color& dst) const
 	{
 		return ApplyBlendOP(GetSrcBlendFactor(src, dst) * src, GetDstBlendFactor(src, dst) * dst);
@@ -138,6 +148,8 @@ private:
 		return a + b;
 	}
 
+public:
+	// also called with constant modes by the specialized blend back-ends of PipelineState
 	static Vector3 _BlendRGBFactor(BlendMode mode, const Color& src, const Color& dst)
 	{
 		switch (mode)
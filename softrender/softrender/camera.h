@@ -34,8 +34,8 @@ public:
 	float GetLinearDepth(float projectionZ) const { return zNear_ / (projectionZ * (zNear_ - zFar_) + zFar_); }
 
 	ProjectionMode projectionMode() { return projectionMode_; }
-	float zFar() { return zFar_; }
-	float zNear() { return zNear_; }
+	float zFar() const { return zFar_; }
+	float zNear() const { return zNear_; }
 
 protected:
 	ProjectionMode projectionMode_;
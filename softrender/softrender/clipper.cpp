@@ -24,5 +24,23 @@ Clipper::Plane Clipper::viewFrustumPlanes[6] = {
 		[](const Vector4& v0, const Vector4& v1) { return Clipper::Clip(v0.y, v0.w, v1.y, v1.w); })
 };
 
+Clipper::Plane Clipper::guardBandPlanes[4] = {
+	Clipper::Plane(0x40,
+		[](const Vector4& v) {return v.x < -v.w * guardBandX; },
+		[](const Vector4& v0, const Vector4& v1) { return Clipper::Clip(v0.x, -v0.w * guardBandX, v1.x, -v1.w * guardBandX); }),
+	Clipper::Plane(0x100,
+		[](const Vector4& v) {return v.y < -v.w * guardBandY; },
+		[](const Vector4& v0, const Vector4& v1) { return Clipper::Clip(v0.y, -v0.w * guardBandY, v1.y, -v1.w * guardBandY); }),
+	Clipper::Plane(0x80,
+		[](const Vector4& v) {return v.x > v.w * guardBandX; },
+		[](const Vector4& v0, const Vector4& v1) { return Clipper::Clip(v0.x, v0.w * guardBandX, v1.x, v1.w * guardBandX); }),
+	Clipper::Plane(0x200,
+		[](const Vector4& v) {return v.y > v.w * guardBandY; },
+		[](const Vector4& v0, const Vector4& v1) { return Clipper::Clip(v0.y, v0.w * guardBandY, v1.y, v1.w * guardBandY); })
+};
+
+float Clipper::guardBandX = 1.f;
+float Clipper::guardBandY = 1.f;
+
 
 }
\ No newline at end of file
@@ -27,7 +27,26 @@ struct Clipper
 			clippingFunc(_clippingFunc) {}
 	};
 
+	// the rasterizer's integer edge functions stay in range for pixel coordinates within +-GUARD_BAND_PIXELS
+	static const int GUARD_BAND_PIXELS = 8192;
+	// near, far and the guard band, the only planes triangles are really clipped against
+	static const uint32_t CLIPPING_MASK = 0x3F0;
+	static const int NEAR_FAR_PLANE_COUNT = 2;
+
+	// near and far first
 	static Plane viewFrustumPlanes[6];
+	// the sides of the frustum pushed out to the guard band
+	static Plane guardBandPlanes[4];
+	static float guardBandX;
+	static float guardBandY;
+
+	// guard band extents in ndc for the render target size
+	static void SetGuardBand(int width, int height)
+	{
+		guardBandX = (float)(GUARD_BAND_PIXELS * 2) / width - 1.f;
+		guardBandY = (float)(GUARD_BAND_PIXELS * 2) / height - 1.f;
+	}
+
 	static uint32_t CalculateClipCode(const Vector4& hc)
 	{
 		uint32_t clipCode = 0x0;
@@ -38,6 +57,16 @@ struct Clipper
 				clipCode |= p.cullMask;
 			}
 		}
+		if (clipCode & 0xF)
+		{
+			for (auto& p : guardBandPlanes)
+			{
+				if (p.getClipCodeFunc(hc))
+				{
+					clipCode |= p.cullMask;
+				}
+			}
+		}
 		return clipCode;
 	}
 
@@ -70,13 +99,13 @@ struct Clipper
 		if (0 != (v0.clipCode & v1.clipCode & v2.clipCode)) return triangles;
 
 		triangles.emplace_back(v0, v1, v2);
-		if (0 == (v0.clipCode | v1.clipCode | v2.clipCode)) return triangles;
+		// crossing only the viewport sides is left to the rasterizer's scissor
+		if (0 == ((v0.clipCode | v1.clipCode | v2.clipCode) & CLIPPING_MASK)) return triangles;
 
 		std::vector<Triangle<Type> > clippedTriangles;
-		for (auto& p : viewFrustumPlanes)
-		//for (int i = 0; i < 2; ++i)
+		for (int i = 0; i < NEAR_FAR_PLANE_COUNT + 4; ++i)
 		{
-			//Plane& p = viewFrustumPlanes[i];
+			const Plane& p = (i < NEAR_FAR_PLANE_COUNT) ? viewFrustumPlanes[i] : guardBandPlanes[i - NEAR_FAR_PLANE_COUNT];
 			clippedTriangles.clear();
 			for (auto& f : triangles)
 			{
@@ -84,6 +113,11 @@ struct Clipper
 			}
 			std::swap(triangles, clippedTriangles);
 		}
+		// v0 is the provoking vertex, its flat members go to every clipped triangle whatever their first vertex
+		for (auto& f : triangles)
+		{
+			f.v0 = Type::WithFlatOf(f.v0, v0);
+		}
 		return triangles;
 	}
 
@@ -1,5 +1,6 @@
 #include "cubemap.h"
 #include "pbsf.hpp"
+#include "base/job_system.h"
 
 using namespace sr;
 
@@ -149,30 +150,38 @@ bool Cubemap::PrefilterEnvMap(uint32_t mapCount, uint32_t sampleCount) const
 	int width = latlong->GetWidth();
 	Bitmap::BitmapType type = latlong->GetBitmap(0)->GetType();
 	std::vector<BitmapPtr> bitmaps;
+	std::vector<std::pair<uint32_t, int> > rows; // (map, y)
 	for (uint32_t i = 0; i < mapCount; ++i)
 	{
 		height >>= 1;
 		if (height < 1) height = 1;
 		width = height * 2;
 
-		BitmapPtr bitmap = BitmapPtr(new Bitmap(width, height, type));
+		bitmaps.push_back(BitmapPtr(new Bitmap(width, height, type)));
+		for (int y = 0; y < height; ++y) rows.emplace_back(i, y);
+	}
+
+	// every map only samples the top level, so all rows of all maps are independent
+	JobSystem::ParallelFor((int)rows.size(), [&](int index, int threadIndex)
+	{
+		uint32_t i = rows[index].first;
+		int y = rows[index].second;
+		Bitmap& bitmap = *bitmaps[i];
+		int width = bitmap.GetWidth();
+		int height = bitmap.GetHeight();
 		float roughness = float(i + 1) / mapCount;
-		for (int y = 0; y < height; ++y)
+		for (int x = 0; x < width; ++x)
 		{
-			for (int x = 0; x < width; ++x)
-			{
-				float u = float(x) * Mathf::PI * 2.f / width;
-				float v = float(y) * Mathf::PI / height;
-				Vector3 dir = Vector3::zero;
-				dir.x = -Mathf::Sin(u) * Mathf::Sin(v);
-				dir.y = -Mathf::Cos(v);
-				dir.z = -Mathf::Cos(u) * Mathf::Sin(v);
-				Vector3 rgb = PBSF::PrefilterEnvMap(*this, roughness, dir, sampleCount);
-				bitmap->SetPixel(x, y, Color(rgb, 1.f));
-			}
+			float u = float(x) * Mathf::PI * 2.f / width;
+			float v = float(y) * Mathf::PI / height;
+			Vector3 dir = Vector3::zero;
+			dir.x = -Mathf::Sin(u) * Mathf::Sin(v);
+			dir.y = -Mathf::Cos(v);
+			dir.z = -Mathf::Cos(u) * Mathf::Sin(v);
+			Vector3 rgb = PBSF::PrefilterEnvMap(*this, roughness, dir, sampleCount);
+			bitmap.SetPixel(x, y, Color(rgb, 1.f));
 		}
-		bitmaps.push_back(bitmap);
-	}
+	});
 	latlong->SetMipmaps(bitmaps);
 	return true;
 }
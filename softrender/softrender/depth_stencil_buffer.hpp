@@ -0,0 +1,132 @@
+#ifndef _SOFTRENDER_DEPTH_STENCIL_BUFFER_H_
+#define _SOFTRENDER_DEPTH_STENCIL_BUFFER_H_
+
+#include "base/header.h"
+#include "bitmap.h"
+#include "bitmap_view.hpp"
+
+namespace sr
+{
+
+class DepthStencilBuffer;
+typedef std::shared_ptr<DepthStencilBuffer> DepthStencilBufferPtr;
+
+// the linear depth and the stencil of a render target packed in 32 bits, so a stencil tested pixel
+// is fetched with one load. always laid out in tiles: the four pixels of an aligned 2x2 quad sit
+// side by side in lane order, and a quad is tested or written with a single load and store.
+// it stays a Bitmap, sampling it reads the depth in alpha
+class DepthStencilBuffer : public Bitmap
+{
+public:
+	typedef BitmapFormat<BitmapType_Depth24Stencil8> FormatType;
+
+	DepthStencilBuffer(int width, int height) : Bitmap(width, height, BitmapType_Depth24Stencil8, Layout_Tiled)
+	{
+		Clear(1.f, 0);
+	}
+
+	// fast clears like Bitmap::Clear, of the whole buffer or the inclusive pixel rect
+	void Clear(float depth, uint8_t stencil) { Clear(depth, stencil, 0, 0, width - 1, height - 1); }
+	void Clear(float depth, uint8_t stencil, int minX, int minY, int maxX, int maxY)
+	{
+		ClearValue(FormatType::Pack(depth, stencil), 0, minX, minY, maxX, maxY);
+	}
+
+	// clears the depth and keeps the stencil
+	void ClearDepth(float depth) { ClearDepth(depth, 0, 0, width - 1, height - 1); }
+	void ClearDepth(float depth, int minX, int minY, int maxX, int maxY)
+	{
+		ClearValue(FormatType::Pack(depth, 0), FormatType::STENCIL_MASK, minX, minY, maxX, maxY);
+	}
+
+	// clears the stencil and keeps the depth
+	void ClearStencil(uint8_t stencil) { ClearStencil(stencil, 0, 0, width - 1, height - 1); }
+	void ClearStencil(uint8_t stencil, int minX, int minY, int maxX, int maxY)
+	{
+		ClearValue(stencil, ~FormatType::STENCIL_MASK, minX, minY, maxX, maxY);
+	}
+
+	// the pixel accessors resolve the pending clear of their tile, GetQuad doesn't.
+	// the packed depth and stencil of the pixel
+	uint32_t GetValue(int x, int y) const
+	{
+		ResolveClears(x, y, x, y);
+		return ((const uint32_t*)bytes)[GetPixelIndex(x, y)];
+	}
+
+	float GetDepth(int x, int y) const
+	{
+		return FormatType::UnpackDepth(GetValue(x, y));
+	}
+
+	uint8_t GetStencil(int x, int y) const
+	{
+		return (uint8_t)(GetValue(x, y) & FormatType::STENCIL_MASK);
+	}
+
+	void SetStencil(int x, int y, uint8_t stencil)
+	{
+		ResolveClears(x, y, x, y);
+		uint32_t& pixel = ((uint32_t*)bytes)[GetPixelIndex(x, y)];
+		pixel = (pixel & ~FormatType::STENCIL_MASK) | stencil;
+	}
+
+	// the pixels of the quad at the even pixel (x, y), lane i at (x + (i & 1), y + (i >> 1)).
+	// the quad may reach into the padding of the tiles, never out of the storage
+	const uint32_t* GetQuad(int x, int y) const
+	{
+		assert(((x | y) & 1) == 0);
+		return (const uint32_t*)bytes + GetPixelIndex(x, y);
+	}
+
+	uint32_t* GetQuad(int x, int y)
+	{
+		assert(((x | y) & 1) == 0);
+		return (uint32_t*)bytes + GetPixelIndex(x, y);
+	}
+
+#if _MATH_SIMD_INTRINSIC_
+	// FormatType::QuantizeDepth of four depths
+	static __m128i QuantizeDepthx4(const float depth[4])
+	{
+		__m128 clamped = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(depth), _mm_setzero_ps()), _mm_set1_ps(1.f));
+		__m128i value = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(clamped, _mm_set1_ps(16777215.f)), _mm_set1_ps(0.5f)));
+		return _mm_min_epi32(value, _mm_set1_epi32(FormatType::MAX_DEPTH));
+	}
+#endif
+
+	// writes the depths of the quad lanes in mask and keeps their stencil
+	void WriteQuadDepth(int x, int y, const float depth[4], uint8_t mask)
+	{
+		uint32_t* quad = GetQuad(x, y);
+#if _MATH_SIMD_INTRINSIC_
+		__m128i dst = _mm_loadu_si128((const __m128i*)quad);
+		__m128i stencil = _mm_and_si128(dst, _mm_set1_epi32(FormatType::STENCIL_MASK));
+		__m128i src = _mm_or_si128(_mm_slli_epi32(QuantizeDepthx4(depth), FormatType::DEPTH_SHIFT), stencil);
+		if (mask != 0xF)
+		{
+			__m128i laneBits = _mm_set_epi32(8, 4, 2, 1);
+			__m128i laneMask = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(mask), laneBits), laneBits);
+			src = _mm_blendv_epi8(dst, src, laneMask);
+		}
+		_mm_storeu_si128((__m128i*)quad, src);
+#else
+		for (int i = 0; i < 4; ++i)
+		{
+			if (mask & (1 << i)) quad[i] = (FormatType::QuantizeDepth(depth[i]) << FormatType::DEPTH_SHIFT) | (quad[i] & FormatType::STENCIL_MASK);
+		}
+#endif
+	}
+
+private:
+	void ClearValue(uint32_t value, uint32_t keepMask, int minX, int minY, int maxX, int maxY)
+	{
+		uint8_t packed[sizeof(TileClear::value)] = {};
+		memcpy(packed, &value, sizeof(value));
+		ClearPacked(packed, keepMask, minX, minY, maxX, maxY);
+	}
+};
+
+} // namespace sr
+
+#endif // !_SOFTRENDER_DEPTH_STENCIL_BUFFER_H_
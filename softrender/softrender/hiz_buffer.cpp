@@ -0,0 +1,95 @@
+#include "hiz_buffer.h"
+using namespace sr;
+
+HiZBuffer::HiZBuffer(DepthStencilBufferPtr depthStencilBuffer)
+{
+	assert(depthStencilBuffer != nullptr);
+	this->depthStencilBuffer = depthStencilBuffer;
+	width = depthStencilBuffer->GetWidth();
+	height = depthStencilBuffer->GetHeight();
+	blockCountX = (width + BLOCK_SIZE - 1) >> BLOCK_SIZE_SHIFT;
+	blockCountY = (height + BLOCK_SIZE - 1) >> BLOCK_SIZE_SHIFT;
+	blocks.resize(blockCountX * blockCountY);
+	Invalidate();
+}
+
+void HiZBuffer::Clear(float depth)
+{
+	uint32_t quantized = DepthStencilBuffer::FormatType::QuantizeDepth(depth);
+	for (auto& block : blocks)
+	{
+		block.minDepth = MinBound(quantized);
+		block.maxDepth = MaxBound(quantized);
+		block.isDirty = false;
+	}
+}
+
+void HiZBuffer::Invalidate()
+{
+	for (auto& block : blocks)
+	{
+		block.minDepth = -Mathf::inifinity;
+		block.maxDepth = Mathf::inifinity;
+		block.isDirty = true;
+	}
+}
+
+void HiZBuffer::UpdateBlock(int blockX, int blockY)
+{
+	int minX = blockX << BLOCK_SIZE_SHIFT;
+	int minY = blockY << BLOCK_SIZE_SHIFT;
+	int maxX = Mathf::Min(minX + BLOCK_SIZE, width);
+	int maxY = Mathf::Min(minY + BLOCK_SIZE, height);
+
+	// the tiles of a depth buffer hold whole blocks, a pending clear is resolved for the block's tile
+	depthStencilBuffer->ResolveClears(minX, minY, maxX - 1, maxY - 1);
+
+	// the stencil bits below the depth don't change the order of the packed pixels
+	const int depthShift = DepthStencilBuffer::FormatType::DEPTH_SHIFT;
+	uint32_t minPixel = 0xFFFFFFFF;
+	uint32_t maxPixel = 0;
+	static_assert(Bitmap::TILE_SIZE % BLOCK_SIZE == 0, "tiles of the depth buffer must hold whole blocks");
+	if (maxX - minX == BLOCK_SIZE && maxY - minY == BLOCK_SIZE)
+	{
+		// a whole block is contiguous in the tiled depth buffer
+		const uint32_t* pixels = depthStencilBuffer->GetQuad(minX, minY);
+		for (int i = 0; i < BLOCK_SIZE * BLOCK_SIZE; ++i)
+		{
+			minPixel = Mathf::Min(minPixel, pixels[i]);
+			maxPixel = Mathf::Max(maxPixel, pixels[i]);
+		}
+	}
+	else
+	{
+		for (int y = minY; y < maxY; ++y)
+		{
+			for (int x = minX; x < maxX; ++x)
+			{
+				uint32_t pixel = depthStencilBuffer->GetValue(x, y);
+				minPixel = Mathf::Min(minPixel, pixel);
+				maxPixel = Mathf::Max(maxPixel, pixel);
+			}
+		}
+	}
+
+	Block& block = blocks[blockY * blockCountX + blockX];
+	block.minDepth = MinBound(minPixel >> depthShift);
+	block.maxDepth = MaxBound(maxPixel >> depthShift);
+	block.isDirty = false;
+}
+
+void HiZBuffer::GetDepthRange(int minX, int minY, int maxX, int maxY, float& minDepth, float& maxDepth)
+{
+	minDepth = Mathf::inifinity;
+	maxDepth = -Mathf::inifinity;
+	for (int blockY = (minY >> BLOCK_SIZE_SHIFT); blockY <= (maxY >> BLOCK_SIZE_SHIFT); ++blockY)
+	{
+		for (int blockX = (minX >> BLOCK_SIZE_SHIFT); blockX <= (maxX >> BLOCK_SIZE_SHIFT); ++blockX)
+		{
+			Block& block = blocks[blockY * blockCountX + blockX];
+			if (block.isDirty) UpdateBlock(blockX, blockY);
+			minDepth = Mathf::Min(minDepth, block.minDepth);
+			maxDepth = Mathf::Max(maxDepth, block.maxDepth);
+		}
+	}
+}
@@ -0,0 +1,100 @@
+#ifndef _SOFTRENDER_HIZ_BUFFER_H_
+#define _SOFTRENDER_HIZ_BUFFER_H_
+
+#include "base/header.h"
+#include "math/mathf.h"
+#include "softrender/depth_stencil_buffer.hpp"
+
+namespace sr
+{
+
+class HiZBuffer;
+typedef std::shared_ptr<HiZBuffer> HiZBufferPtr;
+
+// min/max depth of every 8x8 block of a depth buffer, lets blocks and triangles that can't
+// pass the depth test be rejected without reading their pixels.
+// depth writes only widen the bounds of their block, the exact range is recomputed on the next query.
+// the bounds cover every depth quantizing to the 24 bit values of the block, so a test against them
+// stays conservative for the fixed point compare of the pixels
+class HiZBuffer
+{
+public:
+	static const int BLOCK_SIZE_SHIFT = 3;
+	static const int BLOCK_SIZE = (1 << BLOCK_SIZE_SHIFT);
+
+	HiZBuffer(DepthStencilBufferPtr depthStencilBuffer);
+
+	void Clear(float depth);
+	// the depth buffer was written without going through OnQuadDepthWrite
+	void Invalidate();
+
+	// the depth of the lanes in mask of the quad at the even pixel (x, y) was written, a quad never straddles two blocks
+	void OnQuadDepthWrite(int x, int y, uint8_t mask)
+	{
+		Block& block = blocks[(y >> BLOCK_SIZE_SHIFT) * blockCountX + (x >> BLOCK_SIZE_SHIFT)];
+		const uint32_t* pixels = depthStencilBuffer->GetQuad(x, y);
+		for (int i = 0; i < 4; ++i)
+		{
+			if (!(mask & (1 << i))) continue;
+			uint32_t depth = pixels[i] >> DepthStencilBuffer::FormatType::DEPTH_SHIFT;
+			block.minDepth = Mathf::Min(block.minDepth, MinBound(depth));
+			block.maxDepth = Mathf::Max(block.maxDepth, MaxBound(depth));
+		}
+		block.isDirty = true;
+	}
+
+	// mayPass(bufferMin, bufferMax) returns false when no pixel can pass against buffer depths in that range.
+	// returns false when that holds for the block containing (x, y)
+	template<typename TestFunc>
+	bool TestBlock(int x, int y, const TestFunc& mayPass)
+	{
+		Block& block = blocks[(y >> BLOCK_SIZE_SHIFT) * blockCountX + (x >> BLOCK_SIZE_SHIFT)];
+		if (!mayPass(block.minDepth, block.maxDepth)) return false;
+		if (!block.isDirty) return true;
+
+		UpdateBlock(x >> BLOCK_SIZE_SHIFT, y >> BLOCK_SIZE_SHIFT);
+		return mayPass(block.minDepth, block.maxDepth);
+	}
+
+	// same for every block overlapping the inclusive pixel rect
+	template<typename TestFunc>
+	bool TestRect(int minX, int minY, int maxX, int maxY, const TestFunc& mayPass)
+	{
+		for (int y = (minY & ~(BLOCK_SIZE - 1)); y <= maxY; y += BLOCK_SIZE)
+		{
+			for (int x = (minX & ~(BLOCK_SIZE - 1)); x <= maxX; x += BLOCK_SIZE)
+			{
+				if (TestBlock(x, y, mayPass)) return true;
+			}
+		}
+		return false;
+	}
+
+	// min and max depth of the blocks overlapping the inclusive pixel rect
+	void GetDepthRange(int minX, int minY, int maxX, int maxY, float& minDepth, float& maxDepth);
+
+private:
+	struct Block
+	{
+		float minDepth;
+		float maxDepth;
+		bool isDirty;
+	};
+
+	// bounds of the depths quantizing to a 24 bit buffer depth, widened by a whole step for the rounding
+	static float MinBound(uint32_t depth) { return DepthStencilBuffer::FormatType::DequantizeDepth(depth) - 1.f / 16777215.f; }
+	static float MaxBound(uint32_t depth) { return DepthStencilBuffer::FormatType::DequantizeDepth(depth) + 1.f / 16777215.f; }
+
+	void UpdateBlock(int blockX, int blockY);
+
+	DepthStencilBufferPtr depthStencilBuffer = nullptr;
+	int width = 0;
+	int height = 0;
+	int blockCountX = 0;
+	int blockCountY = 0;
+	std::vector<Block> blocks;
+};
+
+}
+
+#endif //! _SOFTRENDER_HIZ_BUFFER_H_
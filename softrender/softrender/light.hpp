@@ -4,10 +4,26 @@
 #include "base/header.h"
 #include "math/color.h"
 #include "math/vector3.h"
+#include "math/vector4.h"
+#include "softrender/camera.h"
 
 namespace sr
 {
 
+// a light as the shaders see it, see IShader::InitLightArgs
+struct LightData
+{
+	// w is 0 for a directional light, xyz is then its forward direction
+	Vector4 worldSpacePos;
+	// color * intensity
+	Color color;
+	// atten0, atten1, atten2, range
+	Vector4 atten;
+	Vector3 spotDir;
+	// cosHalfPhi, cosHalfTheta, falloff, x is negative for lights that aren't spot lights
+	Vector3 spotParams;
+};
+
 struct Light;
 typedef std::shared_ptr<Light> LightPtr;
 
@@ -35,6 +51,7 @@ struct Light
     float cosHalfTheta;
     float cosHalfPhi;
     
+    // once the light is set up and again after theta or phi change, GetLightData reads what it derives
     void Initilize()
     {
         if (type == LightType_Spot)
@@ -44,6 +61,18 @@ struct Light
         }
     }
 
+	LightData GetLightData() const
+	{
+		LightData data;
+		data.worldSpacePos = (type == LightType_Directional) ? Vector4(transform.forward(), 0.f) : Vector4(transform.position, 1.f);
+		data.color = color;
+		data.color *= intensity;
+		data.atten = Vector4(atten0, atten1, atten2, range);
+		data.spotDir = (type == LightType_Spot) ? Vector3(transform.forward()) : Vector3::zero;
+		data.spotParams = (type == LightType_Spot) ? Vector3(cosHalfPhi, cosHalfTheta, falloff) : Vector3(-1.f, -1.f, 0.f);
+		return data;
+	}
+
 	Matrix4x4 GetProjectionToWorldSpaceMatrix(const CameraPtr& camera)
 	{
 		return transform.worldToLocalMatrix() * (camera->projectionMatrix() * camera->viewMatrix()).Inverse();
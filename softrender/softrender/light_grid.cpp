@@ -0,0 +1,151 @@
+#include "light_grid.h"
+#include "math/mathf.h"
+using namespace sr;
+
+void LightGrid::Build(const std::vector<LightPtr>& lights, const CameraPtr& camera, HiZBuffer& hizBuffer, int width, int height)
+{
+	this->width = width;
+	this->height = height;
+	tileCountX = (width + TILE_SIZE - 1) >> TILE_SIZE_SHIFT;
+	tileCountY = (height + TILE_SIZE - 1) >> TILE_SIZE_SHIFT;
+	isPerspective = (camera->projectionMode() == Camera::ProjectionMode_Perspective);
+	zNear = camera->zNear();
+	zFar = camera->zFar();
+	sliceScale = SLICE_COUNT / Mathf::Log2(zFar / zNear);
+
+	Matrix4x4 projection = camera->projectionMatrix();
+	Matrix4x4 invProjection = projection.Inverse();
+	tiles.resize(tileCountX * tileCountY);
+	clusters.resize(tiles.size() * SLICE_COUNT);
+	for (auto& cluster : clusters) cluster.clear();
+	for (int tileY = 0; tileY < tileCountY; ++tileY)
+	{
+		for (int tileX = 0; tileX < tileCountX; ++tileX)
+		{
+			SetupTile(tiles[tileY * tileCountX + tileX], tileX, tileY, invProjection, hizBuffer);
+		}
+	}
+
+	Matrix4x4 viewMatrix = camera->viewMatrix();
+	this->lights.clear();
+	for (auto& light : lights)
+	{
+		int index = (int)this->lights.size();
+		this->lights.push_back(light->GetLightData());
+		if (light->type != Light::LightType_Directional)
+		{
+			// spot lights are binned with the sphere of their range
+			BinLight(index, viewMatrix.MultiplyPoint3x4(light->transform.position), light->range, projection);
+			continue;
+		}
+
+		for (int i = 0; i < (int)tiles.size(); ++i)
+		{
+			const TileFrustum& tile = tiles[i];
+			for (int slice = GetSlice(tile.minViewDepth); slice <= GetSlice(tile.maxViewDepth); ++slice)
+			{
+				clusters[i * SLICE_COUNT + slice].push_back(index);
+			}
+		}
+	}
+}
+
+void LightGrid::SetupTile(TileFrustum& tile, int tileX, int tileY, const Matrix4x4& invProjection, HiZBuffer& hizBuffer)
+{
+	int minX = tileX << TILE_SIZE_SHIFT;
+	int minY = tileY << TILE_SIZE_SHIFT;
+	int maxX = Mathf::Min(minX + TILE_SIZE, width) - 1;
+	int maxY = Mathf::Min(minY + TILE_SIZE, height) - 1;
+
+	float minDepth, maxDepth;
+	hizBuffer.GetDepthRange(minX, minY, maxX, maxY, minDepth, maxDepth);
+	tile.minViewDepth = ToViewDepth(minDepth);
+	tile.maxViewDepth = ToViewDepth(maxDepth);
+
+	// a pixel of slack around the tile for the rounding of the projected vertices
+	float ndcX[2] = { (minX - 1) * 2.f / width - 1.f, (maxX + 1) * 2.f / width - 1.f };
+	float ndcY[2] = { (minY - 1) * 2.f / height - 1.f, (maxY + 1) * 2.f / height - 1.f };
+	for (int i = 0; i < 4; ++i)
+	{
+		Vector4 nearCorner = invProjection.MultiplyPoint(Vector3(ndcX[i & 1], ndcY[i >> 1], 0.f));
+		Vector4 farCorner = invProjection.MultiplyPoint(Vector3(ndcX[i & 1], ndcY[i >> 1], 1.f));
+		tile.nearCorners[i] = nearCorner.xyz / nearCorner.w;
+		tile.farCorners[i] = farCorner.xyz / farCorner.w;
+	}
+}
+
+void LightGrid::BinLight(int index, const Vector3& viewPos, float range, const Matrix4x4& projection)
+{
+	float minViewDepth = viewPos.z - range;
+	float maxViewDepth = viewPos.z + range;
+	if (maxViewDepth < zNear || minViewDepth > zFar) return;
+
+	// tiles under the projected box around the light, all of them when it reaches behind the camera
+	int minTileX = 0;
+	int minTileY = 0;
+	int maxTileX = tileCountX - 1;
+	int maxTileY = tileCountY - 1;
+	if (!isPerspective || minViewDepth > 0.f)
+	{
+		float minNdcX = Mathf::inifinity, minNdcY = Mathf::inifinity;
+		float maxNdcX = -Mathf::inifinity, maxNdcY = -Mathf::inifinity;
+		for (int i = 0; i < 8; ++i)
+		{
+			Vector3 corner = viewPos + Vector3((i & 1) ? range : -range, (i & 2) ? range : -range, (i & 4) ? range : -range);
+			Vector4 position = projection.MultiplyPoint(corner);
+			minNdcX = Mathf::Min(minNdcX, position.x / position.w);
+			minNdcY = Mathf::Min(minNdcY, position.y / position.w);
+			maxNdcX = Mathf::Max(maxNdcX, position.x / position.w);
+			maxNdcY = Mathf::Max(maxNdcY, position.y / position.w);
+		}
+		if (maxNdcX < -1.f || maxNdcY < -1.f || minNdcX > 1.f || minNdcY > 1.f) return;
+
+		minTileX = Mathf::Clamp(Mathf::FloorToInt((minNdcX + 1.f) * 0.5f * width) - 1, 0, width - 1) >> TILE_SIZE_SHIFT;
+		minTileY = Mathf::Clamp(Mathf::FloorToInt((minNdcY + 1.f) * 0.5f * height) - 1, 0, height - 1) >> TILE_SIZE_SHIFT;
+		maxTileX = Mathf::Clamp(Mathf::CeilToInt((maxNdcX + 1.f) * 0.5f * width) + 1, 0, width - 1) >> TILE_SIZE_SHIFT;
+		maxTileY = Mathf::Clamp(Mathf::CeilToInt((maxNdcY + 1.f) * 0.5f * height) + 1, 0, height - 1) >> TILE_SIZE_SHIFT;
+	}
+
+	for (int tileY = minTileY; tileY <= maxTileY; ++tileY)
+	{
+		for (int tileX = minTileX; tileX <= maxTileX; ++tileX)
+		{
+			// only the slices holding depths of the tile
+			int tileIndex = tileY * tileCountX + tileX;
+			const TileFrustum& tile = tiles[tileIndex];
+			float reachedMin = Mathf::Max(minViewDepth, tile.minViewDepth);
+			float reachedMax = Mathf::Min(maxViewDepth, tile.maxViewDepth);
+			if (reachedMin > reachedMax) continue;
+
+			for (int slice = GetSlice(reachedMin); slice <= GetSlice(reachedMax); ++slice)
+			{
+				float sliceMin = Mathf::Max(GetSliceDepth(slice), tile.minViewDepth);
+				float sliceMax = Mathf::Min(GetSliceDepth(slice + 1), tile.maxViewDepth);
+				if (IsClusterReached(tile, sliceMin, sliceMax, viewPos, range))
+				{
+					clusters[tileIndex * SLICE_COUNT + slice].push_back(index);
+				}
+			}
+		}
+	}
+}
+
+bool LightGrid::IsClusterReached(const TileFrustum& tile, float minViewDepth, float maxViewDepth, const Vector3& viewPos, float range) const
+{
+	// view space box of the tile frustum between the two depths
+	Vector3 boxMin(Mathf::inifinity, Mathf::inifinity, Mathf::inifinity);
+	Vector3 boxMax(-Mathf::inifinity, -Mathf::inifinity, -Mathf::inifinity);
+	for (int i = 0; i < 4; ++i)
+	{
+		const Vector3& nearCorner = tile.nearCorners[i];
+		const Vector3& farCorner = tile.farCorners[i];
+		float depthRange = farCorner.z - nearCorner.z;
+		Vector3 p0 = Vector3::LinearInterp(nearCorner, farCorner, (minViewDepth - nearCorner.z) / depthRange);
+		Vector3 p1 = Vector3::LinearInterp(nearCorner, farCorner, (maxViewDepth - nearCorner.z) / depthRange);
+		boxMin = Vector3::Min(boxMin, Vector3::Min(p0, p1));
+		boxMax = Vector3::Max(boxMax, Vector3::Max(p0, p1));
+	}
+
+	Vector3 closest = Vector3::Max(boxMin, Vector3::Min(viewPos, boxMax));
+	return (closest - viewPos).SqrLength() <= range * range;
+}
@@ -0,0 +1,91 @@
+#ifndef _SOFTRENDER_LIGHT_GRID_H_
+#define _SOFTRENDER_LIGHT_GRID_H_
+
+#include "base/header.h"
+#include "math/vector3.h"
+#include "math/matrix4x4.h"
+#include "softrender/camera.h"
+#include "softrender/light.hpp"
+#include "softrender/hiz_buffer.h"
+
+namespace sr
+{
+
+// clustered light culling: the screen is cut into tiles, and every tile into slices growing
+// exponentially with the view depth. the lights are binned into the clusters their range reaches,
+// only over the depth range the depth buffer holds in a tile, so a pass over the screen can shade
+// every pixel with the lights of its cluster instead of drawing a volume per light
+class LightGrid
+{
+public:
+	static const int TILE_SIZE_SHIFT = 5;
+	static const int TILE_SIZE = (1 << TILE_SIZE_SHIFT);
+	static const int SLICE_COUNT = 16;
+
+	LightGrid() = default;
+
+	// hizBuffer bounds the depth buffer the lights are binned against, which holds the depth of a camera
+	// of that projection: view depth / far for a perspective camera, the projected z for an orthographic one
+	void Build(const std::vector<LightPtr>& lights, const CameraPtr& camera, HiZBuffer& hizBuffer, int width, int height);
+
+	// indices of the lights reaching the cluster of the pixel (x, y) with depth, the value of its depth buffer.
+	// the pixel must be on the render target, a caller deriving it from interpolated coordinates clamps it
+	const std::vector<int>& GetLights(int x, int y, float depth) const
+	{
+		assert(x >= 0 && x < width && y >= 0 && y < height);
+		int tileX = x >> TILE_SIZE_SHIFT;
+		int tileY = y >> TILE_SIZE_SHIFT;
+		return clusters[(tileY * tileCountX + tileX) * SLICE_COUNT + GetSlice(ToViewDepth(depth))];
+	}
+
+	const LightData& GetLight(int index) const { return lights[index]; }
+	int GetLightCount() const { return (int)lights.size(); }
+
+private:
+	// view space corners of a tile's frustum on the near and the far plane
+	struct TileFrustum
+	{
+		Vector3 nearCorners[4];
+		Vector3 farCorners[4];
+		float minViewDepth;
+		float maxViewDepth;
+	};
+
+	float ToViewDepth(float depth) const
+	{
+		return isPerspective ? depth * zFar : zNear + depth * (zFar - zNear);
+	}
+
+	int GetSlice(float viewDepth) const
+	{
+		if (viewDepth <= zNear) return 0;
+		return Mathf::Min(Mathf::FloorToInt(Mathf::Log2(viewDepth / zNear) * sliceScale), SLICE_COUNT - 1);
+	}
+
+	float GetSliceDepth(int slice) const
+	{
+		return zNear * Mathf::Pow(zFar / zNear, (float)slice / SLICE_COUNT);
+	}
+
+	void SetupTile(TileFrustum& tile, int tileX, int tileY, const Matrix4x4& invProjection, HiZBuffer& hizBuffer);
+	void BinLight(int index, const Vector3& viewPos, float range, const Matrix4x4& projection);
+	bool IsClusterReached(const TileFrustum& tile, float minViewDepth, float maxViewDepth, const Vector3& viewPos, float range) const;
+
+	int width = 0;
+	int height = 0;
+	int tileCountX = 0;
+	int tileCountY = 0;
+	bool isPerspective = true;
+	float zNear = 0.f;
+	float zFar = 0.f;
+	float sliceScale = 0.f;
+
+	std::vector<LightData> lights;
+	std::vector<TileFrustum> tiles;
+	// light indices of every cluster, the slices of a tile side by side
+	std::vector<std::vector<int>> clusters;
+};
+
+}
+
+#endif //! _SOFTRENDER_LIGHT_GRID_H_
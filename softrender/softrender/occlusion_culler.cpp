@@ -0,0 +1,210 @@
+#include "occlusion_culler.h"
+#include "math/mathf.h"
+using namespace sr;
+
+static const uint16_t FULL_MASK = 0xFFFF;
+
+void OcclusionCuller::Initialize(int width, int height)
+{
+	if (this->width == width && this->height == height) return;
+
+	this->width = width;
+	this->height = height;
+	cellCountX = (width + CELL_SIZE - 1) >> CELL_SIZE_SHIFT;
+	cellCountY = (height + CELL_SIZE - 1) >> CELL_SIZE_SHIFT;
+	cells.resize(cellCountX * cellCountY);
+	for (int cy = 0; cy < cellCountY; ++cy)
+	{
+		for (int cx = 0; cx < cellCountX; ++cx)
+		{
+			uint16_t borderMask = 0x0;
+			for (int j = 0; j < CELL_SIZE; ++j)
+			{
+				for (int i = 0; i < CELL_SIZE; ++i)
+				{
+					int x = (cx << CELL_SIZE_SHIFT) + i;
+					int y = (cy << CELL_SIZE_SHIFT) + j;
+					if (x >= width || y >= height) borderMask |= (1 << (j * CELL_SIZE + i));
+				}
+			}
+			cells[cy * cellCountX + cx].borderMask = borderMask;
+		}
+	}
+	Clear();
+}
+
+void OcclusionCuller::Clear()
+{
+	for (auto& cell : cells)
+	{
+		cell.zMax0 = Mathf::inifinity;
+		cell.zMax1 = -Mathf::inifinity;
+		cell.mask = cell.borderMask;
+	}
+	hasOccluders = false;
+}
+
+OcclusionCuller::ScreenVertex OcclusionCuller::ToScreen(const Vector4& position) const
+{
+	// snapped like Projection, so covered samples are covered by the real draw as well
+	float invW = 1.f / position.w;
+	ScreenVertex v;
+	v.x = (float)Mathf::RoundToInt(((position.x * invW) + 1.f) / 2.f * width);
+	v.y = (float)Mathf::RoundToInt(((position.y * invW) + 1.f) / 2.f * height);
+	v.z = position.z * invW;
+	return v;
+}
+
+void OcclusionCuller::AddOccluder(const std::vector<Vector3>& vertices, const std::vector<uint16_t>& indices,
+	const Matrix4x4& modelMatrix, const Matrix4x4& viewProjection)
+{
+	if (cells.empty()) return;
+
+	if (!hasOccluders)
+	{
+		occluderViewProjection = viewProjection;
+		hasOccluders = true;
+	}
+	else if (!std::equal(viewProjection.m, viewProjection.m + 16, occluderViewProjection.m))
+	{
+		assert(false);
+		return;
+	}
+
+	Matrix4x4 mvp = viewProjection.Multiply(modelMatrix);
+	std::vector<Vector4> positions(vertices.size());
+	for (size_t i = 0; i < vertices.size(); ++i)
+	{
+		positions[i] = mvp.MultiplyPoint(vertices[i]);
+	}
+
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		const Vector4& p0 = positions[indices[i]];
+		const Vector4& p1 = positions[indices[i + 1]];
+		const Vector4& p2 = positions[indices[i + 2]];
+		if (p0.z < 0.f || p1.z < 0.f || p2.z < 0.f) continue;
+
+		RasterizeOccluder(ToScreen(p0), ToScreen(p1), ToScreen(p2));
+	}
+}
+
+void OcclusionCuller::RasterizeOccluder(const ScreenVertex& v0, const ScreenVertex& _v1, const ScreenVertex& _v2)
+{
+	// occluders hide from both sides, wind every triangle the same way
+	float area = (_v1.x - v0.x) * (_v2.y - v0.y) - (_v1.y - v0.y) * (_v2.x - v0.x);
+	if (area == 0.f) return;
+	const ScreenVertex& v1 = (area > 0.f) ? _v1 : _v2;
+	const ScreenVertex& v2 = (area > 0.f) ? _v2 : _v1;
+	area = Mathf::Abs(area);
+
+	int minX = Mathf::Max(Mathf::CeilToInt(Mathf::Min(v0.x, v1.x, v2.x)), 0);
+	int minY = Mathf::Max(Mathf::CeilToInt(Mathf::Min(v0.y, v1.y, v2.y)), 0);
+	int maxX = Mathf::Min(Mathf::FloorToInt(Mathf::Max(v0.x, v1.x, v2.x)), width - 1);
+	int maxY = Mathf::Min(Mathf::FloorToInt(Mathf::Max(v0.y, v1.y, v2.y)), height - 1);
+	if (maxX < minX || maxY < minY) return;
+
+	// z/w is linear in screen space, its max over a cell is at one of the cell's corner samples
+	float dzdx = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) / area;
+	float dzdy = ((v2.z - v0.z) * (v1.x - v0.x) - (v1.z - v0.z) * (v2.x - v0.x)) / area;
+	float zTriangleMax = Mathf::Max(v0.z, v1.z, v2.z);
+
+	for (int cy = (minY >> CELL_SIZE_SHIFT); cy <= (maxY >> CELL_SIZE_SHIFT); ++cy)
+	{
+		for (int cx = (minX >> CELL_SIZE_SHIFT); cx <= (maxX >> CELL_SIZE_SHIFT); ++cx)
+		{
+			float x0 = (float)(cx << CELL_SIZE_SHIFT);
+			float y0 = (float)(cy << CELL_SIZE_SHIFT);
+
+			// only samples strictly inside, the real draw covers at least those
+			uint16_t mask = 0x0;
+			for (int j = 0; j < CELL_SIZE; ++j)
+			{
+				for (int i = 0; i < CELL_SIZE; ++i)
+				{
+					float x = x0 + i;
+					float y = y0 + j;
+					float w0 = (v1.x - v0.x) * (y - v0.y) - (v1.y - v0.y) * (x - v0.x);
+					float w1 = (v2.x - v1.x) * (y - v1.y) - (v2.y - v1.y) * (x - v1.x);
+					float w2 = (v0.x - v2.x) * (y - v2.y) - (v0.y - v2.y) * (x - v2.x);
+					if (w0 > 0.f && w1 > 0.f && w2 > 0.f) mask |= (1 << (j * CELL_SIZE + i));
+				}
+			}
+			if (mask == 0) continue;
+
+			float z = v0.z + (x0 - v0.x) * dzdx + (y0 - v0.y) * dzdy;
+			float zCellMax = z + Mathf::Max(0.f, dzdx) * (CELL_SIZE - 1) + Mathf::Max(0.f, dzdy) * (CELL_SIZE - 1);
+			UpdateCell(cells[cy * cellCountX + cx], mask, Mathf::Min(zCellMax, zTriangleMax));
+		}
+	}
+}
+
+void OcclusionCuller::UpdateCell(Cell& cell, uint16_t mask, float zMax)
+{
+	// nothing closer than what the cell already hides
+	if (zMax >= cell.zMax0) return;
+
+	if ((mask | cell.borderMask) == FULL_MASK)
+	{
+		cell.zMax0 = zMax;
+		if (cell.zMax1 >= zMax)
+		{
+			cell.zMax1 = -Mathf::inifinity;
+			cell.mask = cell.borderMask;
+		}
+		return;
+	}
+
+	// merge into the working layer, once it covers the whole cell it becomes the new reference
+	cell.mask |= mask;
+	cell.zMax1 = Mathf::Max(cell.zMax1, zMax);
+	if (cell.mask == FULL_MASK)
+	{
+		cell.zMax0 = cell.zMax1;
+		cell.zMax1 = -Mathf::inifinity;
+		cell.mask = cell.borderMask;
+	}
+}
+
+bool OcclusionCuller::IsOccluded(const Vector3& boundsMin, const Vector3& boundsMax,
+	const Matrix4x4& modelMatrix, const Matrix4x4& viewProjection) const
+{
+	if (!hasOccluders) return false;
+	if (!std::equal(viewProjection.m, viewProjection.m + 16, occluderViewProjection.m)) return false;
+
+	Matrix4x4 mvp = viewProjection.Multiply(modelMatrix);
+	float minX = Mathf::inifinity, minY = Mathf::inifinity, minZ = Mathf::inifinity;
+	float maxX = -Mathf::inifinity, maxY = -Mathf::inifinity;
+	for (int i = 0; i < 8; ++i)
+	{
+		Vector3 corner((i & 1) ? boundsMax.x : boundsMin.x, (i & 2) ? boundsMax.y : boundsMin.y, (i & 4) ? boundsMax.z : boundsMin.z);
+		Vector4 position = mvp.MultiplyPoint(corner);
+		// a box reaching the near plane may cover everything
+		if (position.z < 0.f || position.w <= 0.f) return false;
+
+		float invW = 1.f / position.w;
+		float x = ((position.x * invW) + 1.f) / 2.f * width;
+		float y = ((position.y * invW) + 1.f) / 2.f * height;
+		minX = Mathf::Min(minX, x);
+		minY = Mathf::Min(minY, y);
+		maxX = Mathf::Max(maxX, x);
+		maxY = Mathf::Max(maxY, y);
+		minZ = Mathf::Min(minZ, position.z * invW);
+	}
+
+	// one extra sample around the box for the vertex snapping of the real draw
+	int sampleMinX = Mathf::Max(Mathf::FloorToInt(minX) - 1, 0);
+	int sampleMinY = Mathf::Max(Mathf::FloorToInt(minY) - 1, 0);
+	int sampleMaxX = Mathf::Min(Mathf::CeilToInt(maxX) + 1, width - 1);
+	int sampleMaxY = Mathf::Min(Mathf::CeilToInt(maxY) + 1, height - 1);
+	if (sampleMaxX < sampleMinX || sampleMaxY < sampleMinY) return true;
+
+	for (int cy = (sampleMinY >> CELL_SIZE_SHIFT); cy <= (sampleMaxY >> CELL_SIZE_SHIFT); ++cy)
+	{
+		for (int cx = (sampleMinX >> CELL_SIZE_SHIFT); cx <= (sampleMaxX >> CELL_SIZE_SHIFT); ++cx)
+		{
+			if (minZ <= cells[cy * cellCountX + cx].zMax0) return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,69 @@
+#ifndef _SOFTRENDER_OCCLUSION_CULLER_H_
+#define _SOFTRENDER_OCCLUSION_CULLER_H_
+
+#include "base/header.h"
+#include "math/vector3.h"
+#include "math/vector4.h"
+#include "math/matrix4x4.h"
+
+namespace sr
+{
+
+// coarse depth buffer of marked occluders, in the spirit of masked occlusion culling:
+// every cell covers 4x4 render target pixels and keeps a coverage mask of those samples
+// and two conservative max depths, so occluders that only cover a cell together still
+// hide what is behind it. bounding boxes are tested against it before their draw is shaded.
+class OcclusionCuller
+{
+public:
+	static const int CELL_SIZE_SHIFT = 2;
+	static const int CELL_SIZE = (1 << CELL_SIZE_SHIFT);
+
+	OcclusionCuller() = default;
+
+	void Initialize(int width, int height);
+	// drops all occluders, the next one fixes the view projection the buffer is valid for
+	void Clear();
+
+	bool HasOccluders() const { return hasOccluders; }
+
+	// triangles crossing the near plane are skipped, they can't be rasterized conservatively
+	void AddOccluder(const std::vector<Vector3>& vertices, const std::vector<uint16_t>& indices,
+		const Matrix4x4& modelMatrix, const Matrix4x4& viewProjection);
+
+	// true when the object space box is entirely hidden behind the occluders,
+	// always false for a view projection other than the occluders' one
+	bool IsOccluded(const Vector3& boundsMin, const Vector3& boundsMax,
+		const Matrix4x4& modelMatrix, const Matrix4x4& viewProjection) const;
+
+private:
+	struct Cell
+	{
+		float zMax0; // every sample of the cell is hidden behind this depth
+		float zMax1; // the samples in mask are hidden behind this depth
+		uint16_t mask;
+		uint16_t borderMask; // samples outside the render target count as covered
+	};
+
+	struct ScreenVertex
+	{
+		float x, y, z;
+	};
+
+	ScreenVertex ToScreen(const Vector4& position) const;
+	void RasterizeOccluder(const ScreenVertex& v0, const ScreenVertex& v1, const ScreenVertex& v2);
+	void UpdateCell(Cell& cell, uint16_t mask, float zMax);
+
+	int width = 0;
+	int height = 0;
+	int cellCountX = 0;
+	int cellCountY = 0;
+	std::vector<Cell> cells;
+
+	bool hasOccluders = false;
+	Matrix4x4 occluderViewProjection;
+};
+
+}
+
+#endif //! _SOFTRENDER_OCCLUSION_CULLER_H_
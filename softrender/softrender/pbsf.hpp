@@ -6,6 +6,7 @@
 #include "math/vector3.h"
 #include "math/vector4.h"
 #include "math/mathf.h"
+#include "math/vectorx4.h"
 #include "shader.hpp"
 
 namespace sr
@@ -39,6 +40,32 @@ struct PBSInput
 	}
 };
 
+struct PBSLightx4
+{
+	Vector3x4 dir;
+	Vector3x4 color;
+};
+
+struct PBSInputx4
+{
+	Vector3x4 albedo;
+	Vector3x4 normal;
+	Floatx4 roughness;
+	Floatx4 metallic;
+
+	Vector3x4 diffColor;
+	Vector3x4 specColor;
+	Floatx4 reflectivity;
+
+	void PBSSetup()
+	{
+		static float dielectricSpec = 0.220916301f;
+		specColor = Vector3x4::LinearInterp(Vector3x4(Vector3::one * dielectricSpec), albedo, metallic);
+		reflectivity = Floatx4::Lerp(metallic, 1.f, dielectricSpec);
+		diffColor = albedo * (Floatx4(1.f) - reflectivity);
+	}
+};
+
 struct PBSF
 {
 	static float GGXTerm(float nDotH, float roughness)
@@ -130,6 +157,64 @@ struct PBSF
 		return input.diffColor * nDotL + light.color * (D * VF * nDotL * Mathf::PI);
 	}
 
+	// SoA versions shading a quad at once //
+
+	static Floatx4 Pow5(const Floatx4& x)
+	{
+		Floatx4 x2 = x * x;
+		return x2 * x2 * x;
+	}
+
+	static Floatx4 GGXTerm(const Floatx4& nDotH, const Floatx4& roughness)
+	{
+		Floatx4 a = roughness * roughness;
+		Floatx4 a2 = a * a;
+		Floatx4 d = (nDotH * nDotH) * (a2 - 1.f) + 1.f;
+		return a2 / (d * d * Mathf::PI + 1e-5f);
+	}
+
+	static Floatx4 SmithVisibilityTerm(const Floatx4& NdotL, const Floatx4& NdotV, const Floatx4& k)
+	{
+		Floatx4 gL = NdotL * (Floatx4(1.f) - k) + k;
+		Floatx4 gV = NdotV * (Floatx4(1.f) - k) + k;
+		return Floatx4(1.f) / (gL * gV + 1e-5f);
+	}
+
+	static Floatx4 SmithGGXVisibilityTerm(const Floatx4& NdotL, const Floatx4& NdotV, const Floatx4& roughness)
+	{
+		Floatx4 k = roughness * roughness * 0.5f;
+		return SmithVisibilityTerm(NdotL, NdotV, k) * 0.25f;
+	}
+
+	static Vector3x4 FresnelTerm(const Floatx4& vDotH, const Vector3x4& specular)
+	{
+		return specular + (Vector3x4(Vector3::one) - specular) * Pow5(Floatx4(1.f) - vDotH);
+	}
+
+	static Floatx4 DisneyDiffuseTerm(const Floatx4& nDotL, const Floatx4& nDotV, const Floatx4& lDotH, const Floatx4& roughness)
+	{
+		Floatx4 nlPow5 = Pow5(Floatx4(1.f) - nDotL);
+		Floatx4 nvPow5 = Pow5(Floatx4(1.f) - nDotV);
+		Floatx4 fD90 = lDotH * lDotH * roughness * 2.f + 0.5f;
+		return ((fD90 - 1.f) * nlPow5 + 1.f) * ((fD90 - 1.f) * nvPow5 + 1.f);
+	}
+
+	static Vector3x4 BRDF1(const PBSInputx4& input, const Vector3x4& normal, const Vector3x4& viewDir, const PBSLightx4& light)
+	{
+		Vector3x4 halfDir = (light.dir + viewDir).Normalize();
+		Floatx4 nDotL = Floatx4::Clamp01(normal.Dot(light.dir));
+		Floatx4 nDotV = Floatx4::Clamp01(normal.Dot(viewDir));
+		Floatx4 nDotH = Floatx4::Clamp01(normal.Dot(halfDir));
+		Floatx4 vDotH = Floatx4::Clamp01(viewDir.Dot(halfDir));
+		Floatx4 lDotH = Floatx4::Clamp01(light.dir.Dot(halfDir));
+
+		Floatx4 diffuseTerm = DisneyDiffuseTerm(nDotL, nDotV, lDotH, input.roughness);
+		Floatx4 D = GGXTerm(nDotH, input.roughness);
+		Floatx4 V = SmithGGXVisibilityTerm(nDotL, nDotV, input.roughness);
+		Vector3x4 F = FresnelTerm(vDotH, input.specColor);
+		return input.diffColor * (diffuseTerm * nDotL) + light.color * F * (D * V * nDotL * Mathf::PI);
+	}
+
 	// IBL //
 
 	static Vector2 Hammersley2d(uint32_t i, uint32_t maxSampleCount)
@@ -259,6 +344,17 @@ struct PBSF
 		return prefilterColor.rgb * (specColor * envBRDF.x + Vector3::one * envBRDF.y);
 	}
 
+	// the cubemap and lut lookups are per pixel anyway
+	static Vector3x4 ApproximateSpecularIBL(const Cubemap& cubemap, const Vector3x4& specColor, const Vector3x4& normal, const Vector3x4& viewDir, const Floatx4& roughness)
+	{
+		Vector3x4 specular;
+		for (int i = 0; i < 4; ++i)
+		{
+			specular.Set(i, ApproximateSpecularIBL(cubemap, specColor.Get(i), normal.Get(i), viewDir.Get(i), roughness[i]));
+		}
+		return specular;
+	}
+
 };
 
 } // namespace sr
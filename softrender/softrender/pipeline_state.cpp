@@ -0,0 +1,630 @@
+#include "pipeline_state.h"
+#include "bitmap_view.hpp"
+#include "texture2d.h"
+#include "cubemap.h"
+#include "shader.hpp"
+using namespace sr;
+
+namespace
+{
+
+typedef DepthStencilBuffer::FormatType DepthStencilFormat;
+
+template<RenderState::ZTestType zTest>
+inline bool DepthTest(uint32_t zPixel, uint32_t zInBuffer)
+{
+	switch (zTest)
+	{
+	case RenderState::ZTestType_Less:
+		return zPixel < zInBuffer;
+	case RenderState::ZTestType_Greater:
+		return zPixel > zInBuffer;
+	case RenderState::ZTestType_LEqual:
+		return zPixel <= zInBuffer;
+	case RenderState::ZTestType_GEqual:
+		return zPixel >= zInBuffer;
+	case RenderState::ZTestType_Equal:
+		return zPixel == zInBuffer;
+	case RenderState::ZTestType_NotEqual:
+		return zPixel != zInBuffer;
+	case RenderState::ZTestType_Always:
+	default:
+		return true;
+	}
+}
+
+// mask of the quad lanes passing the depth test, compared at the 24 bit precision of the buffer
+template<RenderState::ZTestType zTest>
+inline uint8_t DepthTestQuad(const float zPixel[4], const uint32_t pixels[4])
+{
+#if _MATH_SIMD_INTRINSIC_
+	// both sides fit in 24 bits, the signed compares are exact
+	__m128i z = DepthStencilBuffer::QuantizeDepthx4(zPixel);
+	__m128i bufferZ = _mm_srli_epi32(_mm_loadu_si128((const __m128i*)pixels), DepthStencilFormat::DEPTH_SHIFT);
+	switch (zTest)
+	{
+	case RenderState::ZTestType_Less:
+		return (uint8_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(z, bufferZ)));
+	case RenderState::ZTestType_Greater:
+		return (uint8_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(z, bufferZ)));
+	case RenderState::ZTestType_LEqual:
+		return (uint8_t)(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(z, bufferZ))) ^ 0xF);
+	case RenderState::ZTestType_GEqual:
+		return (uint8_t)(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(z, bufferZ))) ^ 0xF);
+	case RenderState::ZTestType_Equal:
+		return (uint8_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(z, bufferZ)));
+	case RenderState::ZTestType_NotEqual:
+		return (uint8_t)(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(z, bufferZ))) ^ 0xF);
+	case RenderState::ZTestType_Always:
+	default:
+		return 0xF;
+	}
+#else
+	uint8_t mask = 0x0;
+	for (int i = 0; i < 4; ++i)
+	{
+		if (DepthTest<zTest>(DepthStencilFormat::QuantizeDepth(zPixel[i]), pixels[i] >> DepthStencilFormat::DEPTH_SHIFT)) mask |= (1 << i);
+	}
+	return mask;
+#endif
+}
+
+inline void WriteStencil(uint32_t& pixel, uint8_t stencil)
+{
+	pixel = (pixel & ~DepthStencilFormat::STENCIL_MASK) | stencil;
+}
+
+// depth and stencil of a quad come from one load of its packed pixels
+template<RenderState::ZTestType zTest, bool stencilOn>
+uint8_t TestQuad(const PipelineState::StencilFace& stencil, const PixelTargets& targets, const Rasterizer2x2Info& quad)
+{
+	uint32_t* pixels = targets.depthStencilBuffer->GetQuad(quad.x, quad.y);
+	uint8_t depthMask = (zTest == RenderState::ZTestType_Always) ? (uint8_t)0xF : DepthTestQuad<zTest>(quad.depth, pixels);
+	if (!stencilOn) return quad.maskCode & depthMask;
+
+	uint8_t stencilMask = 0x0;
+	for (int i = 0; i < 4; ++i)
+	{
+		if (stencil.passes[pixels[i] & DepthStencilFormat::STENCIL_MASK]) stencilMask |= (1 << i);
+	}
+	uint8_t liveMask = quad.maskCode & stencilMask & depthMask;
+
+	// the covered lanes failing either test take their operation here, the passing ones once they're shaded
+	uint8_t failMask = quad.maskCode & ~liveMask;
+	if (stencil.writesOnFail && failMask != 0)
+	{
+		for (int i = 0; i < 4; ++i)
+		{
+			if (!(failMask & (1 << i))) continue;
+
+			uint8_t value = (uint8_t)(pixels[i] & DepthStencilFormat::STENCIL_MASK);
+			WriteStencil(pixels[i], (stencilMask & (1 << i)) ? stencil.zFailOp[value] : stencil.failOp[value]);
+		}
+	}
+	return liveMask;
+}
+
+// eight 16 bit channels, two RGBA32 pixels, for blending in 8 bit fixed point.
+// a * b / 255 is rounded exactly, so both builds write the same bytes
+#if _MATH_SIMD_INTRINSIC_
+typedef __m128i Fixedx8;
+
+inline Fixedx8 Mul255(const Fixedx8& a, const Fixedx8& b)
+{
+	Fixedx8 t = _mm_add_epi16(_mm_mullo_epi16(a, b), _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+inline Fixedx8 AddSat(const Fixedx8& a, const Fixedx8& b) { return _mm_min_epi16(_mm_add_epi16(a, b), _mm_set1_epi16(255)); }
+inline Fixedx8 Inv(const Fixedx8& a) { return _mm_sub_epi16(_mm_set1_epi16(255), a); }
+inline Fixedx8 Min(const Fixedx8& a, const Fixedx8& b) { return _mm_min_epi16(a, b); }
+inline Fixedx8 Max(const Fixedx8& a, const Fixedx8& b) { return _mm_max_epi16(a, b); }
+
+// the alpha of every pixel in all its channels
+inline Fixedx8 BroadcastAlpha(const Fixedx8& a)
+{
+	return _mm_shufflehi_epi16(_mm_shufflelo_epi16(a, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+// rgb of color and alpha of alpha
+inline Fixedx8 MergeAlpha(const Fixedx8& color, const Fixedx8& alpha) { return _mm_blend_epi16(color, alpha, 0x88); }
+#else
+struct Fixedx8
+{
+	int32_t c[8];
+};
+
+inline Fixedx8 Mul255(const Fixedx8& a, const Fixedx8& b)
+{
+	Fixedx8 ret;
+	for (int i = 0; i < 8; ++i)
+	{
+		int32_t t = a.c[i] * b.c[i] + 128;
+		ret.c[i] = (t + (t >> 8)) >> 8;
+	}
+	return ret;
+}
+
+inline Fixedx8 AddSat(const Fixedx8& a, const Fixedx8& b)
+{
+	Fixedx8 ret;
+	for (int i = 0; i < 8; ++i) ret.c[i] = Mathf::Min(a.c[i] + b.c[i], 255);
+	return ret;
+}
+
+inline Fixedx8 Inv(const Fixedx8& a)
+{
+	Fixedx8 ret;
+	for (int i = 0; i < 8; ++i) ret.c[i] = 255 - a.c[i];
+	return ret;
+}
+
+inline Fixedx8 Min(const Fixedx8& a, const Fixedx8& b)
+{
+	Fixedx8 ret;
+	for (int i = 0; i < 8; ++i) ret.c[i] = Mathf::Min(a.c[i], b.c[i]);
+	return ret;
+}
+
+inline Fixedx8 Max(const Fixedx8& a, const Fixedx8& b)
+{
+	Fixedx8 ret;
+	for (int i = 0; i < 8; ++i) ret.c[i] = Mathf::Max(a.c[i], b.c[i]);
+	return ret;
+}
+
+inline Fixedx8 BroadcastAlpha(const Fixedx8& a)
+{
+	Fixedx8 ret;
+	for (int i = 0; i < 8; ++i) ret.c[i] = a.c[(i & 4) + 3];
+	return ret;
+}
+
+inline Fixedx8 MergeAlpha(const Fixedx8& color, const Fixedx8& alpha)
+{
+	Fixedx8 ret = color;
+	ret.c[3] = alpha.c[3];
+	ret.c[7] = alpha.c[7];
+	return ret;
+}
+#endif
+
+// the pixels of a quad in 16 bit channels, lanes 0 and 1 in lo, 2 and 3 in hi
+struct FixedQuad
+{
+	Fixedx8 lo, hi;
+};
+
+// row0 and row1 point at the two pixels of the upper and the lower quad row
+inline FixedQuad LoadQuad(const uint8_t* row0, const uint8_t* row1)
+{
+	FixedQuad quad;
+#if _MATH_SIMD_INTRINSIC_
+	__m128i bytes = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)row0), _mm_loadl_epi64((const __m128i*)row1));
+	quad.lo = _mm_cvtepu8_epi16(bytes);
+	quad.hi = _mm_cvtepu8_epi16(_mm_srli_si128(bytes, 8));
+#else
+	for (int i = 0; i < 8; ++i)
+	{
+		quad.lo.c[i] = row0[i];
+		quad.hi.c[i] = row1[i];
+	}
+#endif
+	return quad;
+}
+
+// whether the lanes in mask have every channel in [0, 1], so clamping them before blending changes nothing
+inline bool IsInUnitRange(const Colorx4& color, uint8_t mask)
+{
+#if _MATH_SIMD_INTRINSIC_
+	__m128 zero = _mm_setzero_ps();
+	__m128 one = _mm_set1_ps(1.f);
+	__m128 outside = _mm_setzero_ps();
+	const __m128 channels[4] = { color.rgb.x.m, color.rgb.y.m, color.rgb.z.m, color.a.m };
+	for (int c = 0; c < 4; ++c)
+	{
+		outside = _mm_or_ps(outside, _mm_or_ps(_mm_cmplt_ps(channels[c], zero), _mm_cmpgt_ps(channels[c], one)));
+	}
+	return (_mm_movemask_ps(outside) & mask) == 0;
+#else
+	for (int i = 0; i < 4; ++i)
+	{
+		if (!(mask & (1 << i))) continue;
+		Color pixel = color.Get(i);
+		if (pixel.r < 0.f || pixel.r > 1.f || pixel.g < 0.f || pixel.g > 1.f
+			|| pixel.b < 0.f || pixel.b > 1.f || pixel.a < 0.f || pixel.a > 1.f) return false;
+	}
+	return true;
+#endif
+}
+
+// the shader outputs as Bitmap::SetPixel converts them: clamped and truncated
+inline FixedQuad ToFixedQuad(const Colorx4& color)
+{
+	FixedQuad quad;
+#if _MATH_SIMD_INTRINSIC_
+	__m128 zero = _mm_setzero_ps();
+	__m128 one = _mm_set1_ps(1.f);
+	__m128 scale = _mm_set1_ps(255.f);
+	__m128i r = _mm_cvttps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(color.rgb.x.m, zero), one), scale));
+	__m128i g = _mm_cvttps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(color.rgb.y.m, zero), one), scale));
+	__m128i b = _mm_cvttps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(color.rgb.z.m, zero), one), scale));
+	__m128i a = _mm_cvttps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(color.a.m, zero), one), scale));
+	// rg and ba of the four lanes as 16 bit pairs, interleaved into rgba
+	__m128i rg = _mm_or_si128(r, _mm_slli_epi32(g, 16));
+	__m128i ba = _mm_or_si128(b, _mm_slli_epi32(a, 16));
+	quad.lo = _mm_unpacklo_epi32(rg, ba);
+	quad.hi = _mm_unpackhi_epi32(rg, ba);
+#else
+	for (int i = 0; i < 4; ++i)
+	{
+		Color32 pixel = color.Get(i);
+		Fixedx8& half = (i < 2) ? quad.lo : quad.hi;
+		int offset = (i & 1) * 4;
+		half.c[offset] = pixel.r;
+		half.c[offset + 1] = pixel.g;
+		half.c[offset + 2] = pixel.b;
+		half.c[offset + 3] = pixel.a;
+	}
+#endif
+	return quad;
+}
+
+inline void StoreQuad(uint8_t* row0, uint8_t* row1, const FixedQuad& quad, uint8_t writeMask)
+{
+#if _MATH_SIMD_INTRINSIC_
+	__m128i bytes = _mm_packus_epi16(quad.lo, quad.hi);
+	if (writeMask != 0xF)
+	{
+		__m128i laneBits = _mm_set_epi32(8, 4, 2, 1);
+		__m128i laneMask = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(writeMask), laneBits), laneBits);
+		__m128i dst = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)row0), _mm_loadl_epi64((const __m128i*)row1));
+		bytes = _mm_blendv_epi8(dst, bytes, laneMask);
+	}
+	_mm_storel_epi64((__m128i*)row0, bytes);
+	_mm_storel_epi64((__m128i*)row1, _mm_srli_si128(bytes, 8));
+#else
+	for (int i = 0; i < 8; ++i)
+	{
+		if (writeMask & (1 << (i >> 2))) row0[i] = (uint8_t)quad.lo.c[i];
+		if (writeMask & (4 << (i >> 2))) row1[i] = (uint8_t)quad.hi.c[i];
+	}
+#endif
+}
+
+// IS_FIXED_POINT: the blend has a fixed point kernel. CLAMPS_EXACTLY: blending src clamped to [0, 1]
+// gives what the float blend gives clamped, for any src. otherwise the kernel only takes src in [0, 1]
+struct NoBlend
+{
+	static const bool IS_FIXED_POINT = true;
+	static const bool CLAMPS_EXACTLY = true;
+
+	template<typename ViewType>
+	static void Write(const RenderState& state, const ViewType& buffer, int x, int y, const Color& src)
+	{
+		buffer.SetPixel(x, y, src);
+	}
+
+	static Fixedx8 BlendFixed(const Fixedx8& src, const Fixedx8& dst)
+	{
+		return src;
+	}
+};
+
+// blend operations or factors this back-end has no specialization for
+struct GenericBlend
+{
+	static const bool IS_FIXED_POINT = false;
+	static const bool CLAMPS_EXACTLY = false;
+
+	template<typename ViewType>
+	static void Write(const RenderState& state, const ViewType& buffer, int x, int y, const Color& src)
+	{
+		buffer.SetPixel(x, y, state.blender.Blend(src, buffer.GetPixel(x, y)));
+	}
+
+	static Fixedx8 BlendFixed(const Fixedx8& src, const Fixedx8& dst)
+	{
+		return dst;
+	}
+};
+
+constexpr Blender::BlendMode SrcMode(int factors)
+{
+	return (factors == PipelineState::BlendFactors_SrcAlphaOneMinusSrcAlpha) ? Blender::BlendMode_SrcAlpha
+		: (factors == PipelineState::BlendFactors_DstColorZero) ? Blender::BlendMode_DstColor
+		: (factors == PipelineState::BlendFactors_ZeroOne) ? Blender::BlendMode_Zero : Blender::BlendMode_One;
+}
+
+constexpr Blender::BlendMode DstMode(int factors)
+{
+	return (factors == PipelineState::BlendFactors_SrcAlphaOneMinusSrcAlpha
+			|| factors == PipelineState::BlendFactors_OneOneMinusSrcAlpha) ? Blender::BlendMode_OneMinusSrcAlpha
+		: (factors == PipelineState::BlendFactors_OneZero
+			|| factors == PipelineState::BlendFactors_DstColorZero) ? Blender::BlendMode_Zero : Blender::BlendMode_One;
+}
+
+constexpr bool ClampsExactly(int factors)
+{
+	return factors == PipelineState::BlendFactors_OneZero || factors == PipelineState::BlendFactors_ZeroOne;
+}
+
+// src * srcFactor + dst * dstFactor of the channels of a factor pair, srcAlpha in all channels of a pixel
+template<int factors>
+inline Fixedx8 AddFixed(const Fixedx8& src, const Fixedx8& dst, const Fixedx8& srcAlpha)
+{
+	switch (factors)
+	{
+	case PipelineState::BlendFactors_OneZero:
+		return src;
+	case PipelineState::BlendFactors_OneOne:
+		return AddSat(src, dst);
+	case PipelineState::BlendFactors_SrcAlphaOneMinusSrcAlpha:
+		return AddSat(Mul255(src, srcAlpha), Mul255(dst, Inv(srcAlpha)));
+	case PipelineState::BlendFactors_OneOneMinusSrcAlpha:
+		return AddSat(src, Mul255(dst, Inv(srcAlpha)));
+	case PipelineState::BlendFactors_DstColorZero:
+		return Mul255(src, dst);
+	case PipelineState::BlendFactors_ZeroOne:
+	default:
+		return dst;
+	}
+}
+
+// src * srcFactor + dst * dstFactor, the factor switches fold away on the constant modes
+template<int colorFactors, int alphaFactors>
+struct AddBlend
+{
+	static const bool IS_FIXED_POINT = true;
+	// a negative src lowers the sum, a src over 1 scales dst or is scaled by src alpha
+	static const bool CLAMPS_EXACTLY = ClampsExactly(colorFactors) && ClampsExactly(alphaFactors);
+
+	template<typename ViewType>
+	static void Write(const RenderState& state, const ViewType& buffer, int x, int y, const Color& src)
+	{
+		Color dst = buffer.GetPixel(x, y);
+		Color color = Color::clear;
+		color.rgb = Blender::_BlendRGBFactor(SrcMode(colorFactors), src, dst) * src.rgb
+			+ Blender::_BlendRGBFactor(DstMode(colorFactors), src, dst) * dst.rgb;
+		color.a = Blender::_BlendAlphaFactor(SrcMode(alphaFactors), src, dst) * src.a
+			+ Blender::_BlendAlphaFactor(DstMode(alphaFactors), src, dst) * dst.a;
+		buffer.SetPixel(x, y, color);
+	}
+
+	static Fixedx8 BlendFixed(const Fixedx8& src, const Fixedx8& dst)
+	{
+		Fixedx8 srcAlpha = BroadcastAlpha(src);
+		if (colorFactors == alphaFactors) return AddFixed<colorFactors>(src, dst, srcAlpha);
+		return MergeAlpha(AddFixed<colorFactors>(src, dst, srcAlpha), AddFixed<alphaFactors>(src, dst, srcAlpha));
+	}
+};
+
+// min or max of src and dst for color and alpha, the factors don't apply
+template<bool isMax>
+struct MinMaxBlend
+{
+	static const bool IS_FIXED_POINT = true;
+	static const bool CLAMPS_EXACTLY = true;
+
+	template<typename ViewType>
+	static void Write(const RenderState& state, const ViewType& buffer, int x, int y, const Color& src)
+	{
+		Color dst = buffer.GetPixel(x, y);
+		Color color = Color::clear;
+		color.rgb = isMax ? Vector3::Max(src.rgb, dst.rgb) : Vector3::Min(src.rgb, dst.rgb);
+		color.a = isMax ? Mathf::Max(src.a, dst.a) : Mathf::Min(src.a, dst.a);
+		buffer.SetPixel(x, y, color);
+	}
+
+	static Fixedx8 BlendFixed(const Fixedx8& src, const Fixedx8& dst)
+	{
+		return isMax ? Max(src, dst) : Min(src, dst);
+	}
+};
+
+// RGBA32 targets are blended a quad at a time in fixed point, the others pixel by pixel in float.
+// the float blend clamps only its result, so src out of [0, 1] stays float where clamping it first would differ
+template<Bitmap::BitmapType Format, typename BlendType>
+void WriteQuadTarget(const RenderState& state, Bitmap* buffer, const Rasterizer2x2Info& quad, uint8_t writeMask, const Colorx4& src)
+{
+	static const int quadX[4] = { 0, 1, 0, 1 };
+	static const int quadY[4] = { 0, 0, 1, 1 };
+
+	RWBitmapView<Format> target(*buffer);
+	if (BlendType::IS_FIXED_POINT && Format == Bitmap::BitmapType_RGBA32
+		&& (BlendType::CLAMPS_EXACTLY || IsInUnitRange(src, writeMask)))
+	{
+		// a tiled bitmap is padded to whole tiles, so the quad is always inside its storage. the last
+		// column or row of a linear bitmap with an odd size is blended through a copy of its lanes inside,
+		// so every pixel goes through the same arithmetic
+		uint8_t boundsMask = 0xF;
+		if (buffer->GetLayout() == Bitmap::Layout_Linear)
+		{
+			if (quad.x + 1 >= buffer->GetWidth()) boundsMask &= 0x5;
+			if (quad.y + 1 >= buffer->GetHeight()) boundsMask &= 0x3;
+		}
+
+		uint8_t edge[2][8];
+		uint8_t* row0 = buffer->GetPixelAddress(quad.x, quad.y);
+		uint8_t* row1 = (boundsMask & 0x4) ? buffer->GetPixelAddress(quad.x, quad.y + 1) : nullptr;
+		uint8_t* rows[2] = { row0, row1 };
+		if (boundsMask != 0xF)
+		{
+			memset(edge, 0, sizeof(edge));
+			for (int i = 0; i < 4; ++i)
+			{
+				if (boundsMask & (1 << i)) memcpy(&edge[i >> 1][(i & 1) * 4], rows[i >> 1] + (i & 1) * 4, 4);
+			}
+			row0 = edge[0];
+			row1 = edge[1];
+		}
+
+		FixedQuad srcQuad = ToFixedQuad(src);
+		FixedQuad dstQuad = LoadQuad(row0, row1);
+		FixedQuad result;
+		result.lo = BlendType::BlendFixed(srcQuad.lo, dstQuad.lo);
+		result.hi = BlendType::BlendFixed(srcQuad.hi, dstQuad.hi);
+		StoreQuad(row0, row1, result, writeMask & boundsMask);
+
+		if (boundsMask != 0xF)
+		{
+			for (int i = 0; i < 4; ++i)
+			{
+				if (writeMask & boundsMask & (1 << i)) memcpy(rows[i >> 1] + (i & 1) * 4, &edge[i >> 1][(i & 1) * 4], 4);
+			}
+		}
+		return;
+	}
+
+	for (int i = 0; i < 4; ++i)
+	{
+		if (writeMask & (1 << i)) BlendType::Write(state, target, quad.x + quadX[i], quad.y + quadY[i], src.Get(i));
+	}
+}
+
+template<bool zWrite, bool stencilWrite>
+void WriteQuad(const RenderState& state, const PipelineState::StencilFace& stencil, const PixelTargets& targets,
+	const Rasterizer2x2Info& quad, uint8_t writeMask, const IShader& shader)
+{
+	targets.writeTargetFuncs[0](state, targets.colorBuffer, quad, writeMask, shader.SV_Target0x4);
+	if (targets.gbuffers[0]) targets.writeTargetFuncs[1](state, targets.gbuffers[0], quad, writeMask, shader.SV_Target1x4);
+	if (targets.gbuffers[1]) targets.writeTargetFuncs[2](state, targets.gbuffers[1], quad, writeMask, shader.SV_Target2x4);
+	if (targets.gbuffers[2]) targets.writeTargetFuncs[3](state, targets.gbuffers[2], quad, writeMask, shader.SV_Target3x4);
+
+	if (zWrite) targets.depthStencilBuffer->WriteQuadDepth(quad.x, quad.y, quad.depth, writeMask);
+	if (stencilWrite)
+	{
+		uint32_t* pixels = targets.depthStencilBuffer->GetQuad(quad.x, quad.y);
+		for (int i = 0; i < 4; ++i)
+		{
+			if (writeMask & (1 << i)) WriteStencil(pixels[i], stencil.passOp[pixels[i] & DepthStencilFormat::STENCIL_MASK]);
+		}
+	}
+	if (zWrite) targets.hizBuffer->OnQuadDepthWrite(quad.x, quad.y, writeMask);
+}
+
+const PipelineState::TestQuadFunc testQuadFuncs[PipelineState::ZTEST_COUNT][2] = {
+	{ TestQuad<RenderState::ZTestType_Always, false>, TestQuad<RenderState::ZTestType_Always, true> },
+	{ TestQuad<RenderState::ZTestType_Less, false>, TestQuad<RenderState::ZTestType_Less, true> },
+	{ TestQuad<RenderState::ZTestType_Greater, false>, TestQuad<RenderState::ZTestType_Greater, true> },
+	{ TestQuad<RenderState::ZTestType_LEqual, false>, TestQuad<RenderState::ZTestType_LEqual, true> },
+	{ TestQuad<RenderState::ZTestType_GEqual, false>, TestQuad<RenderState::ZTestType_GEqual, true> },
+	{ TestQuad<RenderState::ZTestType_Equal, false>, TestQuad<RenderState::ZTestType_Equal, true> },
+	{ TestQuad<RenderState::ZTestType_NotEqual, false>, TestQuad<RenderState::ZTestType_NotEqual, true> },
+};
+
+const PipelineState::WriteQuadFunc writeQuadFuncs[2][2] = {
+	{ WriteQuad<false, false>, WriteQuad<false, true> },
+	{ WriteQuad<true, false>, WriteQuad<true, true> },
+};
+
+#define WRITE_TARGET_FORMATS(...) { nullptr, \
+	WriteQuadTarget<Bitmap::BitmapType_Alpha8, __VA_ARGS__>, \
+	WriteQuadTarget<Bitmap::BitmapType_RGB24, __VA_ARGS__>, \
+	WriteQuadTarget<Bitmap::BitmapType_RGBA32, __VA_ARGS__>, \
+	WriteQuadTarget<Bitmap::BitmapType_AlphaFloat, __VA_ARGS__>, \
+	WriteQuadTarget<Bitmap::BitmapType_RGBFloat, __VA_ARGS__>, \
+	WriteQuadTarget<Bitmap::BitmapType_RGBAFloat, __VA_ARGS__>, \
+	nullptr /* a depth stencil buffer is no color target */ }
+
+#define ADD_BLENDS(colorFactors) \
+	WRITE_TARGET_FORMATS(AddBlend<colorFactors, 0>), \
+	WRITE_TARGET_FORMATS(AddBlend<colorFactors, 1>), \
+	WRITE_TARGET_FORMATS(AddBlend<colorFactors, 2>), \
+	WRITE_TARGET_FORMATS(AddBlend<colorFactors, 3>), \
+	WRITE_TARGET_FORMATS(AddBlend<colorFactors, 4>), \
+	WRITE_TARGET_FORMATS(AddBlend<colorFactors, 5>)
+
+static_assert(PipelineState::BlendFactorsCount == 6, "ADD_BLENDS lists every factor pair");
+static_assert(Bitmap::BitmapTypeCount == 8, "WRITE_TARGET_FORMATS lists every bitmap type");
+
+const WriteTargetFunc writeTargetFuncs[PipelineState::BLEND_EQUATION_COUNT][Bitmap::BitmapTypeCount] = {
+	WRITE_TARGET_FORMATS(NoBlend),
+	WRITE_TARGET_FORMATS(GenericBlend),
+	WRITE_TARGET_FORMATS(MinMaxBlend<false>),
+	WRITE_TARGET_FORMATS(MinMaxBlend<true>),
+	ADD_BLENDS(0),
+	ADD_BLENDS(1),
+	ADD_BLENDS(2),
+	ADD_BLENDS(3),
+	ADD_BLENDS(4),
+	ADD_BLENDS(5),
+};
+
+int FindBlendFactors(Blender::BlendMode srcMode, Blender::BlendMode dstMode)
+{
+	for (int factors = 0; factors < PipelineState::BlendFactorsCount; ++factors)
+	{
+		if (SrcMode(factors) == srcMode && DstMode(factors) == dstMode) return factors;
+	}
+	return -1;
+}
+
+}
+
+PipelineState::PipelineState(const RenderState& state)
+	: state(state)
+{
+	if (state.stencilOn)
+	{
+		stencilFaces[0].Setup(state, state.stencilComp, state.stencilFailOp, state.stencilZFailOp, state.stencilOp);
+		if (state.twoSidedStencil)
+		{
+			stencilFaces[1].Setup(state, state.stencilCompBack, state.stencilFailOpBack, state.stencilZFailOpBack, state.stencilOpBack);
+		}
+		else
+		{
+			stencilFaces[1] = stencilFaces[0];
+		}
+	}
+
+	bool stencilWrite = stencilFaces[0].writesOnPass || stencilFaces[1].writesOnPass;
+	testQuadFunc = testQuadFuncs[state.zTest][state.stencilOn ? 1 : 0];
+	writeQuadFunc = writeQuadFuncs[state.zWrite ? 1 : 0][stencilWrite ? 1 : 0];
+	blendEquation = GetBlendEquation(state);
+}
+
+void PipelineState::StencilFace::Setup(const RenderState& state, RenderState::StencilComparison comp,
+	RenderState::StencilOperation fail, RenderState::StencilOperation zFail, RenderState::StencilOperation pass)
+{
+	writesOnFail = false;
+	writesOnPass = false;
+	for (int i = 0; i < 256; ++i)
+	{
+		uint8_t value = (uint8_t)i;
+		passes[i] = state.StencilTest(comp, value);
+		failOp[i] = state.WriteStencil(fail, value);
+		zFailOp[i] = state.WriteStencil(zFail, value);
+		passOp[i] = state.WriteStencil(pass, value);
+		writesOnFail |= (failOp[i] != value) || (zFailOp[i] != value);
+		writesOnPass |= (passOp[i] != value);
+	}
+}
+
+void PipelineState::BindTargets(PixelTargets& targets) const
+{
+	Bitmap* colorTargets[4] = { targets.colorBuffer, targets.gbuffers[0], targets.gbuffers[1], targets.gbuffers[2] };
+	for (int i = 0; i < 4; ++i)
+	{
+		targets.writeTargetFuncs[i] = colorTargets[i] ? writeTargetFuncs[blendEquation][colorTargets[i]->GetType()] : nullptr;
+	}
+}
+
+int PipelineState::GetBlendEquation(const RenderState& state)
+{
+	if (!state.alphaBlend) return BLEND_EQUATION_NONE;
+
+	const Blender& blender = state.blender;
+	if (blender.blendOP || blender.srcBlendFactor || blender.dstBlendFactor) return BLEND_EQUATION_GENERIC;
+	int colorFactors = FindBlendFactors(blender.srcColorMode, blender.dstColorMode);
+	int alphaFactors = FindBlendFactors(blender.srcAlphaMode, blender.dstAlphaMode);
+	if (colorFactors < 0 || alphaFactors < 0) return BLEND_EQUATION_GENERIC;
+
+	// the Blender scales both sides by the factors before min and max too
+	if (blender.colorOP != blender.alphaOP) return BLEND_EQUATION_GENERIC;
+	bool isOneOne = (colorFactors == BlendFactors_OneOne && alphaFactors == BlendFactors_OneOne);
+	if (blender.colorOP == Blender::BlendOP_Min) return isOneOne ? BLEND_EQUATION_MIN : BLEND_EQUATION_GENERIC;
+	if (blender.colorOP == Blender::BlendOP_Max) return isOneOne ? BLEND_EQUATION_MAX : BLEND_EQUATION_GENERIC;
+	if (blender.colorOP != Blender::BlendOP_Add) return BLEND_EQUATION_GENERIC;
+	return BLEND_EQUATION_ADD + colorFactors * BlendFactorsCount + alphaFactors;
+}
@@ -0,0 +1,128 @@
+#ifndef _SOFTRENDER_PIPELINE_STATE_H_
+#define _SOFTRENDER_PIPELINE_STATE_H_
+
+#include "base/header.h"
+#include "math/vectorx4.h"
+#include "render_state.hpp"
+#include "rasterizer.hpp"
+#include "bitmap.h"
+#include "depth_stencil_buffer.hpp"
+#include "hiz_buffer.h"
+
+namespace sr
+{
+
+struct IShader;
+
+class PipelineState;
+typedef std::shared_ptr<PipelineState> PipelineStatePtr;
+
+// blends the quad lanes in writeMask of src into a color target of one format
+typedef void(*WriteTargetFunc)(const RenderState& state, Bitmap* buffer, const Rasterizer2x2Info& quad, uint8_t writeMask, const Colorx4& src);
+
+// buffers the pixel back-end of a draw reads and writes, gathered once per draw
+struct PixelTargets
+{
+	Bitmap* colorBuffer = nullptr;
+	Bitmap* gbuffers[3] = { nullptr, nullptr, nullptr };
+	DepthStencilBuffer* depthStencilBuffer = nullptr;
+	HiZBuffer* hizBuffer = nullptr;
+	// the writers of the color buffer and the g-buffers for their formats, set by PipelineState::BindTargets
+	WriteTargetFunc writeTargetFuncs[4] = { nullptr, nullptr, nullptr, nullptr };
+};
+
+// immutable render state of a draw. the depth test, depth write, stencil and blend equation are
+// resolved once into pixel back-end functions specialized for the combination, picked from
+// compile-time tables like the samplers of Texture2D, so no per-pixel switch is left. the color
+// targets get writers specialized for their formats too, when a draw binds them
+class PipelineState
+{
+public:
+	// the state is copied, changing it afterwards doesn't affect the pipeline state
+	explicit PipelineState(const RenderState& state);
+
+	static PipelineStatePtr Create(const RenderState& state)
+	{
+		return std::make_shared<PipelineState>(state);
+	}
+
+	const RenderState& GetRenderState() const { return state; }
+
+	// picks the writers of the targets' formats for the blend equation, once per draw
+	void BindTargets(PixelTargets& targets) const;
+
+	// mask of the covered quad pixels passing the depth and stencil tests of the face. the depth
+	// is not written, the stencil only by the fail and depth fail operations of the lanes failing
+	uint8_t TestQuad(const PixelTargets& targets, const Rasterizer2x2Info& quad, bool isBackFace) const
+	{
+		return testQuadFunc(stencilFaces[isBackFace ? 1 : 0], targets, quad);
+	}
+
+	// blends the shader outputs of the quad lanes in writeMask, SV_Target0x4 to SV_Target3x4,
+	// and writes their depth and the stencil pass operation of the face
+	void WriteQuad(const PixelTargets& targets, const Rasterizer2x2Info& quad, uint8_t writeMask, const IShader& shader, bool isBackFace) const
+	{
+		writeQuadFunc(state, stencilFaces[isBackFace ? 1 : 0], targets, quad, writeMask, shader);
+	}
+
+	// the stencil is written by pixels failing a test, so they can't be skipped unrasterized
+	bool WritesOnFail() const { return stencilFaces[0].writesOnFail || stencilFaces[1].writesOnFail; }
+	bool WritesDepthStencil() const
+	{
+		return state.zWrite || WritesOnFail() || stencilFaces[0].writesOnPass || stencilFaces[1].writesOnPass;
+	}
+
+	// the stencil state of a face resolved to tables over the 256 buffer values: whether the
+	// value passes the test, and what each operation leaves of it, masks applied
+	struct StencilFace
+	{
+		bool passes[256];
+		uint8_t failOp[256];
+		uint8_t zFailOp[256];
+		uint8_t passOp[256];
+		bool writesOnFail = false;
+		bool writesOnPass = false;
+
+		void Setup(const RenderState& state, RenderState::StencilComparison comp,
+			RenderState::StencilOperation fail, RenderState::StencilOperation zFail, RenderState::StencilOperation pass);
+	};
+
+	// blend equations with a specialized back-end: no blending, the Blender at runtime, min or max
+	// with factors One One, or an add over one of the factor pairs below for color and alpha each.
+	// RGBA32 targets are blended by them in 8 bit fixed point, a quad at a time
+	enum BlendFactors
+	{
+		BlendFactors_OneZero = 0,
+		BlendFactors_OneOne,
+		BlendFactors_SrcAlphaOneMinusSrcAlpha,
+		BlendFactors_ZeroOne,
+		BlendFactors_OneOneMinusSrcAlpha, // premultiplied alpha
+		BlendFactors_DstColorZero, // multiply
+		BlendFactorsCount
+	};
+	static const int BLEND_EQUATION_NONE = 0;
+	static const int BLEND_EQUATION_GENERIC = 1;
+	static const int BLEND_EQUATION_MIN = 2;
+	static const int BLEND_EQUATION_MAX = 3;
+	static const int BLEND_EQUATION_ADD = 4;
+	static const int BLEND_EQUATION_COUNT = BLEND_EQUATION_ADD + BlendFactorsCount * BlendFactorsCount;
+
+	static const int ZTEST_COUNT = RenderState::ZTestType_NotEqual + 1;
+
+	typedef uint8_t(*TestQuadFunc)(const StencilFace& stencil, const PixelTargets& targets, const Rasterizer2x2Info& quad);
+	typedef void(*WriteQuadFunc)(const RenderState& state, const StencilFace& stencil, const PixelTargets& targets, const Rasterizer2x2Info& quad, uint8_t writeMask, const IShader& shader);
+
+private:
+	static int GetBlendEquation(const RenderState& state);
+
+	RenderState state;
+	// front and back
+	StencilFace stencilFaces[2];
+	TestQuadFunc testQuadFunc;
+	WriteQuadFunc writeQuadFunc;
+	int blendEquation;
+};
+
+}
+
+#endif //! _SOFTRENDER_PIPELINE_STATE_H_
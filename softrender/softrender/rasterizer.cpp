@@ -0,0 +1,157 @@
+#include "rasterizer.hpp"
+#include "base/cpu_features.h"
+
+namespace sr
+{
+
+#if _MATH_SIMD_INTRINSIC_
+Rasterizer::Kernel Rasterizer::kernel = Rasterizer::Kernel_SSE41;
+Rasterizer::QuadRowFunc Rasterizer::quadRowFunc = Rasterizer::QuadRowSSE41;
+#else
+Rasterizer::Kernel Rasterizer::kernel = Rasterizer::Kernel_Scalar;
+Rasterizer::QuadRowFunc Rasterizer::quadRowFunc = Rasterizer::QuadRowScalar;
+#endif
+
+void Rasterizer::SelectKernel(Kernel maxKernel/* = Kernel_AVX512*/)
+{
+	kernel = Kernel_Scalar;
+	quadRowFunc = QuadRowScalar;
+#if _MATH_SIMD_INTRINSIC_
+	// the SIMD build already requires SSE4.1, the wider kernels are checked at runtime
+	if (maxKernel >= Kernel_SSE41)
+	{
+		kernel = Kernel_SSE41;
+		quadRowFunc = QuadRowSSE41;
+	}
+	if (maxKernel >= Kernel_AVX2 && CpuFeatures::HasAVX2())
+	{
+		kernel = Kernel_AVX2;
+		quadRowFunc = QuadRowAVX2;
+	}
+	if (maxKernel >= Kernel_AVX512 && CpuFeatures::HasAVX512F())
+	{
+		kernel = Kernel_AVX512;
+		quadRowFunc = QuadRowAVX512;
+	}
+#endif
+}
+
+int Rasterizer::QuadRowScalar(const RasterizerSetup& setup, int x, int y, int quadCount, bool isBlockInside, Rasterizer2x2Info* quads)
+{
+	int w0 = setup.w0 + (x - setup.minX) * setup.dy01 - (y - setup.minY) * setup.dx01;
+	int w1 = setup.w1 + (x - setup.minX) * setup.dy12 - (y - setup.minY) * setup.dx12;
+	int w2 = setup.w2 + (x - setup.minX) * setup.dy20 - (y - setup.minY) * setup.dx20;
+
+	int i_w0_delta[4] = { 0, setup.dy01, -setup.dx01, setup.dy01 - setup.dx01 };
+	int i_w1_delta[4] = { 0, setup.dy12, -setup.dx12, setup.dy12 - setup.dx12 };
+	int i_w2_delta[4] = { 0, setup.dy20, -setup.dx20, setup.dy20 - setup.dx20 };
+
+	int count = 0;
+	for (int q = 0; q < quadCount; ++q, x += 2)
+	{
+		Rasterizer2x2Info& info = quads[count];
+		int i_w0[4], i_w1[4], i_w2[4];
+		info.maskCode = isBlockInside ? 0xF : 0x0;
+		for (int i = 0; i < 4; ++i)
+		{
+			i_w0[i] = w0 + i_w0_delta[i];
+			i_w1[i] = w1 + i_w1_delta[i];
+			i_w2[i] = w2 + i_w2_delta[i];
+			if ((i_w0[i] | i_w1[i] | i_w2[i]) >= 0) info.maskCode |= (1 << i);
+		}
+		info.maskCode = setup.ClipQuadMask(x, y, info.maskCode);
+
+		w0 += setup.dy01 * 2;
+		w1 += setup.dy12 * 2;
+		w2 += setup.dy20 * 2;
+		if (info.maskCode == 0) continue;
+
+		for (int i = 0; i < 4; ++i)
+		{
+			float f_w0 = (float)i_w0[i];
+			float f_w1 = (float)i_w1[i];
+			float f_w2 = (float)i_w2[i];
+
+			info.wx[i] = f_w1 * setup.invW0;
+			info.wy[i] = f_w2 * setup.invW1;
+			info.wz[i] = f_w0 * setup.invW2;
+			float f_invSum = 1.f / (info.wx[i] + info.wy[i] + info.wz[i]);
+			info.wx[i] *= f_invSum;
+			info.wy[i] *= f_invSum;
+			info.wz[i] *= f_invSum;
+			info.depth[i] = Mathf::TriangleInterp(setup.z0, setup.z1, setup.z2, info.wx[i], info.wy[i], info.wz[i]);
+		}
+		info.x = x;
+		info.y = y;
+		++count;
+	}
+	return count;
+}
+
+#if _MATH_SIMD_INTRINSIC_
+int Rasterizer::QuadRowSSE41(const RasterizerSetup& setup, int x, int y, int quadCount, bool isBlockInside, Rasterizer2x2Info* quads)
+{
+	int w0 = setup.w0 + (x - setup.minX) * setup.dy01 - (y - setup.minY) * setup.dx01;
+	int w1 = setup.w1 + (x - setup.minX) * setup.dy12 - (y - setup.minY) * setup.dx12;
+	int w2 = setup.w2 + (x - setup.minX) * setup.dy20 - (y - setup.minY) * setup.dx20;
+
+	const __m128 _mf_one = _mm_set1_ps(1.f);
+
+	__m128i mi_w0_delta = _mm_setr_epi32(0, setup.dy01, -setup.dx01, setup.dy01 - setup.dx01);
+	__m128i mi_w1_delta = _mm_setr_epi32(0, setup.dy12, -setup.dx12, setup.dy12 - setup.dx12);
+	__m128i mi_w2_delta = _mm_setr_epi32(0, setup.dy20, -setup.dx20, setup.dy20 - setup.dx20);
+
+	__m128 mf_p0_invW = _mm_set1_ps(setup.invW0);
+	__m128 mf_p1_invW = _mm_set1_ps(setup.invW1);
+	__m128 mf_p2_invW = _mm_set1_ps(setup.invW2);
+	__m128 mf_p0_z = _mm_set1_ps(setup.z0);
+	__m128 mf_p1_z = _mm_set1_ps(setup.z1);
+	__m128 mf_p2_z = _mm_set1_ps(setup.z2);
+
+	int count = 0;
+	for (int q = 0; q < quadCount; ++q, x += 2)
+	{
+		Rasterizer2x2Info& info = quads[count];
+		__m128i mi_w0 = _mm_add_epi32(_mm_set1_epi32(w0), mi_w0_delta);
+		__m128i mi_w1 = _mm_add_epi32(_mm_set1_epi32(w1), mi_w1_delta);
+		__m128i mi_w2 = _mm_add_epi32(_mm_set1_epi32(w2), mi_w2_delta);
+
+		if (isBlockInside) info.maskCode = 0xF;
+		else
+		{
+			__m128i mi_or_w = _mm_or_si128(_mm_or_si128(mi_w0, mi_w1), mi_w2);
+			info.maskCode = (uint8_t)(~_mm_movemask_ps(_mm_castsi128_ps(mi_or_w)) & 0xF);
+		}
+		info.maskCode = setup.ClipQuadMask(x, y, info.maskCode);
+
+		w0 += setup.dy01 * 2;
+		w1 += setup.dy12 * 2;
+		w2 += setup.dy20 * 2;
+		if (info.maskCode == 0) continue;
+
+		__m128 mf_w0 = _mm_cvtepi32_ps(mi_w0);
+		__m128 mf_w1 = _mm_cvtepi32_ps(mi_w1);
+		__m128 mf_w2 = _mm_cvtepi32_ps(mi_w2);
+
+		__m128 mf_tmp0 = _mm_mul_ps(mf_w1, mf_p0_invW);
+		__m128 mf_tmp1 = _mm_mul_ps(mf_w2, mf_p1_invW);
+		__m128 mf_tmp2 = _mm_mul_ps(mf_w0, mf_p2_invW);
+		//__m128 mf_invw = _mm_rcp_ps(_mm_add_ps(_mm_add_ps(mf_x, mf_y), mf_z));
+		__m128 mf_invSum = _mm_div_ps(_mf_one, _mm_add_ps(_mm_add_ps(mf_tmp0, mf_tmp1), mf_tmp2));
+		__m128 mf_wx = _mm_mul_ps(mf_tmp0, mf_invSum);
+		__m128 mf_wy = _mm_mul_ps(mf_tmp1, mf_invSum);
+		__m128 mf_wz = _mm_mul_ps(mf_tmp2, mf_invSum);
+		_mm_store_ps(info.wx, mf_wx);
+		_mm_store_ps(info.wy, mf_wy);
+		_mm_store_ps(info.wz, mf_wz);
+		_mm_store_ps(info.depth, _mm_add_ps(_mm_add_ps(_mm_mul_ps(mf_p0_z, mf_wx), _mm_mul_ps(mf_p1_z, mf_wy)), _mm_mul_ps(mf_p2_z, mf_wz)));
+
+		info.x = x;
+		info.y = y;
+		++count;
+	}
+	return count;
+}
+#endif
+
+}
@@ -9,13 +9,6 @@
 namespace sr
 {
 
-struct RasterizerInfo
-{
-	int x, y;
-	float depth;
-	float wx, wy, wz;
-};
-
 struct Rasterizer2x2Info
 {
 	int x, y;
@@ -29,12 +22,81 @@ struct Rasterizer2x2Info
 #endif
 };
 
+// per triangle edge and attribute setup shared by the quad kernels
+struct RasterizerSetup
+{
+	int minX, minY; // origin of the edge values, aligned to even pixels
+	int minXInside, minYInside, maxX, maxY; // pixels outside are masked off
+	int w0, w1, w2; // edge values at the origin, top-left bias applied
+	int dx01, dx12, dx20;
+	int dy01, dy12, dy20;
+	float invW0, invW1, invW2;
+	float z0, z1, z2;
+
+	uint8_t ClipQuadMask(int x, int y, uint8_t maskCode) const
+	{
+		if (x < minXInside) maskCode &= ~0x5;
+		if (x + 1 > maxX) maskCode &= ~0xA;
+		if (y < minYInside) maskCode &= ~0x3;
+		if (y + 1 > maxY) maskCode &= ~0xC;
+		return maskCode;
+	}
+};
+
 class Rasterizer
 {
+public:
+	enum Kernel
+	{
+		Kernel_Scalar = 0,
+		Kernel_SSE41,
+		Kernel_AVX2,
+		Kernel_AVX512
+	};
+
+	static const int BLOCK_SIZE = 8;
+
+	// evaluates quadCount quads of one row starting at (x, y), writes the covered ones to quads
+	// and returns how many were written. quadCount is at most BLOCK_SIZE / 2.
+	typedef int(*QuadRowFunc)(const RasterizerSetup& setup, int x, int y, int quadCount, bool isBlockInside, Rasterizer2x2Info* quads);
+
+	// picks the widest kernel the CPU and OS support, never above maxKernel
+	static void SelectKernel(Kernel maxKernel = Kernel_AVX512);
+	static Kernel GetKernel() { return kernel; }
+
 private:
+	static Kernel kernel;
+	static QuadRowFunc quadRowFunc;
+
+	static int QuadRowScalar(const RasterizerSetup& setup, int x, int y, int quadCount, bool isBlockInside, Rasterizer2x2Info* quads);
+#if _MATH_SIMD_INTRINSIC_
+	static int QuadRowSSE41(const RasterizerSetup& setup, int x, int y, int quadCount, bool isBlockInside, Rasterizer2x2Info* quads);
+	static int QuadRowAVX2(const RasterizerSetup& setup, int x, int y, int quadCount, bool isBlockInside, Rasterizer2x2Info* quads);
+	static int QuadRowAVX512(const RasterizerSetup& setup, int x, int y, int quadCount, bool isBlockInside, Rasterizer2x2Info* quads);
+#endif
+
+	enum BlockCode
+	{
+		BlockOutside = 0,
+		BlockPartial = 1,
+		BlockInside = 2
+	};
+
 	int width = 0;
 	int height = 0;
 
+	// edge function of the block corners, the edge is linear so the corners bound the whole block
+	static int ClassifyBlock(int w, int dx, int dy, int x0, int x1, int y0, int y1)
+	{
+		int w00 = w + x0 * dy - y0 * dx;
+		int w10 = w + x1 * dy - y0 * dx;
+		int w01 = w + x0 * dy - y1 * dx;
+		int w11 = w + x1 * dy - y1 * dx;
+		if ((w00 & w10 & w01 & w11) < 0) return BlockOutside;
+		if ((w00 | w10 | w01 | w11) >= 0) return BlockInside;
+		return BlockPartial;
+	}
+
 public:
 	Rasterizer() = default;
 
@@ -47,6 +109,9 @@ public:
 	template<typename Type>
 	using Render2x2Func = std::function<void(const Type&, const Rasterizer2x2Info&)>;
 
+	// false when nothing of the BLOCK_SIZE aligned block at (blockX, blockY) can be visible
+	typedef std::function<bool(int blockX, int blockY)> BlockTestFunc;
+
 	//static void DrawLine(int x0, int x1, int y0, int y1, const Color32& color)
 	//{
 	//	bool steep = Mathf::Abs(y1 - y0) > Mathf::Abs(x1 - x0);
@@ -79,8 +144,19 @@ public:
 	//	}
 	//}
 
-	template<typename DrawDataType>
-	void RasterizerTriangle(Triangle<Projection> projection, Render2x2Func<DrawDataType> renderFunc, const DrawDataType& renderData)
+	// renderFunc is a Render2x2Func or any functor with its signature, which is called without indirection
+	template<typename DrawDataType, typename RenderFuncType>
+	void RasterizerTriangle(const Triangle<Projection>& projection, const RenderFuncType& renderFunc, const DrawDataType& renderData) const
+	{
+		RasterizerTriangle(projection, renderFunc, renderData, 0, 0, width - 1, height - 1);
+	}
+
+	// only pixels inside [clipMinX, clipMaxX] x [clipMinY, clipMaxY] are emitted,
+	// quads stay aligned to even pixels so a triangle split across tiles shades the same quads.
+	// blocks covered by the triangle are skipped when blockTest rejects them
+	template<typename DrawDataType, typename RenderFuncType>
+	void RasterizerTriangle(const Triangle<Projection>& projection, const RenderFuncType& renderFunc, const DrawDataType& renderData,
+		int clipMinX, int clipMinY, int clipMaxX, int clipMaxY, const BlockTestFunc& blockTest = nullptr) const
 	{
 		const Projection& p0 = projection.v0;
 		const Projection& p1 = projection.v1;
@@ -91,137 +167,110 @@ public:
 		int maxX = Mathf::Max(p0.x, p1.x, p2.x);
 		int maxY = Mathf::Max(p0.y, p1.y, p2.y);
 
-		if (minX < 0) minX = 0;
-		if (minY < 0) minY = 0;
-		if (maxX >= width) maxX = width - 1;
-		if (maxY >= height) maxY = height - 1;
+		if (minX < clipMinX) minX = clipMinX;
+		if (minY < clipMinY) minY = clipMinY;
+		if (maxX > clipMaxX) maxX = clipMaxX;
+		if (maxY > clipMaxY) maxY = clipMaxY;
 
 		if (maxX < minX) return;
 		if (maxY < minY) return;
 
-		int dx01 = p1.x - p0.x;
-		int dx12 = p2.x - p1.x;
-		int dx20 = p0.x - p2.x;
+		RasterizerSetup setup;
+		setup.minXInside = minX;
+		setup.minYInside = minY;
+		setup.maxX = maxX;
+		setup.maxY = maxY;
+		minX &= ~1;
+		minY &= ~1;
+		setup.minX = minX;
+		setup.minY = minY;
 
-		int dy01 = p1.y - p0.y;
-		int dy12 = p2.y - p1.y;
-		int dy20 = p0.y - p2.y;
+		SetupEdges(projection, setup);
 
-		int startW0 = Projection::Orient2D(p1.x, p1.y, p0.x, p0.y, minX, minY);
-		int startW1 = Projection::Orient2D(p2.x, p2.y, p1.x, p1.y, minX, minY);
-		int startW2 = Projection::Orient2D(p0.x, p0.y, p2.x, p2.y, minX, minY);
+		Rasterizer2x2Info quads[BLOCK_SIZE / 2];
 
-		if (!(dy01 > 0 || (dy01 == 0 && dx01 < 0))) startW0 -= 1;
-		if (!(dy12 > 0 || (dy12 == 0 && dx12 < 0))) startW1 -= 1;
-		if (!(dy20 > 0 || (dy20 == 0 && dx20 < 0))) startW2 -= 1;
-
-		Rasterizer2x2Info info;
-#if _MATH_SIMD_INTRINSIC_
-		static __m128 _mf_one = _mm_set1_ps(1.f);
-
-		__m128i mi_w0_delta = _mm_setr_epi32(0, dy01, -dx01, dy01 - dx01);
-		__m128i mi_w1_delta = _mm_setr_epi32(0, dy12, -dx12, dy12 - dx12);
-		__m128i mi_w2_delta = _mm_setr_epi32(0, dy20, -dx20, dy20 - dx20);
-
-		__m128 mf_p0_invW = _mm_load1_ps(&(p0.invW));
-		__m128 mf_p1_invW = _mm_load1_ps(&(p1.invW));
-		__m128 mf_p2_invW = _mm_load1_ps(&(p2.invW));
-#else
-		int i_w0_delta[4] = { 0, dy01, -dx01, dy01 - dx01 };
-		int i_w1_delta[4] = { 0, dy12, -dx12, dy12 - dx12 };
-		int i_w2_delta[4] = { 0, dy20, -dx20, dy20 - dx20 };
-#endif
-
-		for (int y = minY; y <= maxY; y += 2)
+		// coarse pass over aligned blocks: blocks outside any edge are skipped,
+		// blocks inside all three edges emit their quads without per-pixel edge tests
+		for (int blockY = (minY & ~(BLOCK_SIZE - 1)); blockY <= maxY; blockY += BLOCK_SIZE)
 		{
-			int w0 = startW0;
-			int w1 = startW1;
-			int w2 = startW2;
+			int quadMinY = Mathf::Max(blockY, minY);
+			int quadMaxY = Mathf::Min(blockY + BLOCK_SIZE - 1, maxY);
+			int offsetY0 = blockY - minY;
+			int offsetY1 = offsetY0 + BLOCK_SIZE - 1;
 
-			for (int x = minX; x <= maxX; x += 2)
+			for (int blockX = (minX & ~(BLOCK_SIZE - 1)); blockX <= maxX; blockX += BLOCK_SIZE)
 			{
-				info.maskCode = 0x00;
-#if _MATH_SIMD_INTRINSIC_
-				__m128i mi_w0 = _mm_add_epi32(_mm_set1_epi32(w0), mi_w0_delta);
-				__m128i mi_w1 = _mm_add_epi32(_mm_set1_epi32(w1), mi_w1_delta);
-				__m128i mi_w2 = _mm_add_epi32(_mm_set1_epi32(w2), mi_w2_delta);
-
-				__m128i mi_or_w = _mm_or_si128(_mm_or_si128(mi_w0, mi_w1), mi_w2);
-				SIMD_ALIGN static int or_w[4];
-				_mm_store_si128((__m128i*)or_w, mi_or_w);
-				if (or_w[0] >= 0) info.maskCode |= 0x1;
-				if (or_w[1] >= 0) info.maskCode |= 0x2;
-				if (or_w[2] >= 0) info.maskCode |= 0x4;
-				if (or_w[3] >= 0) info.maskCode |= 0x8;
-				if (x + 1 >= maxX) info.maskCode &= ~0xA;
-				if (y + 1 >= maxY) info.maskCode &= ~0xC;
-
-				if (info.maskCode != 0)
-				{
-					__m128 mf_w0 = _mm_cvtepi32_ps(mi_w0);
-					__m128 mf_w1 = _mm_cvtepi32_ps(mi_w1);
-					__m128 mf_w2 = _mm_cvtepi32_ps(mi_w2);
-
-					__m128 mf_tmp0 = _mm_mul_ps(mf_w1, mf_p0_invW);
-					__m128 mf_tmp1 = _mm_mul_ps(mf_w2, mf_p1_invW);
-					__m128 mf_tmp2 = _mm_mul_ps(mf_w0, mf_p2_invW);
-					//__m128 mf_invw = _mm_rcp_ps(_mm_add_ps(_mm_add_ps(mf_x, mf_y), mf_z));
-					__m128 mf_invSum = _mm_div_ps(_mf_one, _mm_add_ps(_mm_add_ps(mf_tmp0, mf_tmp1), mf_tmp2));
-					_mm_store_ps(info.wx, _mm_mul_ps(mf_tmp0, mf_invSum));
-					_mm_store_ps(info.wy, _mm_mul_ps(mf_tmp1, mf_invSum));
-					_mm_store_ps(info.wz, _mm_mul_ps(mf_tmp2, mf_invSum));
-
-					for (int i = 0; i < 4; ++i)
-					{
-#else
-				int i_w0[4], i_w1[4], i_w2[4];
-				for (int i = 0; i < 4; ++i)
-				{
-					i_w0[i] = w0 + i_w0_delta[i];
-					i_w1[i] = w1 + i_w1_delta[i];
-					i_w2[i] = w2 + i_w2_delta[i];
-					if ((i_w0[i] | i_w1[i] | i_w2[i]) >= 0) info.maskCode |= (1 << i);
-				}
-				if (x + 1 >= maxX) info.maskCode &= ~0xA;
-				if (y + 1 >= maxY) info.maskCode &= ~0xC;
-
-				if (info.maskCode != 0)
+				int quadMinX = Mathf::Max(blockX, minX);
+				int quadMaxX = Mathf::Min(blockX + BLOCK_SIZE - 1, maxX);
+				int offsetX0 = blockX - minX;
+				int offsetX1 = offsetX0 + BLOCK_SIZE - 1;
+
+				int code0 = ClassifyBlock(setup.w0, setup.dx01, setup.dy01, offsetX0, offsetX1, offsetY0, offsetY1);
+				int code1 = ClassifyBlock(setup.w1, setup.dx12, setup.dy12, offsetX0, offsetX1, offsetY0, offsetY1);
+				int code2 = ClassifyBlock(setup.w2, setup.dx20, setup.dy20, offsetX0, offsetX1, offsetY0, offsetY1);
+				if (code0 == BlockOutside || code1 == BlockOutside || code2 == BlockOutside) continue;
+				if (blockTest && !blockTest(blockX, blockY)) continue;
+				bool isBlockInside = (code0 == BlockInside && code1 == BlockInside && code2 == BlockInside);
+
+				int quadCount = ((quadMaxX - quadMinX) >> 1) + 1;
+				for (int y = quadMinY; y <= quadMaxY; y += 2)
 				{
-					for (int i = 0; i < 4; ++i)
+					int count = quadRowFunc(setup, quadMinX, y, quadCount, isBlockInside, quads);
+					for (int i = 0; i < count; ++i)
 					{
-						float f_w0 = (float)i_w0[i];
-						float f_w1 = (float)i_w1[i];
-						float f_w2 = (float)i_w2[i];
-
-						info.wx[i] = f_w1 * p0.invW;
-						info.wy[i] = f_w2 * p1.invW;
-						info.wz[i] = f_w0 * p2.invW;
-						float f_invSum = 1.f / (info.wx[i] + info.wy[i] + info.wz[i]);
-						info.wx[i] *= f_invSum;
-						info.wy[i] *= f_invSum;
-						info.wz[i] *= f_invSum;
-#endif
-						info.depth[i] = Mathf::TriangleInterp(p0.z, p1.z, p2.z, info.wx[i], info.wy[i], info.wz[i]);
+						renderFunc(renderData, quads[i]);
 					}
-
-					info.x = x;
-					info.y = y;
-					renderFunc(renderData, info);
 				}
-
-
-				w0 += dy01 * 2;
-				w1 += dy12 * 2;
-				w2 += dy20 * 2;
 			}
-
-			startW0 -= dx01 * 2;
-			startW1 -= dx12 * 2;
-			startW2 -= dx20 * 2;
 		}
 	}
 
+	// weights and depth of the quad at the even pixel (x, y) on the plane of the triangle, whether the
+	// triangle covers its pixels or not. computed like the covered quads of RasterizerTriangle
+	static void InterpolateQuad(const Triangle<Projection>& projection, int x, int y, Rasterizer2x2Info& info)
+	{
+		RasterizerSetup setup;
+		setup.minX = setup.minXInside = x;
+		setup.minY = setup.minYInside = y;
+		setup.maxX = x + 1;
+		setup.maxY = y + 1;
+		SetupEdges(projection, setup);
+		quadRowFunc(setup, x, y, 1, true, &info);
+	}
 
+private:
+	// edge values at the setup origin and the attributes of the vertices
+	static void SetupEdges(const Triangle<Projection>& projection, RasterizerSetup& setup)
+	{
+		const Projection& p0 = projection.v0;
+		const Projection& p1 = projection.v1;
+		const Projection& p2 = projection.v2;
+		int minX = setup.minX;
+		int minY = setup.minY;
+
+		setup.dx01 = p1.x - p0.x;
+		setup.dx12 = p2.x - p1.x;
+		setup.dx20 = p0.x - p2.x;
+
+		setup.dy01 = p1.y - p0.y;
+		setup.dy12 = p2.y - p1.y;
+		setup.dy20 = p0.y - p2.y;
+
+		setup.w0 = Projection::Orient2D(p1.x, p1.y, p0.x, p0.y, minX, minY);
+		setup.w1 = Projection::Orient2D(p2.x, p2.y, p1.x, p1.y, minX, minY);
+		setup.w2 = Projection::Orient2D(p0.x, p0.y, p2.x, p2.y, minX, minY);
+
+		if (!(setup.dy01 > 0 || (setup.dy01 == 0 && setup.dx01 < 0))) setup.w0 -= 1;
+		if (!(setup.dy12 > 0 || (setup.dy12 == 0 && setup.dx12 < 0))) setup.w1 -= 1;
+		if (!(setup.dy20 > 0 || (setup.dy20 == 0 && setup.dx20 < 0))) setup.w2 -= 1;
+
+		setup.invW0 = p0.invW;
+		setup.invW1 = p1.invW;
+		setup.invW2 = p2.invW;
+		setup.z0 = p0.z;
+		setup.z1 = p1.z;
+		setup.z2 = p2.z;
+	}
 };
 
 }
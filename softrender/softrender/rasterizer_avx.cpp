@@ -0,0 +1,200 @@
+#include "rasterizer.hpp"
+
+// AVX2 / AVX-512 quad kernels. They are compiled for their instruction set per function
+// so the rest of the library keeps building for SSE4.1, Rasterizer::SelectKernel only
+// picks them when CPUID reports support.
+#if _MATH_SIMD_INTRINSIC_
+#include <immintrin.h>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#define RASTERIZER_TARGET_AVX2
+#define RASTERIZER_TARGET_AVX512
+#else
+#define RASTERIZER_TARGET_AVX2 __attribute__((target("avx2")))
+#define RASTERIZER_TARGET_AVX512 __attribute__((target("avx2,avx512f")))
+#endif
+
+namespace sr
+{
+
+RASTERIZER_TARGET_AVX2
+static inline void StoreQuad(Rasterizer2x2Info& info, int x, int y, uint8_t maskCode, __m128 wx, __m128 wy, __m128 wz, __m128 depth)
+{
+	info.x = x;
+	info.y = y;
+	info.maskCode = maskCode;
+	_mm_store_ps(info.wx, wx);
+	_mm_store_ps(info.wy, wy);
+	_mm_store_ps(info.wz, wz);
+	_mm_store_ps(info.depth, depth);
+}
+
+// two quads per iteration: lanes 0..3 are the quad at x, lanes 4..7 the quad at x + 2
+RASTERIZER_TARGET_AVX2
+int Rasterizer::QuadRowAVX2(const RasterizerSetup& setup, int x, int y, int quadCount, bool isBlockInside, Rasterizer2x2Info* quads)
+{
+	int w0 = setup.w0 + (x - setup.minX) * setup.dy01 - (y - setup.minY) * setup.dx01;
+	int w1 = setup.w1 + (x - setup.minX) * setup.dy12 - (y - setup.minY) * setup.dx12;
+	int w2 = setup.w2 + (x - setup.minX) * setup.dy20 - (y - setup.minY) * setup.dx20;
+
+	const __m256 _mf_one = _mm256_set1_ps(1.f);
+	const __m256i mi_offsetX = _mm256_setr_epi32(0, 1, 0, 1, 2, 3, 2, 3);
+	const __m256i mi_offsetY = _mm256_setr_epi32(0, 0, 1, 1, 0, 0, 1, 1);
+
+	__m256i mi_w0_delta = _mm256_sub_epi32(_mm256_mullo_epi32(mi_offsetX, _mm256_set1_epi32(setup.dy01)), _mm256_mullo_epi32(mi_offsetY, _mm256_set1_epi32(setup.dx01)));
+	__m256i mi_w1_delta = _mm256_sub_epi32(_mm256_mullo_epi32(mi_offsetX, _mm256_set1_epi32(setup.dy12)), _mm256_mullo_epi32(mi_offsetY, _mm256_set1_epi32(setup.dx12)));
+	__m256i mi_w2_delta = _mm256_sub_epi32(_mm256_mullo_epi32(mi_offsetX, _mm256_set1_epi32(setup.dy20)), _mm256_mullo_epi32(mi_offsetY, _mm256_set1_epi32(setup.dx20)));
+
+	__m256 mf_p0_invW = _mm256_set1_ps(setup.invW0);
+	__m256 mf_p1_invW = _mm256_set1_ps(setup.invW1);
+	__m256 mf_p2_invW = _mm256_set1_ps(setup.invW2);
+	__m256 mf_p0_z = _mm256_set1_ps(setup.z0);
+	__m256 mf_p1_z = _mm256_set1_ps(setup.z1);
+	__m256 mf_p2_z = _mm256_set1_ps(setup.z2);
+
+	int count = 0;
+	for (int q = 0; q < quadCount; q += 2, x += 4)
+	{
+		__m256i mi_w0 = _mm256_add_epi32(_mm256_set1_epi32(w0), mi_w0_delta);
+		__m256i mi_w1 = _mm256_add_epi32(_mm256_set1_epi32(w1), mi_w1_delta);
+		__m256i mi_w2 = _mm256_add_epi32(_mm256_set1_epi32(w2), mi_w2_delta);
+
+		int laneMask = 0xFF;
+		if (!isBlockInside)
+		{
+			__m256i mi_or_w = _mm256_or_si256(_mm256_or_si256(mi_w0, mi_w1), mi_w2);
+			laneMask = ~_mm256_movemask_ps(_mm256_castsi256_ps(mi_or_w)) & 0xFF;
+		}
+		uint8_t maskCode0 = setup.ClipQuadMask(x, y, (uint8_t)(laneMask & 0xF));
+		uint8_t maskCode1 = (q + 1 < quadCount) ? setup.ClipQuadMask(x + 2, y, (uint8_t)(laneMask >> 4)) : 0;
+
+		w0 += setup.dy01 * 4;
+		w1 += setup.dy12 * 4;
+		w2 += setup.dy20 * 4;
+		if ((maskCode0 | maskCode1) == 0) continue;
+
+		__m256 mf_w0 = _mm256_cvtepi32_ps(mi_w0);
+		__m256 mf_w1 = _mm256_cvtepi32_ps(mi_w1);
+		__m256 mf_w2 = _mm256_cvtepi32_ps(mi_w2);
+
+		__m256 mf_tmp0 = _mm256_mul_ps(mf_w1, mf_p0_invW);
+		__m256 mf_tmp1 = _mm256_mul_ps(mf_w2, mf_p1_invW);
+		__m256 mf_tmp2 = _mm256_mul_ps(mf_w0, mf_p2_invW);
+		__m256 mf_invSum = _mm256_div_ps(_mf_one, _mm256_add_ps(_mm256_add_ps(mf_tmp0, mf_tmp1), mf_tmp2));
+		__m256 mf_wx = _mm256_mul_ps(mf_tmp0, mf_invSum);
+		__m256 mf_wy = _mm256_mul_ps(mf_tmp1, mf_invSum);
+		__m256 mf_wz = _mm256_mul_ps(mf_tmp2, mf_invSum);
+		__m256 mf_depth = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(mf_p0_z, mf_wx), _mm256_mul_ps(mf_p1_z, mf_wy)), _mm256_mul_ps(mf_p2_z, mf_wz));
+
+		if (maskCode0 != 0)
+		{
+			StoreQuad(quads[count++], x, y, maskCode0,
+				_mm256_castps256_ps128(mf_wx), _mm256_castps256_ps128(mf_wy), _mm256_castps256_ps128(mf_wz), _mm256_castps256_ps128(mf_depth));
+		}
+		if (maskCode1 != 0)
+		{
+			StoreQuad(quads[count++], x + 2, y, maskCode1,
+				_mm256_extractf128_ps(mf_wx, 1), _mm256_extractf128_ps(mf_wy, 1), _mm256_extractf128_ps(mf_wz, 1), _mm256_extractf128_ps(mf_depth, 1));
+		}
+	}
+	return count;
+}
+
+RASTERIZER_TARGET_AVX512
+static inline __m512 AddNoContract(__m512 a, __m512 b)
+{
+	return _mm512_add_round_ps(a, b, _MM_FROUND_CUR_DIRECTION);
+}
+
+// four quads per iteration, a whole 8x2 row of a block: lanes 4k..4k+3 are the quad at x + 2k
+RASTERIZER_TARGET_AVX512
+int Rasterizer::QuadRowAVX512(const RasterizerSetup& setup, int x, int y, int quadCount, bool isBlockInside, Rasterizer2x2Info* quads)
+{
+	int w0 = setup.w0 + (x - setup.minX) * setup.dy01 - (y - setup.minY) * setup.dx01;
+	int w1 = setup.w1 + (x - setup.minX) * setup.dy12 - (y - setup.minY) * setup.dx12;
+	int w2 = setup.w2 + (x - setup.minX) * setup.dy20 - (y - setup.minY) * setup.dx20;
+
+	const __m512 _mf_one = _mm512_set1_ps(1.f);
+	const __m512i mi_offsetX = _mm512_setr_epi32(0, 1, 0, 1, 2, 3, 2, 3, 4, 5, 4, 5, 6, 7, 6, 7);
+	const __m512i mi_offsetY = _mm512_setr_epi32(0, 0, 1, 1, 0, 0, 1, 1, 0, 0, 1, 1, 0, 0, 1, 1);
+
+	__m512i mi_w0_delta = _mm512_sub_epi32(_mm512_mullo_epi32(mi_offsetX, _mm512_set1_epi32(setup.dy01)), _mm512_mullo_epi32(mi_offsetY, _mm512_set1_epi32(setup.dx01)));
+	__m512i mi_w1_delta = _mm512_sub_epi32(_mm512_mullo_epi32(mi_offsetX, _mm512_set1_epi32(setup.dy12)), _mm512_mullo_epi32(mi_offsetY, _mm512_set1_epi32(setup.dx12)));
+	__m512i mi_w2_delta = _mm512_sub_epi32(_mm512_mullo_epi32(mi_offsetX, _mm512_set1_epi32(setup.dy20)), _mm512_mullo_epi32(mi_offsetY, _mm512_set1_epi32(setup.dx20)));
+
+	__m512 mf_p0_invW = _mm512_set1_ps(setup.invW0);
+	__m512 mf_p1_invW = _mm512_set1_ps(setup.invW1);
+	__m512 mf_p2_invW = _mm512_set1_ps(setup.invW2);
+	__m512 mf_p0_z = _mm512_set1_ps(setup.z0);
+	__m512 mf_p1_z = _mm512_set1_ps(setup.z1);
+	__m512 mf_p2_z = _mm512_set1_ps(setup.z2);
+
+	int count = 0;
+	for (int q = 0; q < quadCount; q += 4, x += 8)
+	{
+		__m512i mi_w0 = _mm512_add_epi32(_mm512_set1_epi32(w0), mi_w0_delta);
+		__m512i mi_w1 = _mm512_add_epi32(_mm512_set1_epi32(w1), mi_w1_delta);
+		__m512i mi_w2 = _mm512_add_epi32(_mm512_set1_epi32(w2), mi_w2_delta);
+
+		int laneMask = 0xFFFF;
+		if (!isBlockInside)
+		{
+			__m512i mi_or_w = _mm512_or_si512(_mm512_or_si512(mi_w0, mi_w1), mi_w2);
+			laneMask = ~(int)_mm512_cmplt_epi32_mask(mi_or_w, _mm512_setzero_si512()) & 0xFFFF;
+		}
+		uint8_t maskCode[4];
+		uint8_t anyMask = 0;
+		for (int k = 0; k < 4; ++k)
+		{
+			maskCode[k] = (q + k < quadCount) ? setup.ClipQuadMask(x + k * 2, y, (uint8_t)((laneMask >> (k * 4)) & 0xF)) : 0;
+			anyMask |= maskCode[k];
+		}
+
+		w0 += setup.dy01 * 8;
+		w1 += setup.dy12 * 8;
+		w2 += setup.dy20 * 8;
+		if (anyMask == 0) continue;
+
+		__m512 mf_w0 = _mm512_cvtepi32_ps(mi_w0);
+		__m512 mf_w1 = _mm512_cvtepi32_ps(mi_w1);
+		__m512 mf_w2 = _mm512_cvtepi32_ps(mi_w2);
+
+		__m512 mf_tmp0 = _mm512_mul_ps(mf_w1, mf_p0_invW);
+		__m512 mf_tmp1 = _mm512_mul_ps(mf_w2, mf_p1_invW);
+		__m512 mf_tmp2 = _mm512_mul_ps(mf_w0, mf_p2_invW);
+		// AVX-512 implies FMA, the explicit rounding adds keep the compiler from fusing them
+		// with the multiplies so every kernel produces the same bits
+		__m512 mf_invSum = _mm512_div_ps(_mf_one, AddNoContract(AddNoContract(mf_tmp0, mf_tmp1), mf_tmp2));
+		__m512 mf_wx = _mm512_mul_ps(mf_tmp0, mf_invSum);
+		__m512 mf_wy = _mm512_mul_ps(mf_tmp1, mf_invSum);
+		__m512 mf_wz = _mm512_mul_ps(mf_tmp2, mf_invSum);
+		__m512 mf_depth = AddNoContract(AddNoContract(_mm512_mul_ps(mf_p0_z, mf_wx), _mm512_mul_ps(mf_p1_z, mf_wy)), _mm512_mul_ps(mf_p2_z, mf_wz));
+
+		// the lane index of extractf32x4 has to be an immediate
+		if (maskCode[0] != 0)
+		{
+			StoreQuad(quads[count++], x, y, maskCode[0],
+				_mm512_extractf32x4_ps(mf_wx, 0), _mm512_extractf32x4_ps(mf_wy, 0), _mm512_extractf32x4_ps(mf_wz, 0), _mm512_extractf32x4_ps(mf_depth, 0));
+		}
+		if (maskCode[1] != 0)
+		{
+			StoreQuad(quads[count++], x + 2, y, maskCode[1],
+				_mm512_extractf32x4_ps(mf_wx, 1), _mm512_extractf32x4_ps(mf_wy, 1), _mm512_extractf32x4_ps(mf_wz, 1), _mm512_extractf32x4_ps(mf_depth, 1));
+		}
+		if (maskCode[2] != 0)
+		{
+			StoreQuad(quads[count++], x + 4, y, maskCode[2],
+				_mm512_extractf32x4_ps(mf_wx, 2), _mm512_extractf32x4_ps(mf_wy, 2), _mm512_extractf32x4_ps(mf_wz, 2), _mm512_extractf32x4_ps(mf_depth, 2));
+		}
+		if (maskCode[3] != 0)
+		{
+			StoreQuad(quads[count++], x + 6, y, maskCode[3],
+				_mm512_extractf32x4_ps(mf_wx, 3), _mm512_extractf32x4_ps(mf_wy, 3), _mm512_extractf32x4_ps(mf_wz, 3), _mm512_extractf32x4_ps(mf_depth, 3));
+		}
+	}
+	return count;
+}
+
+}
+
+#endif
@@ -95,6 +95,18 @@ public:
 			return false;
 		}
 		AssignIndexBuffer(mesh.indices);
+
+		if (!mesh.vertices.empty())
+		{
+			Vector3 boundsMin = mesh.vertices[0];
+			Vector3 boundsMax = mesh.vertices[0];
+			for (auto& vertex : mesh.vertices)
+			{
+				boundsMin = Vector3::Min(boundsMin, vertex);
+				boundsMax = Vector3::Max(boundsMax, vertex);
+			}
+			SetBounds(boundsMin, boundsMax);
+		}
 		return true;
 	}
 
@@ -108,9 +120,22 @@ public:
 		vertexBuffer.Assign(vertices);
 		vertexCount = count;
 		vertexSize = sizeof(VertexType);
+		hasBounds = false;
 		return true;
 	}
 
+	// object space bounding box of the vertices, draws without one are never occlusion culled
+	void SetBounds(const Vector3& min, const Vector3& max)
+	{
+		boundsMin = min;
+		boundsMax = max;
+		hasBounds = true;
+	}
+
+	bool HasBounds() const { return hasBounds; }
+	const Vector3& GetBoundsMin() const { return boundsMin; }
+	const Vector3& GetBoundsMax() const { return boundsMax; }
+
 	int GetVertexCount()
 	{
 		return vertexCount;
@@ -157,6 +182,10 @@ private:
 	int vertexCount = 0;
 	int vertexSize = 0;
 
+	bool hasBounds = false;
+	Vector3 boundsMin;
+	Vector3 boundsMax;
+
 	Buffer indexBuffer;
 	int indexCount = 0;
 };
@@ -67,29 +67,69 @@ struct RenderState
 		StencilOperation_Keep,
 		StencilOperation_Zero,
 		StencilOperation_Replace,
+		StencilOperation_IncrSat,
+		StencilOperation_DecrSat,
+		StencilOperation_Invert,
+		StencilOperation_IncrWrap,
+		StencilOperation_DecrWrap,
+		StencilOperationCount
 	};
 
 	bool stencilOn = false;
 	uint8_t stencilRefValue = 0;
+	// the buffer value and the reference are masked with the read mask before they're compared,
+	// an operation only changes the bits of the write mask
+	uint8_t stencilReadMask = 0xFF;
+	uint8_t stencilWriteMask = 0xFF;
+
+	// front faces, and back faces too unless twoSidedStencil. stencilOp is applied when both the
+	// stencil and the depth tests pass, stencilFailOp when the stencil test fails and
+	// stencilZFailOp when the stencil test passes but the depth test fails
 	StencilComparison stencilComp = StencilComparison_Always;
 	StencilOperation stencilOp = StencilOperation_Replace;
+	StencilOperation stencilFailOp = StencilOperation_Keep;
+	StencilOperation stencilZFailOp = StencilOperation_Keep;
+
+	// back faces get their own stencil state, so one pass can count the faces of a volume
+	// in front of and behind the depth buffer with a culling of Off
+	bool twoSidedStencil = false;
+	StencilComparison stencilCompBack = StencilComparison_Always;
+	StencilOperation stencilOpBack = StencilOperation_Replace;
+	StencilOperation stencilFailOpBack = StencilOperation_Keep;
+	StencilOperation stencilZFailOpBack = StencilOperation_Keep;
+
+	bool operator ==(const RenderState& other) const
+	{
+		return renderType == other.renderType && alphaBlend == other.alphaBlend && blender == other.blender
+			&& zTest == other.zTest && zWrite == other.zWrite && cull == other.cull
+			&& stencilOn == other.stencilOn && stencilRefValue == other.stencilRefValue
+			&& stencilReadMask == other.stencilReadMask && stencilWriteMask == other.stencilWriteMask
+			&& stencilComp == other.stencilComp && stencilOp == other.stencilOp
+			&& stencilFailOp == other.stencilFailOp && stencilZFailOp == other.stencilZFailOp
+			&& twoSidedStencil == other.twoSidedStencil && stencilCompBack == other.stencilCompBack
+			&& stencilOpBack == other.stencilOpBack && stencilFailOpBack == other.stencilFailOpBack
+			&& stencilZFailOpBack == other.stencilZFailOpBack;
+	}
+	bool operator !=(const RenderState& other) const { return !(*this == other); }
 
-	bool StencilTest(float stencil) const
+	bool StencilTest(StencilComparison comp, uint8_t stencil) const
 	{
-		switch (stencilComp)
+		stencil &= stencilReadMask;
+		uint8_t refValue = stencilRefValue & stencilReadMask;
+		switch (comp)
 		{
 		case RenderState::StencilComparison_Greater:
-			return stencil > stencilRefValue;
+			return stencil > refValue;
 		case RenderState::StencilComparison_GEqual:
-			return stencil >= stencilRefValue;
+			return stencil >= refValue;
 		case RenderState::StencilComparison_Less:
-			return stencil < stencilRefValue;
+			return stencil < refValue;
 		case RenderState::StencilComparison_LEqual:
-			return stencil <= stencilRefValue;
+			return stencil <= refValue;
 		case RenderState::StencilComparison_Equal:
-			return stencil == stencilRefValue;
+			return stencil == refValue;
 		case RenderState::StencilComparison_NotEqual:
-			return stencil != stencilRefValue;
+			return stencil != refValue;
 		case RenderState::StencilComparison_Never:
 			return false;
 		case RenderState::StencilComparison_Always:
@@ -98,18 +138,38 @@ struct RenderState
 		}
 	}
 
-	uint8_t WriteStencil(uint8_t stencil) const
+	uint8_t WriteStencil(StencilOperation op, uint8_t stencil) const
 	{
-		switch (stencilOp)
+		uint8_t value = stencil;
+		switch (op)
 		{
 		case RenderState::StencilOperation_Keep:
-			return stencil;
+			break;
 		case RenderState::StencilOperation_Zero:
-			return (uint8_t)0;
+			value = 0;
+			break;
 		case RenderState::StencilOperation_Replace:
+			value = stencilRefValue;
+			break;
+		case RenderState::StencilOperation_IncrSat:
+			value = stencil == 0xFF ? stencil : stencil + 1;
+			break;
+		case RenderState::StencilOperation_DecrSat:
+			value = stencil == 0 ? stencil : stencil - 1;
+			break;
+		case RenderState::StencilOperation_Invert:
+			value = ~stencil;
+			break;
+		case RenderState::StencilOperation_IncrWrap:
+			value = stencil + 1;
+			break;
+		case RenderState::StencilOperation_DecrWrap:
+			value = stencil - 1;
+			break;
 		default:
-			return stencilRefValue;
+			break;
 		}
+		return (uint8_t)((stencil & ~stencilWriteMask) | (value & stencilWriteMask));
 	}
 
 	template <typename Type>
@@ -143,10 +203,12 @@ struct RenderState
 		}
 	}
 
+	// isBackFace tells the surviving triangle's facing, for the two sided stencil
 	template <typename Type>
-	bool FaceCullingSimple(Triangle<Projection>& p, Triangle<Type>& v) const
+	bool FaceCullingSimple(Triangle<Projection>& p, Triangle<Type>& v, bool& isBackFace) const
 	{
 		int ret = Projection::Orient2D(p.v0, p.v1, p.v2);
+		isBackFace = ret > 0;
 
 		switch (cull)
 		{
@@ -192,6 +254,29 @@ struct RenderState
 		}
 		return false;
 	}
+
+	// false when no depth in [zMin, zMax] can pass against any buffer depth in [bufferMin, bufferMax]
+	bool ZTestRange(float zMin, float zMax, float bufferMin, float bufferMax) const
+	{
+		switch (zTest)
+		{
+		case RenderState::ZTestType_Less:
+			return zMin < bufferMax;
+		case RenderState::ZTestType_Greater:
+			return zMax > bufferMin;
+		case RenderState::ZTestType_LEqual:
+			return zMin <= bufferMax;
+		case RenderState::ZTestType_GEqual:
+			return zMax >= bufferMin;
+		case RenderState::ZTestType_Equal:
+			return zMin <= bufferMax && zMax >= bufferMin;
+		case RenderState::ZTestType_NotEqual:
+			return !(zMin == zMax && bufferMin == bufferMax && zMin == bufferMin);
+		case RenderState::ZTestType_Always:
+		default:
+			return true;
+		}
+	}
 };
 
 
@@ -4,31 +4,33 @@
 using namespace sr;
 
 
-RenderTexture::RenderTexture(int width, int height)
+RenderTexture::RenderTexture(int width, int height, Bitmap::Layout layout/* = Bitmap::Layout_Linear*/)
 {
 	this->width = width;
 	this->height = height;
-	colorBuffer = std::make_shared<Bitmap>(width, height, Bitmap::BitmapType_RGBA32);
-	depthBuffer = std::make_shared<Bitmap>(width, height, Bitmap::BitmapType_AlphaFloat);
+	colorBuffer = std::make_shared<Bitmap>(width, height, Bitmap::BitmapType_RGBA32, layout);
+	depthStencilBuffer = std::make_shared<DepthStencilBuffer>(width, height);
 	assert(colorBuffer != nullptr);
-	assert(depthBuffer != nullptr);
+	assert(depthStencilBuffer != nullptr);
+	hizBuffer = std::make_shared<HiZBuffer>(depthStencilBuffer);
 }
 
-sr::RenderTexture::RenderTexture(BitmapPtr colorBuffer, BitmapPtr depthBuffer)
+sr::RenderTexture::RenderTexture(BitmapPtr colorBuffer, DepthStencilBufferPtr depthStencilBuffer)
 {
 	assert(colorBuffer != nullptr);
-	assert(depthBuffer != nullptr);
+	assert(depthStencilBuffer != nullptr);
 	this->width = colorBuffer->GetWidth();
 	this->height = colorBuffer->GetHeight();
-	assert(this->width == depthBuffer->GetWidth());
-	assert(this->height == depthBuffer->GetHeight());
+	assert(this->width == depthStencilBuffer->GetWidth());
+	assert(this->height == depthStencilBuffer->GetHeight());
 	this->colorBuffer = colorBuffer;
-	this->depthBuffer = depthBuffer;
+	this->depthStencilBuffer = depthStencilBuffer;
+	hizBuffer = std::make_shared<HiZBuffer>(depthStencilBuffer);
 }
 
 BitmapPtr RenderTexture::CreateGBuffer(int index, Bitmap::BitmapType format)
 {
-	BitmapPtr bitmap = std::make_shared<Bitmap>(width, height, format);
+	BitmapPtr bitmap = std::make_shared<Bitmap>(width, height, format, GetLayout());
 	SetGBuffer(index, bitmap);
 	return bitmap;
 }
@@ -3,6 +3,8 @@
 
 #include "base/header.h"
 #include "softrender/bitmap.h"
+#include "softrender/depth_stencil_buffer.hpp"
+#include "softrender/hiz_buffer.h"
 #include "math/color.h"
 #include "math/vector2.h"
 
@@ -15,23 +17,28 @@ typedef std::shared_ptr<RenderTexture> RenderTexturePtr;
 class RenderTexture
 {
 public:
-	RenderTexture(int width, int height);
-	RenderTexture(BitmapPtr colorBuffer, BitmapPtr depthBuffer);
+	RenderTexture(int width, int height, Bitmap::Layout layout = Bitmap::Layout_Linear);
+	RenderTexture(BitmapPtr colorBuffer, DepthStencilBufferPtr depthStencilBuffer);
 	
 	int GetWidth() const { return width; }
 	int GetHeight() const { return height; }
+	// the layout of the color buffer, which the g-buffers created for the target share.
+	// the depth stencil buffer is always tiled
+	Bitmap::Layout GetLayout() const { return colorBuffer->GetLayout(); }
 
 	BitmapPtr CreateGBuffer(int index, Bitmap::BitmapType format);
 	void SetGBuffer(int index, BitmapPtr bitmap);
 	void ClearGBuffer(int index);
 
 	BitmapPtr GetColorBuffer() { return colorBuffer; }
-	BitmapPtr GetDepthBuffer() { return depthBuffer; }
+	DepthStencilBufferPtr GetDepthStencilBuffer() { return depthStencilBuffer; }
+	HiZBufferPtr GetHiZBuffer() { return hizBuffer; }
 	BitmapPtr GetGBuffer(int index);
 
 protected:
 	BitmapPtr colorBuffer = nullptr;
-	BitmapPtr depthBuffer = nullptr;
+	DepthStencilBufferPtr depthStencilBuffer = nullptr;
+	HiZBufferPtr hizBuffer = nullptr;
 	BitmapPtr gbuffer0 = nullptr;
 	BitmapPtr gbuffer1 = nullptr;
 	BitmapPtr gbuffer2 = nullptr;
@@ -5,6 +5,7 @@
 #include "math/vector3.h"
 #include "math/mathf.h"
 #include "softrender/texture2d.h"
+#include "softrender/bitmap_view.hpp"
 
 namespace sr
 {
@@ -55,9 +56,10 @@ struct MirrorAddresser
 
 struct PointSampler
 {
-	template<typename XAddresserType, typename YAddresserType>
+	template<typename XAddresserType, typename YAddresserType, Bitmap::BitmapType Format>
 	static Color Sample(const Bitmap& bitmap, float u, float v)
 	{
+		BitmapView<Format> view(bitmap);
 		int width = bitmap.GetWidth();
 		int height = bitmap.GetHeight();
 
@@ -66,15 +68,16 @@ struct PointSampler
 		float fy = YAddresserType::CalcAddress(v, height);
 		int y = YAddresserType::FixAddress(Mathf::RoundToInt(fy), height);
 
-		return bitmap.GetPixel(x, y);
+		return view.GetPixel(x, y);
 	}
 };
 
 struct LinearSampler
 {
-	template<typename XAddresserType, typename YAddresserType>
+	template<typename XAddresserType, typename YAddresserType, Bitmap::BitmapType Format>
 	static Color Sample(const Bitmap& bitmap, float u, float v)
 	{
+		BitmapView<Format> view(bitmap);
 		int width = bitmap.GetWidth();
 		int height = bitmap.GetHeight();
 
@@ -89,10 +92,10 @@ struct LinearSampler
 		int x1 = XAddresserType::FixAddress(x0 + 1, width);
 		int y1 = YAddresserType::FixAddress(y0 + 1, height);
 
-		Color c0 = bitmap.GetPixel(x0, y0);
-		Color c1 = bitmap.GetPixel(x1, y0);
-		Color c2 = bitmap.GetPixel(x0, y1);
-		Color c3 = bitmap.GetPixel(x1, y1);
+		Color c0 = view.GetPixel(x0, y0);
+		Color c1 = view.GetPixel(x1, y0);
+		Color c2 = view.GetPixel(x0, y1);
+		Color c3 = view.GetPixel(x1, y1);
 
 		return Color::Lerp(c0, c1, c2, c3, xFrac, yFrac);
 	}
@@ -6,21 +6,33 @@
 #include "math/vector4.h"
 #include "math/matrix4x4.h"
 #include "math/mathf.h"
+#include "math/vectorx4.h"
 #include "softrender/varying_data.h"
+#include "softrender/light.hpp"
+#include "softrender/uniform_block.hpp"
 
 namespace sr
 {
 
+class LightGrid;
+
 struct IShader;
 typedef std::shared_ptr<IShader> ShaderPtr;
 
 struct IShader
 {
 	int varyingDataSize;
+	// interpolation of the varying members, null when VaryingDataType doesn't list them
+	const std::vector<VaryingElement>* varyingElements = nullptr;
 	rawptr_t varyingData = nullptr;
 
 	// alpha test
 	bool isClipped;
+	// cleared by the default passQuad, the rasterizer then skips the helper lanes of a quad
+	bool needsQuadPass = true;
+
+	// ObjectUniforms::Usage of the derived object matrices the shader reads, the others are left stale
+	uint32_t objectUniformUsage = ObjectUniforms::Usage_All;
 
 	//uniform
 	Matrix4x4 _MATRIX_MVP;
@@ -43,6 +55,12 @@ struct IShader
 	Vector4 _LightAtten; // atten0, atten1, atten2, range
 	Vector3 _SpotLightDir;
 	Vector3 _SpotLightParams; // cos(phi/2), cos(theta/2), falloff
+	// lights of SoftRender::lights reaching the drawn object, the strongest first
+	static const int MAX_LIGHT_COUNT = 8;
+	LightData _Lights[MAX_LIGHT_COUNT];
+	int _LightCount = 0;
+	// lights binned by SoftRender::BuildLightGrid
+	const LightGrid* _LightGrid = nullptr;
 	// uniform time
 	//Vector4 _Time;
 	//Vector4 _SinTime;
@@ -54,9 +72,40 @@ struct IShader
 	Color SV_Target2;
 	Color SV_Target3;
 
-	virtual void _VSMain(const rawptr_t input) = 0;
+	// outputs of the batched fragment shader, lane i is the i-th pixel of the quad
+	Colorx4 SV_Target0x4;
+	Colorx4 SV_Target1x4;
+	Colorx4 SV_Target2x4;
+	Colorx4 SV_Target3x4;
+	// lanes discarded by the batched fragment shader
+	uint8_t clipMask;
+	// cleared by the default fragQuad, quads are then shaded pixel by pixel with _PSMain
+	bool hasQuadFrag = true;
+
+	// re-entrant: reads uniforms only and writes the varying data to output
+	virtual void _VSMain(const rawptr_t input, rawptr_t output) = 0;
 	virtual void _PSMain() = 0;
 	virtual void _PassQuad(const rawptr_t quadVaryingData[4]) {}
+	virtual void _PSMainQuad(const rawptr_t quadVaryingData[4], uint8_t laneMask) { hasQuadFrag = false; }
+
+	// copies uniforms and resources into a new instance of the concrete shader type,
+	// used to give every render thread its own varyingData and SV_Target state
+	typedef ShaderPtr(*CloneFunc)(const IShader& shader);
+
+	template<typename ShaderType>
+	static ShaderPtr Clone(const IShader& shader)
+	{
+		return std::make_shared<ShaderType>(static_cast<const ShaderType&>(shader));
+	}
+
+	// copies uniforms and resources over an earlier clone of the same shader, so a draw reuses it
+	typedef void(*CopyFunc)(IShader& dst, const IShader& src);
+
+	template<typename ShaderType>
+	static void Copy(IShader& dst, const IShader& src)
+	{
+		static_cast<ShaderType&>(dst) = static_cast<const ShaderType&>(src);
+	}
 
 	template<typename Type>
 	static float CalcLod(const Type& ddx, const Type& ddy)
@@ -75,6 +124,13 @@ struct IShader
 		return tex.Sample(uv, ddx, ddy);
 	}
 
+	static Colorx4 Tex2D(const Texture2D& tex, const Vector2x4& uv, float lod = 0.f)
+	{
+		Colorx4 color;
+		for (int i = 0; i < 4; ++i) color.Set(i, tex.Sample(uv.Get(i), lod));
+		return color;
+	}
+
 	static float SampleShadowMap(const Texture2D& tex, const Vector2& uv, float depth, float bias)
 	{
 		return tex.Sample(uv).a + bias < depth ? 1.f : 0.f;
@@ -113,6 +169,11 @@ struct IShader
 		return Vector3(color.r * 2.f - 1.f, color.g * 2.f - 1.f, color.b * 2.f - 1.f);
 	}
 
+	static Vector3x4 UnpackNormal(const Colorx4& color)
+	{
+		return color.rgb * 2.f - Vector3x4(Vector3::one);
+	}
+
 	static Vector3 UnpackNormal(const Color& color, const Matrix4x4& tbn)
 	{
 		Vector3 normal = Vector3(color.r * 2.f - 1.f, color.g * 2.f - 1.f, color.b * 2.f - 1.f);
@@ -129,42 +190,143 @@ struct IShader
 		return isClipped = (x < 0.f);
 	}
 
+	// discards the lanes where x is negative, returns all discarded lanes so far
+	uint8_t Clip(const Floatx4& x)
+	{
+		return clipMask |= (uint8_t)Floatx4::MoveMask(x < 0.f);
+	}
+
+	// member of the varying data of the four quad pixels, as one SoA value
+	template<typename Type>
+	static Floatx4 Gather(const Quad<Type*>& quad, float Type::*member)
+	{
+		return Floatx4(quad.v0->*member, quad.v1->*member, quad.v2->*member, quad.v3->*member);
+	}
+
+	template<typename Type>
+	static Vector2x4 Gather(const Quad<Type*>& quad, Vector2 Type::*member)
+	{
+		const Vector2& v0 = quad.v0->*member;
+		const Vector2& v1 = quad.v1->*member;
+		const Vector2& v2 = quad.v2->*member;
+		const Vector2& v3 = quad.v3->*member;
+		return Vector2x4(Floatx4(v0.x, v1.x, v2.x, v3.x), Floatx4(v0.y, v1.y, v2.y, v3.y));
+	}
+
+	template<typename Type>
+	static Vector3x4 Gather(const Quad<Type*>& quad, Vector3 Type::*member)
+	{
+		const Vector3& v0 = quad.v0->*member;
+		const Vector3& v1 = quad.v1->*member;
+		const Vector3& v2 = quad.v2->*member;
+		const Vector3& v3 = quad.v3->*member;
+		return Vector3x4(Floatx4(v0.x, v1.x, v2.x, v3.x), Floatx4(v0.y, v1.y, v2.y, v3.y), Floatx4(v0.z, v1.z, v2.z, v3.z));
+	}
+
 	void InitLightArgs(const Vector3& worldPos, Vector3& lightDir, Color& lightColor)
 	{
-		lightColor = _LightColor;
-		if (Mathf::Approximately(_WorldSpaceLightPos.w, 0.f))
+		InitLightArgs(_WorldSpaceLightPos, _LightColor, _LightAtten, _SpotLightDir, _SpotLightParams, worldPos, lightDir, lightColor);
+	}
+
+	// the same for a light of the light grid
+	void InitLightArgs(const LightData& light, const Vector3& worldPos, Vector3& lightDir, Color& lightColor)
+	{
+		InitLightArgs(light.worldSpacePos, light.color, light.atten, light.spotDir, light.spotParams, worldPos, lightDir, lightColor);
+	}
+
+	void SetUniforms(const CameraUniforms& camera, const ObjectUniforms& object)
+	{
+		_WorldToCamera = camera.worldToCamera;
+		_CameraToWorld = camera.cameraToWorld;
+		_MATRIX_P = camera.projection;
+		_MATRIX_VP = camera.viewProjection;
+		_WorldSpaceCameraPos = camera.worldSpaceCameraPos;
+		_ScreenParams = camera.screenParams;
+		_ZBufferParams = camera.zBufferParams;
+
+		_Object2World = object.object2World;
+		_World2Object = object.world2Object;
+		_MATRIX_MV = object.mv;
+		_MATRIX_MVP = object.mvp;
+	}
+
+	// calls func(lightDir, lightColor) for every light of _Lights, to shade them all in one pass
+	template<typename LightFunc>
+	void ForEachLight(const Vector3& worldPos, LightFunc func)
+	{
+		for (int i = 0; i < _LightCount; ++i)
+		{
+			Vector3 lightDir;
+			Color lightColor;
+			InitLightArgs(_Lights[i], worldPos, lightDir, lightColor);
+			func(lightDir, lightColor);
+		}
+	}
+
+	static void InitLightArgs(const Vector4& lightPos, const Color& color, const Vector4& atten, const Vector3& spotDir, const Vector3& spotParams,
+		const Vector3& worldPos, Vector3& lightDir, Color& lightColor)
+	{
+		lightColor = color;
+		if (Mathf::Approximately(lightPos.w, 0.f))
 		{
-			lightDir = -_WorldSpaceLightPos.xyz;
+			lightDir = -lightPos.xyz;
 			lightColor *= 1.f;
 		}
 		else
 		{
-			lightDir = _WorldSpaceLightPos.xyz - worldPos;
+			lightDir = lightPos.xyz - worldPos;
 			float distance = lightDir.Length();
 			lightDir /= distance;
 
-			lightColor *= 1.f / (_LightAtten.x + _LightAtten.y * distance + _LightAtten.z * distance * distance);
-			if (_SpotLightParams.x >= 0.f)
+			lightColor *= 1.f / (atten.x + atten.y * distance + atten.z * distance * distance);
+			if (spotParams.x >= 0.f)
 			{
-				float spotLightFactor = ((-_SpotLightDir).Dot(lightDir) - _SpotLightParams.x) / (_SpotLightParams.y - _SpotLightParams.x);
-				spotLightFactor = Mathf::Clamp01(Mathf::Pow(spotLightFactor, _SpotLightParams.z));
+				float spotLightFactor = ((-spotDir).Dot(lightDir) - spotParams.x) / (spotParams.y - spotParams.x);
+				spotLightFactor = Mathf::Clamp01(Mathf::Pow(spotLightFactor, spotParams.z));
 				lightColor *= spotLightFactor;
 			}
 		}
 	}
+
+	void InitLightArgs(const Vector3x4& worldPos, Vector3x4& lightDir, Colorx4& lightColor)
+	{
+		lightColor = Colorx4(_LightColor);
+		if (Mathf::Approximately(_WorldSpaceLightPos.w, 0.f))
+		{
+			lightDir = Vector3x4(-_WorldSpaceLightPos.xyz);
+		}
+		else
+		{
+			lightDir = Vector3x4(_WorldSpaceLightPos.xyz) - worldPos;
+			Floatx4 distance = lightDir.Length();
+			lightDir = lightDir / distance;
+
+			lightColor = lightColor * (Floatx4(1.f) / (Floatx4(_LightAtten.x) + distance * _LightAtten.y + distance * distance * _LightAtten.z));
+			if (_SpotLightParams.x >= 0.f)
+			{
+				Floatx4 spotLightFactor = ((-Vector3x4(_SpotLightDir)).Dot(lightDir) - _SpotLightParams.x) / (_SpotLightParams.y - _SpotLightParams.x);
+				spotLightFactor = Floatx4::Clamp01(Floatx4::Pow(spotLightFactor, _SpotLightParams.z));
+				lightColor = lightColor * spotLightFactor;
+			}
+		}
+	}
 };
 
 template <typename VSInputType, typename VaryingDataType>
 struct Shader : IShader
 {
+	typedef VSInputType VSInput;
+	typedef VaryingDataType VaryingData;
+
 	Shader()
 	{
 		varyingDataSize = sizeof(VaryingDataType);
+		varyingElements = VaryingElementsOf<VaryingDataType>(0);
 	}
 
-	void _VSMain(const rawptr_t input) override
+	void _VSMain(const rawptr_t input, rawptr_t output) override
 	{
-		*((VaryingDataType*)varyingData) = vert(*(VSInputType*)input);
+		*((VaryingDataType*)output) = vert(*(VSInputType*)input);
 	}
 
 	void _PassQuad(const rawptr_t quadVaryingData[4]) override
@@ -182,6 +344,16 @@ struct Shader : IShader
 		frag(*(VaryingDataType*)(varyingData));
 	}
 
+	void _PSMainQuad(const rawptr_t quadVaryingData[4], uint8_t laneMask) override
+	{
+		fragQuad(Quad<VaryingDataType*> {
+				(VaryingDataType*)quadVaryingData[0],
+				(VaryingDataType*)quadVaryingData[1],
+				(VaryingDataType*)quadVaryingData[2],
+				(VaryingDataType*)quadVaryingData[3]
+		}, laneMask);
+	}
+
 	virtual VaryingDataType vert(const VSInputType& input)
 	{
 		VaryingDataType output;
@@ -191,12 +363,85 @@ struct Shader : IShader
 
 	virtual void passQuad(const Quad<VaryingDataType*>& quad)
 	{
+		needsQuadPass = false;
 	}
 
 	virtual void frag(const VaryingDataType& input)
 	{
 		SV_Target0 = Color::clear;
 	}
+
+	// shades the four pixels of a quad at once into SV_Target0x4..3x4. lanes outside laneMask
+	// hold a copy of a live pixel and their outputs are dropped. without an override every
+	// pixel is shaded with frag
+	virtual void fragQuad(const Quad<VaryingDataType*>& quad, uint8_t laneMask)
+	{
+		hasQuadFrag = false;
+	}
+
+private:
+	// the static varyings() of the varying struct if it declares one
+	template<typename Type>
+	static auto VaryingElementsOf(int) -> decltype(&Type::varyings(), (const std::vector<VaryingElement>*)nullptr)
+	{
+		return &Type::varyings();
+	}
+
+	template<typename Type>
+	static const std::vector<VaryingElement>* VaryingElementsOf(...)
+	{
+		return nullptr;
+	}
+};
+
+// the shader entry points the pipeline calls. for a concrete shader type the final overriders
+// are named directly, so vert and frag are resolved at compile time and can be inlined into the
+// vertex and pixel loops. ShaderType has to be the dynamic type of the shader
+template<typename ShaderType>
+struct ShaderStages
+{
+	typedef typename ShaderType::VSInput VSInput;
+	typedef typename ShaderType::VaryingData VaryingData;
+
+	static void VSMain(ShaderType& shader, const rawptr_t input, rawptr_t output)
+	{
+		*((VaryingData*)output) = shader.ShaderType::vert(*(const VSInput*)input);
+	}
+
+	static void PassQuad(ShaderType& shader, const rawptr_t quadVaryingData[4])
+	{
+		shader.ShaderType::passQuad(Quad<VaryingData*> {
+				(VaryingData*)quadVaryingData[0],
+				(VaryingData*)quadVaryingData[1],
+				(VaryingData*)quadVaryingData[2],
+				(VaryingData*)quadVaryingData[3]
+		});
+	}
+
+	static void PSMain(ShaderType& shader)
+	{
+		shader.ShaderType::frag(*(const VaryingData*)(shader.varyingData));
+	}
+
+	static void PSMainQuad(ShaderType& shader, const rawptr_t quadVaryingData[4], uint8_t laneMask)
+	{
+		shader.ShaderType::fragQuad(Quad<VaryingData*> {
+				(VaryingData*)quadVaryingData[0],
+				(VaryingData*)quadVaryingData[1],
+				(VaryingData*)quadVaryingData[2],
+				(VaryingData*)quadVaryingData[3]
+		}, laneMask);
+	}
+};
+
+// shaders only known as IShader go through the virtual entry points
+template<>
+struct ShaderStages<IShader>
+{
+	static void VSMain(IShader& shader, const rawptr_t input, rawptr_t output) { shader._VSMain(input, output); }
+	static void PassQuad(IShader& shader, const rawptr_t quadVaryingData[4]) { shader._PassQuad(quadVaryingData); }
+	static void PSMain(IShader& shader) { shader._PSMain(); }
+	static void PSMainQuad(IShader& shader, const rawptr_t quadVaryingData[4], uint8_t laneMask) { shader._PSMainQuad(quadVaryingData, laneMask); }
 };
 
 } // namespace sr
@@ -6,6 +6,7 @@
 #include "math/vector3.h"
 #include "math/vector4.h"
 #include "math/mathf.h"
+#include "math/vectorx4.h"
 
 namespace sr
 {
@@ -18,6 +19,14 @@ struct LightInput
 	float shininess;
 };
 
+struct LightInputx4
+{
+	Colorx4 ambient;
+	Colorx4 diffuse;
+	Colorx4 specular;
+	Floatx4 shininess;
+};
+
 struct ShaderF
 {
 	static Vector3 LightingLambert(const LightInput& input, const Vector3& normal, const Vector3& lightDir, const Vector3& lightColor)
@@ -60,6 +69,26 @@ struct ShaderF
 			+ input.specular.rgb * lightColor * specular;
 	}
 
+	static Vector3x4 LightingLambert(const LightInputx4& input, const Vector3x4& normal, const Vector3x4& lightDir, const Vector3x4& lightColor)
+	{
+		Floatx4 nDotL = Floatx4::Clamp01(normal.Dot(lightDir));
+		return input.ambient.rgb * input.diffuse.rgb + input.diffuse.rgb * lightColor * nDotL;
+	}
+
+	static Vector3x4 LightingBlinnPhong(const LightInputx4& input, const Vector3x4& normal, const Vector3x4& lightDir, const Vector3x4& lightColor, const Vector3x4& viewDir)
+	{
+		Floatx4 lambertian = Floatx4::Clamp01(normal.Dot(lightDir));
+
+		// every lane takes the highlight path, the ones facing away are masked off after
+		Vector3x4 halfDir = (lightDir + viewDir).Normalize();
+		Floatx4 specAngle = Floatx4::Max(halfDir.Dot(normal), 0.f);
+		Floatx4 specular = Floatx4::Select(lambertian > 0.f, Floatx4::Pow(specAngle, input.shininess * 4.f), 0.f);
+
+		return input.ambient.rgb * input.diffuse.rgb
+			+ input.diffuse.rgb * lightColor * lambertian
+			+ input.specular.rgb * lightColor * specular;
+	}
+
 };
 
 } // namespace sr
@@ -2,49 +2,94 @@
 #include "math/mathf.h"
 #include "freeimage/FreeImage.h"
 #include "sampler.hpp"
+#include "base/job_system.h"
 
 namespace sr
 {
 
-Texture2D::SampleFunc Texture2D::sampleFunc[2][AddressModeCount][AddressModeCount] = {
+// a sample function for every format, read through a BitmapView of it
+#define SAMPLE_FORMATS(Sampler, XAddresser, YAddresser) { nullptr, \
+	Sampler::Sample<XAddresser, YAddresser, Bitmap::BitmapType_Alpha8>, \
+	Sampler::Sample<XAddresser, YAddresser, Bitmap::BitmapType_RGB24>, \
+	Sampler::Sample<XAddresser, YAddresser, Bitmap::BitmapType_RGBA32>, \
+	Sampler::Sample<XAddresser, YAddresser, Bitmap::BitmapType_AlphaFloat>, \
+	Sampler::Sample<XAddresser, YAddresser, Bitmap::BitmapType_RGBFloat>, \
+	Sampler::Sample<XAddresser, YAddresser, Bitmap::BitmapType_RGBAFloat>, \
+	Sampler::Sample<XAddresser, YAddresser, Bitmap::BitmapType_Depth24Stencil8> }
+
+static_assert(Bitmap::BitmapTypeCount == 8, "SAMPLE_FORMATS lists every bitmap type");
+
+Texture2D::SampleFunc Texture2D::sampleFunc[2][AddressModeCount][AddressModeCount][Bitmap::BitmapTypeCount] = {
 	{
 		{
-			PointSampler::Sample < WarpAddresser, WarpAddresser >,
-			PointSampler::Sample < WarpAddresser, MirrorAddresser >,
-			PointSampler::Sample < WarpAddresser, ClampAddresser >
+			SAMPLE_FORMATS(PointSampler, WarpAddresser, WarpAddresser),
+			SAMPLE_FORMATS(PointSampler, WarpAddresser, MirrorAddresser),
+			SAMPLE_FORMATS(PointSampler, WarpAddresser, ClampAddresser)
 		},
 		{
-			PointSampler::Sample < MirrorAddresser, WarpAddresser >,
-			PointSampler::Sample < MirrorAddresser, MirrorAddresser >,
-			PointSampler::Sample < MirrorAddresser, ClampAddresser >
+			SAMPLE_FORMATS(PointSampler, MirrorAddresser, WarpAddresser),
+			SAMPLE_FORMATS(PointSampler, MirrorAddresser, MirrorAddresser),
+			SAMPLE_FORMATS(PointSampler, MirrorAddresser, ClampAddresser)
 		},
 		{
-			PointSampler::Sample < ClampAddresser, WarpAddresser >,
-			PointSampler::Sample < ClampAddresser, MirrorAddresser >,
-			PointSampler::Sample < ClampAddresser, ClampAddresser >
+			SAMPLE_FORMATS(PointSampler, ClampAddresser, WarpAddresser),
+			SAMPLE_FORMATS(PointSampler, ClampAddresser, MirrorAddresser),
+			SAMPLE_FORMATS(PointSampler, ClampAddresser, ClampAddresser)
 		},
 	},
 	{
 		{
-			LinearSampler::Sample < WarpAddresser, WarpAddresser >,
-			LinearSampler::Sample < WarpAddresser, MirrorAddresser >,
-			LinearSampler::Sample < WarpAddresser, ClampAddresser >
+			SAMPLE_FORMATS(LinearSampler, WarpAddresser, WarpAddresser),
+			SAMPLE_FORMATS(LinearSampler, WarpAddresser, MirrorAddresser),
+			SAMPLE_FORMATS(LinearSampler, WarpAddresser, ClampAddresser)
 		},
 		{
-			LinearSampler::Sample < MirrorAddresser, WarpAddresser >,
-			LinearSampler::Sample < MirrorAddresser, MirrorAddresser >,
-			LinearSampler::Sample < MirrorAddresser, ClampAddresser >
+			SAMPLE_FORMATS(LinearSampler, MirrorAddresser, WarpAddresser),
+			SAMPLE_FORMATS(LinearSampler, MirrorAddresser, MirrorAddresser),
+			SAMPLE_FORMATS(LinearSampler, MirrorAddresser, ClampAddresser)
 		},
 		{
-			LinearSampler::Sample < ClampAddresser, WarpAddresser >,
-			LinearSampler::Sample < ClampAddresser, MirrorAddresser >,
-			LinearSampler::Sample < ClampAddresser, ClampAddresser >
+			SAMPLE_FORMATS(LinearSampler, ClampAddresser, WarpAddresser),
+			SAMPLE_FORMATS(LinearSampler, ClampAddresser, MirrorAddresser),
+			SAMPLE_FORMATS(LinearSampler, ClampAddresser, ClampAddresser)
 		},
-	}
+	},
 };
 
 
 
+// row y of a mipmap, each pixel the average of the 2x2 pixels under it in the source level
+template<Bitmap::BitmapType Format>
+static void DownsampleRow(const Bitmap& source, Bitmap& mipmap, int y)
+{
+	BitmapView<Format> src(source);
+	RWBitmapView<Format> dst(mipmap);
+	int y0 = y * 2;
+	int y1 = y0 + 1;
+	for (int x = 0; x < mipmap.GetWidth(); ++x)
+	{
+		int x0 = x * 2;
+		int x1 = x0 + 1;
+		Color c0 = src.GetPixel(x0, y0);
+		Color c1 = src.GetPixel(x1, y0);
+		Color c2 = src.GetPixel(x0, y1);
+		Color c3 = src.GetPixel(x1, y1);
+		dst.SetPixel(x, y, Color::Lerp(c0, c1, c2, c3, 0.5f, 0.5f));
+	}
+}
+
+typedef void(*DownsampleRowFunc)(const Bitmap& source, Bitmap& mipmap, int y);
+static const DownsampleRowFunc downsampleRowFuncs[Bitmap::BitmapTypeCount] = {
+	nullptr,
+	DownsampleRow<Bitmap::BitmapType_Alpha8>,
+	DownsampleRow<Bitmap::BitmapType_RGB24>,
+	DownsampleRow<Bitmap::BitmapType_RGBA32>,
+	DownsampleRow<Bitmap::BitmapType_AlphaFloat>,
+	DownsampleRow<Bitmap::BitmapType_RGBFloat>,
+	DownsampleRow<Bitmap::BitmapType_RGBAFloat>,
+	DownsampleRow<Bitmap::BitmapType_Depth24Stencil8>,
+};
+
 void Texture2D::Initialize()
 {
 	FreeImage_Initialise();
@@ -71,25 +116,30 @@ Texture2DPtr Texture2D::LoadTexture(const std::string& file)
 }
 
 std::map<std::string, Texture2DPtr> Texture2D::texturePool;
+std::mutex Texture2D::texturePoolMutex;
 Texture2DPtr Texture2D::LoadTexture(const char* file)
 {
-	std::map<std::string, Texture2DPtr>::iterator itor;
-	itor = texturePool.find(file);
-	if (itor != texturePool.end())
 	{
-		return itor->second;
-	}
-	else
-	{
-		BitmapPtr bitmap = Bitmap::LoadFromFile(file);
-		Texture2DPtr tex = CreateWithBitmap(bitmap);
-		if (tex != nullptr)
+		std::lock_guard<std::mutex> lock(texturePoolMutex);
+		std::map<std::string, Texture2DPtr>::iterator itor;
+		itor = texturePool.find(file);
+		if (itor != texturePool.end())
 		{
-			tex->file = file;
-			texturePool[file] = tex;
+			return itor->second;
 		}
-		return tex;
 	}
+
+	// decode outside the lock so jobs can load different files at the same time
+	BitmapPtr bitmap = Bitmap::LoadFromFile(file);
+	Texture2DPtr tex = CreateWithBitmap(bitmap);
+	if (tex != nullptr)
+	{
+		tex->file = file;
+		std::lock_guard<std::mutex> lock(texturePoolMutex);
+		auto result = texturePool.insert(std::make_pair(std::string(file), tex));
+		return result.first->second;
+	}
+	return tex;
 }
 
 void Texture2D::ConvertBumpToNormal(float strength/* = 10.f*/)
@@ -143,13 +193,13 @@ const Color Texture2D::Sample(const Vector2& uv, float lod/* = 0.f*/) const
             int miplv = FixMipLevel(Mathf::RoundToInt(lod));
             
 			const Bitmap& bmp = GetBitmapFast(miplv);
-            return sampleFunc[0][xAddressMode][xAddressMode](bmp, uv.x, uv.y);
+            return sampleFunc[0][xAddressMode][xAddressMode][bmp.GetType()](bmp, uv.x, uv.y);
         }
 	case FilterMode_Bilinear:
         {
             int miplv = FixMipLevel(Mathf::RoundToInt(lod));
 			const Bitmap& bmp = GetBitmapFast(miplv);
-            return sampleFunc[1][xAddressMode][xAddressMode](bmp, uv.x, uv.y);
+            return sampleFunc[1][xAddressMode][xAddressMode][bmp.GetType()](bmp, uv.x, uv.y);
         }
 	case FilterMode_Trilinear:
         {
@@ -158,13 +208,13 @@ const Color Texture2D::Sample(const Vector2& uv, float lod/* = 0.f*/) const
             float frac = lod - miplv1;
             
 			const Bitmap& bmp1 = GetBitmapFast(miplv1);
-            Color color1 = sampleFunc[1][xAddressMode][xAddressMode](bmp1, uv.x, uv.y);            
+            Color color1 = sampleFunc[1][xAddressMode][xAddressMode][bmp1.GetType()](bmp1, uv.x, uv.y);            
 			if (miplv1 == miplv2)
 			{
 				return color1;
 			}
 			const Bitmap& bmp2 = GetBitmapFast(miplv2);
-            Color color2 = sampleFunc[1][xAddressMode][xAddressMode](bmp2, uv.x, uv.y);
+            Color color2 = sampleFunc[1][xAddressMode][xAddressMode][bmp2.GetType()](bmp2, uv.x, uv.y);
             return Color::Lerp(color1, color2, frac);
         }
 	}
@@ -181,26 +231,18 @@ bool Texture2D::GenerateMipmaps()
 	
 	mipmaps.clear();
 
+	// the rows are read through views from several threads
+	mainTex->ResolveClears();
 	BitmapPtr source = mainTex;
 	int s = (width >> 1);
 	for (int l = 0;; ++l)
 	{
 		BitmapPtr mipmap = std::make_shared<Bitmap>(s, s, mainTex->GetType());
-		for (int y = 0; y < s; ++y)
+		DownsampleRowFunc downsampleRow = downsampleRowFuncs[mainTex->GetType()];
+		JobSystem::ParallelFor(0, s, MIPMAP_ROWS_PER_JOB, [&source, &mipmap, downsampleRow](int y, int threadIndex)
 		{
-			int y0 = y * 2;
-			int y1 = y0 + 1;
-			for (int x = 0; x < s; ++x)
-			{
-				int x0 = x * 2;
-				int x1 = x0 + 1;
-				Color c0 = source->GetPixel(x0, y0);
-				Color c1 = source->GetPixel(x1, y0);
-				Color c2 = source->GetPixel(x0, y1);
-				Color c3 = source->GetPixel(x1, y1);
-				mipmap->SetPixel(x, y, Color::Lerp(c0, c1, c2, c3, 0.5f, 0.5f));
-			}
-		}
+			downsampleRow(*source, *mipmap, y);
+		});
 
 		mipmaps.emplace_back(mipmap);
 		source = mipmaps[l];
@@ -5,6 +5,7 @@
 #include "softrender/bitmap.h"
 #include "math/color.h"
 #include "math/vector2.h"
+#include <mutex>
 
 namespace sr
 {
@@ -38,10 +39,13 @@ public:
     static Texture2DPtr LoadTexture(const char* file);
 	static Texture2DPtr LoadTexture(const std::string& file);
 	static std::map<std::string, Texture2DPtr> texturePool;
+	static std::mutex texturePoolMutex;
 
 protected:
+	static const int MIPMAP_ROWS_PER_JOB = 16;
+
 	typedef Color(*SampleFunc)(const Bitmap& bitmap, float u, float v);
-	static SampleFunc sampleFunc[2][AddressModeCount][AddressModeCount];
+	static SampleFunc sampleFunc[2][AddressModeCount][AddressModeCount][Bitmap::BitmapTypeCount];
 
 	Texture2D() = default;
 
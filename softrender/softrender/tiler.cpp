@@ -0,0 +1,58 @@
+#include "tiler.h"
+#include "math/mathf.h"
+using namespace sr;
+
+void Tiler::Initialize(int width, int height)
+{
+	if (this->width == width && this->height == height) return;
+
+	this->width = width;
+	this->height = height;
+	tileCountX = (width + TILE_SIZE - 1) >> TILE_SIZE_SHIFT;
+	tileCountY = (height + TILE_SIZE - 1) >> TILE_SIZE_SHIFT;
+
+	tiles.assign(tileCountX * tileCountY, Tile());
+	for (int ty = 0; ty < tileCountY; ++ty)
+	{
+		for (int tx = 0; tx < tileCountX; ++tx)
+		{
+			Tile& tile = tiles[ty * tileCountX + tx];
+			tile.minX = tx << TILE_SIZE_SHIFT;
+			tile.minY = ty << TILE_SIZE_SHIFT;
+			tile.maxX = Mathf::Min(tile.minX + TILE_SIZE, width) - 1;
+			tile.maxY = Mathf::Min(tile.minY + TILE_SIZE, height) - 1;
+		}
+	}
+	activeTiles.clear();
+}
+
+void Tiler::Clear()
+{
+	for (int index : activeTiles)
+	{
+		tiles[index].primitives.clear();
+	}
+	activeTiles.clear();
+}
+
+void Tiler::Bin(int primitive, int minX, int minY, int maxX, int maxY)
+{
+	assert(minX >= 0 && maxX < width);
+	assert(minY >= 0 && maxY < height);
+
+	int tileMinX = minX >> TILE_SIZE_SHIFT;
+	int tileMinY = minY >> TILE_SIZE_SHIFT;
+	int tileMaxX = maxX >> TILE_SIZE_SHIFT;
+	int tileMaxY = maxY >> TILE_SIZE_SHIFT;
+
+	for (int ty = tileMinY; ty <= tileMaxY; ++ty)
+	{
+		for (int tx = tileMinX; tx <= tileMaxX; ++tx)
+		{
+			int index = ty * tileCountX + tx;
+			std::vector<int>& primitives = tiles[index].primitives;
+			if (primitives.empty()) activeTiles.push_back(index);
+			primitives.push_back(primitive);
+		}
+	}
+}
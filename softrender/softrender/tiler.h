@@ -0,0 +1,49 @@
+#ifndef _SOFTRENDER_TILER_H_
+#define _SOFTRENDER_TILER_H_
+
+#include "base/header.h"
+
+namespace sr
+{
+
+struct Tile
+{
+	int minX = 0;
+	int minY = 0;
+	int maxX = 0;
+	int maxY = 0;
+
+	// primitive indices in submission order
+	std::vector<int> primitives;
+};
+
+class Tiler
+{
+public:
+	static const int TILE_SIZE_SHIFT = 6;
+	static const int TILE_SIZE = (1 << TILE_SIZE_SHIFT);
+
+	Tiler() = default;
+
+	void Initialize(int width, int height);
+	void Clear();
+
+	// bounding box in pixels, inclusive and already clamped to the render target
+	void Bin(int primitive, int minX, int minY, int maxX, int maxY);
+
+	int GetActiveTileCount() const { return (int)activeTiles.size(); }
+	const Tile& GetActiveTile(int index) const { return tiles[activeTiles[index]]; }
+
+private:
+	int width = 0;
+	int height = 0;
+	int tileCountX = 0;
+	int tileCountY = 0;
+
+	std::vector<Tile> tiles;
+	std::vector<int> activeTiles;
+};
+
+}
+
+#endif //! _SOFTRENDER_TILER_H_
@@ -0,0 +1,109 @@
+#ifndef _SOFTRENDER_UNIFORM_BLOCK_HPP_
+#define _SOFTRENDER_UNIFORM_BLOCK_HPP_
+
+#include "base/header.h"
+#include <cstring>
+#include "math/vector3.h"
+#include "math/vector4.h"
+#include "math/matrix4x4.h"
+#include "softrender/camera.h"
+
+namespace sr
+{
+
+// uniforms shared by every draw of a camera into a render target,
+// rebuilt only when the camera moves or its projection or the target size changes
+struct CameraUniforms
+{
+	Matrix4x4 worldToCamera;
+	Matrix4x4 cameraToWorld;
+	Matrix4x4 projection;
+	Matrix4x4 viewProjection;
+	Vector3 worldSpaceCameraPos;
+	Vector4 screenParams;
+	Vector4 zBufferParams;
+
+	// bumped every time the block is rebuilt
+	uint32_t version = 0;
+
+	void Setup(const Camera& camera, int width, int height)
+	{
+		Matrix4x4 localToWorld = camera.transform.localToWorldMatrix();
+		Matrix4x4 projectionMatrix = camera.projectionMatrix();
+		if (isValid && width == this->width && height == this->height
+			&& memcmp(cameraToWorld.m, localToWorld.m, sizeof(cameraToWorld.m)) == 0
+			&& memcmp(projection.m, projectionMatrix.m, sizeof(projection.m)) == 0
+			&& zBufferParams.x == camera.zFar() && zBufferParams.y == camera.zNear())
+		{
+			return;
+		}
+
+		isValid = true;
+		++version;
+		this->width = width;
+		this->height = height;
+		cameraToWorld = localToWorld;
+		// the camera transform is a TRS
+		worldToCamera = localToWorld.InverseAffine();
+		projection = projectionMatrix;
+		viewProjection = projection.Multiply(worldToCamera);
+		worldSpaceCameraPos = camera.transform.position;
+		screenParams = Vector4((float)width, (float)height, 1.f + 1.f / (float)width, 1.f + 1.f / (float)height);
+		zBufferParams = Vector4(camera.zFar(), camera.zNear(), 0.f, 0.f);
+	}
+
+private:
+	bool isValid = false;
+	int width = 0;
+	int height = 0;
+};
+
+// uniforms of a drawn object, derived from its model matrix and the camera block.
+// the derived matrices are only computed when the shader lists them in its usage
+struct ObjectUniforms
+{
+	enum Usage
+	{
+		Usage_World2Object = 1 << 0,
+		Usage_MV = 1 << 1,
+		Usage_MVP = 1 << 2,
+		Usage_All = Usage_World2Object | Usage_MV | Usage_MVP,
+	};
+
+	Matrix4x4 object2World;
+	Matrix4x4 world2Object;
+	Matrix4x4 mv;
+	Matrix4x4 mvp;
+
+	void Setup(const Matrix4x4& modelMatrix, const CameraUniforms& camera, uint32_t usage)
+	{
+		bool modelChanged = !isValid || memcmp(object2World.m, modelMatrix.m, sizeof(object2World.m)) != 0;
+		if (modelChanged)
+		{
+			isValid = true;
+			object2World = modelMatrix;
+			validUsage = 0;
+		}
+		else if (cameraVersion != camera.version)
+		{
+			validUsage &= Usage_World2Object;
+		}
+		cameraVersion = camera.version;
+
+		uint32_t missing = usage & ~validUsage;
+		// modelMatrix is set by the user and may carry a projection
+		if (missing & Usage_World2Object) world2Object = object2World.IsAffine() ? object2World.InverseAffine() : object2World.Inverse();
+		if (missing & Usage_MV) mv = camera.worldToCamera.Multiply(object2World);
+		if (missing & Usage_MVP) mvp = camera.viewProjection.Multiply(object2World);
+		validUsage |= usage;
+	}
+
+private:
+	bool isValid = false;
+	uint32_t cameraVersion = 0;
+	uint32_t validUsage = 0;
+};
+
+} // namespace sr
+
+#endif // !_SOFTRENDER_UNIFORM_BLOCK_HPP_
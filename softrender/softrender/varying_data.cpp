@@ -1,4 +1,5 @@
 #include "varying_data.h"
+#include <cstring>
 using namespace sr;
 
 void VaryingDataBuffer::InitVerticesVaryingData(int vertexCount)
@@ -34,6 +35,33 @@ void VaryingDataBuffer::ResetDynamicVaryingData()
 	dynamicVaryingDataBuffer.itor.Seek(0);
 }
 
+void VaryingDataBuffer::InitTrianglePlaneData()
+{
+	trianglePlaneDataBuffer.Initialize(2 * varyingDataSize, true);
+	trianglePlaneDataBuffer.Alloc(1);
+}
+
+rawptr_t VaryingDataBuffer::CreateTrianglePlaneData()
+{
+	return trianglePlaneDataBuffer.itor.Get();
+}
+
+void VaryingDataBuffer::ResetTrianglePlaneData()
+{
+	trianglePlaneDataBuffer.itor.Seek(0);
+}
+
+void VaryingDataBuffer::SetupTrianglePlaneData(rawptr_t planes, const Triangle<VertexVaryingData>& triangle) const
+{
+	for (auto& span : varyingSpans)
+	{
+		if (span.qualifier != VaryingElement::Qualifier_Perspective && span.qualifier != VaryingElement::Qualifier_NoPerspective) continue;
+
+		VertexVaryingData::TrianglePlaneSetupValue(planes + span.offset, planes + varyingDataSize + span.offset,
+			triangle.v0.data + span.offset, triangle.v1.data + span.offset, triangle.v2.data + span.offset, span.size);
+	}
+}
+
 void VaryingDataBuffer::InitPixelVaryingData(int slot)
 {
 	pixelVaryingDataBuffer.Initialize(varyingDataSize, false);
@@ -46,9 +74,37 @@ void VaryingDataBuffer::InitPixelVaryingData(int slot)
 	}
 }
 
-void VaryingDataBuffer::InitVaryingDataBuffer(int varyingDataSize)
+void VaryingDataBuffer::InitVaryingDataBuffer(int varyingDataSize, const std::vector<VaryingElement>* varyingElements)
 {
 	this->varyingDataSize = varyingDataSize;
+	this->varyingElements = varyingElements;
+
+	varyingSpans.clear();
+	hasNoPerspective = false;
+	hasFlat = false;
+	if (varyingElements == nullptr)
+	{
+		varyingSpans.push_back(VaryingSpan{ 0, varyingDataSize, VaryingElement::Qualifier_Perspective });
+		return;
+	}
+
+	int offset = 0;
+	for (auto& element : *varyingElements)
+	{
+		assert(element.size % sizeof(float) == 0);
+		if (!varyingSpans.empty() && varyingSpans.back().qualifier == element.qualifier)
+		{
+			varyingSpans.back().size += element.size;
+		}
+		else
+		{
+			varyingSpans.push_back(VaryingSpan{ offset, element.size, element.qualifier });
+		}
+		hasNoPerspective |= (element.qualifier == VaryingElement::Qualifier_NoPerspective);
+		hasFlat |= (element.qualifier == VaryingElement::Qualifier_Flat);
+		offset += element.size;
+	}
+	assert(offset == varyingDataSize);
 }
 
 int VaryingDataBuffer::GetVaryingDataSize() const
@@ -72,21 +128,107 @@ VertexVaryingData VertexVaryingData::LinearInterp(const VertexVaryingData& a, co
 	VertexVaryingData output(varyingDataBuffer);
 	output.data = varyingDataBuffer->CreateDynamicVaryingData();
 	assert(output.data != nullptr);
-	LinearInterpValue(output.data, a.data, b.data, varyingDataBuffer->GetVaryingDataSize(), t);
+	const int positionSize = (int)sizeof(Vector4);
+	LinearInterpValue(output.data, a.data, b.data, positionSize, t);
 	output.position = *Buffer::Value<Vector4>(output.data, 0);
 	output.clipCode = Clipper::CalculateClipCode(output.position);
+
+	for (auto& span : varyingDataBuffer->varyingSpans)
+	{
+		// the position is done above whatever it is qualified with
+		int offset = Mathf::Max(span.offset, positionSize);
+		int size = span.offset + span.size - offset;
+		if (size <= 0) continue;
+
+		switch (span.qualifier)
+		{
+		case VaryingElement::Qualifier_Perspective:
+			LinearInterpValue(output.data + offset, a.data + offset, b.data + offset, size, t);
+			break;
+		case VaryingElement::Qualifier_NoPerspective:
+			// the clip space t mapped to screen space along the edge
+			LinearInterpValue(output.data + offset, a.data + offset, b.data + offset, size, t * b.position.w / output.position.w);
+			break;
+		case VaryingElement::Qualifier_Flat:
+			memcpy(output.data + offset, a.data + offset, size);
+			break;
+		case VaryingElement::Qualifier_Unused:
+		default:
+			break;
+		}
+	}
 	return output;
 }
 
-rawptr_t VertexVaryingData::TriangleInterp(int slotIndex, const VertexVaryingData& v0, const VertexVaryingData& v1, const VertexVaryingData& v2, float x, float y, float z)
+VertexVaryingData VertexVaryingData::WithFlatOf(const VertexVaryingData& v, const VertexVaryingData& provoking)
 {
-	assert(v0.varyingDataBuffer != nullptr);
-	assert(v0.varyingDataBuffer == v1.varyingDataBuffer && v0.varyingDataBuffer == v2.varyingDataBuffer);
+	assert(v.varyingDataBuffer != nullptr);
+	assert(v.varyingDataBuffer == provoking.varyingDataBuffer);
+
+	auto varyingDataBuffer = v.varyingDataBuffer;
+	if (!varyingDataBuffer->hasFlat || v.data == provoking.data) return v;
+
+	VertexVaryingData output = v;
+	output.data = varyingDataBuffer->CreateDynamicVaryingData();
+	assert(output.data != nullptr);
+	memcpy(output.data, v.data, varyingDataBuffer->varyingDataSize);
+
+	const int positionSize = (int)sizeof(Vector4);
+	for (auto& span : varyingDataBuffer->varyingSpans)
+	{
+		if (span.qualifier != VaryingElement::Qualifier_Flat) continue;
 
-	auto varyingDataBuffer = v0.varyingDataBuffer;
+		// the position stays the one of v
+		int offset = Mathf::Max(span.offset, positionSize);
+		int size = span.offset + span.size - offset;
+		if (size <= 0) continue;
+
+		memcpy(output.data + offset, provoking.data + offset, size);
+	}
+	return output;
+}
+
+rawptr_t VertexVaryingData::TrianglePlaneInterp(int slotIndex, const Triangle<VertexVaryingData>& triangle, const rawptr_t planes, float x, float y, float z)
+{
+	assert(triangle.v0.varyingDataBuffer != nullptr);
+
+	auto varyingDataBuffer = triangle.v0.varyingDataBuffer;
 	rawptr_t data = varyingDataBuffer->GetPixelVaryingData(slotIndex).data;
 	assert(data != nullptr);
-	TriangleInterpValue(data, v0.data, v1.data, v2.data, varyingDataBuffer->GetVaryingDataSize(), x, y, z);
+
+	int varyingDataSize = varyingDataBuffer->GetVaryingDataSize();
+	float screenY = y, screenZ = z;
+	if (varyingDataBuffer->hasNoPerspective)
+	{
+		// undo the 1/w of the perspective correct weights
+		float screenX = x * triangle.v0.position.w;
+		screenY = y * triangle.v1.position.w;
+		screenZ = z * triangle.v2.position.w;
+		float invSum = 1.f / (screenX + screenY + screenZ);
+		screenY *= invSum;
+		screenZ *= invSum;
+	}
+
+	const rawptr_t a = triangle.v0.data;
+	for (auto& span : varyingDataBuffer->varyingSpans)
+	{
+		int offset = span.offset;
+		switch (span.qualifier)
+		{
+		case VaryingElement::Qualifier_Perspective:
+			TrianglePlaneValue(data + offset, a + offset, planes + offset, planes + varyingDataSize + offset, span.size, y, z);
+			break;
+		case VaryingElement::Qualifier_NoPerspective:
+			TrianglePlaneValue(data + offset, a + offset, planes + offset, planes + varyingDataSize + offset, span.size, screenY, screenZ);
+			break;
+		case VaryingElement::Qualifier_Flat:
+			memcpy(data + offset, a + offset, span.size);
+			break;
+		case VaryingElement::Qualifier_Unused:
+		default:
+			break;
+		}
+	}
 	return data;
 }
 
@@ -109,3 +251,38 @@ void VertexVaryingData::TriangleInterpValue(rawptr_t output, const rawptr_t a, c
 		offset += sizeof(float);
 	}
 }
+
+void VertexVaryingData::TrianglePlaneSetupValue(rawptr_t dy, rawptr_t dz, const rawptr_t a, const rawptr_t b, const rawptr_t c, int size)
+{
+	int offset = 0;
+	while (offset < size)
+	{
+		float value = *Buffer::Value<float>(a, offset);
+		*Buffer::Value<float>(dy, offset) = *Buffer::Value<float>(b, offset) - value;
+		*Buffer::Value<float>(dz, offset) = *Buffer::Value<float>(c, offset) - value;
+		offset += sizeof(float);
+	}
+}
+
+void VertexVaryingData::TrianglePlaneValue(rawptr_t output, const rawptr_t a, const rawptr_t dy, const rawptr_t dz, int size, float y, float z)
+{
+	int offset = 0;
+#ifdef _MATH_SIMD_INTRINSIC_
+	// four floats of the struct at a time, varying structs are only float aligned
+	__m128 mf_y = _mm_set1_ps(y);
+	__m128 mf_z = _mm_set1_ps(z);
+	for (; offset + 4 * (int)sizeof(float) <= size; offset += 4 * sizeof(float))
+	{
+		__m128 mf_a = _mm_loadu_ps(Buffer::Value<float>(a, offset));
+		__m128 mf_dy = _mm_loadu_ps(Buffer::Value<float>(dy, offset));
+		__m128 mf_dz = _mm_loadu_ps(Buffer::Value<float>(dz, offset));
+		_mm_storeu_ps(Buffer::Value<float>(output, offset), _mm_add_ps(_mm_add_ps(mf_a, _mm_mul_ps(mf_dy, mf_y)), _mm_mul_ps(mf_dz, mf_z)));
+	}
+#endif
+	while (offset < size)
+	{
+		*Buffer::Value<float>(output, offset) = *Buffer::Value<float>(a, offset)
+			+ *Buffer::Value<float>(dy, offset) * y + *Buffer::Value<float>(dz, offset) * z;
+		offset += sizeof(float);
+	}
+}
@@ -12,6 +12,32 @@
 namespace sr
 {
 
+// how a member of the varying data is interpolated across the triangle. a VaryingDataType may list
+// its members in order with a static varyings(), like Vertex::elements() lists the vertex layout.
+// without the list every float is perspective interpolated
+struct VaryingElement
+{
+	enum Qualifier
+	{
+		Qualifier_Perspective = 0,
+		// linear in screen space
+		Qualifier_NoPerspective,
+		// the value of the first vertex of the triangle, the provoking one,
+		// which the clipper hands down to every triangle it cuts it into
+		Qualifier_Flat,
+		// not read by the fragment shader, left undefined in the pixel varyings
+		Qualifier_Unused,
+	};
+
+	Qualifier qualifier;
+	int size;
+
+	template<typename Type> static VaryingElement Perspective() { return VaryingElement{ Qualifier_Perspective, sizeof(Type) }; }
+	template<typename Type> static VaryingElement NoPerspective() { return VaryingElement{ Qualifier_NoPerspective, sizeof(Type) }; }
+	template<typename Type> static VaryingElement Flat() { return VaryingElement{ Qualifier_Flat, sizeof(Type) }; }
+	template<typename Type> static VaryingElement Unused() { return VaryingElement{ Qualifier_Unused, sizeof(Type) }; }
+};
+
 class VaryingDataBuffer;
 struct VertexVaryingData
 {
@@ -24,11 +50,20 @@ struct VertexVaryingData
 
 	VertexVaryingData() = default;
 	explicit VertexVaryingData(VaryingDataBuffer* _varyingDataBuffer) : varyingDataBuffer(_varyingDataBuffer) {}
+	// the position is always interpolated, the clipper needs it
 	static VertexVaryingData LinearInterp(const VertexVaryingData& a, const VertexVaryingData& b, float t);
-	static rawptr_t TriangleInterp(int slot, const VertexVaryingData& v0, const VertexVaryingData& v1, const VertexVaryingData& v2, float x, float y, float z);
+	// v with the flat members of provoking, a copy when they differ
+	static VertexVaryingData WithFlatOf(const VertexVaryingData& v, const VertexVaryingData& provoking);
+	// varyings of a pixel from the planes set up for its triangle, x, y and z are the perspective correct weights
+	static rawptr_t TrianglePlaneInterp(int slot, const Triangle<VertexVaryingData>& triangle, const rawptr_t planes, float x, float y, float z);
 
 	static void LinearInterpValue(rawptr_t output, const rawptr_t a, const rawptr_t b, int size, float t);
 	static void TriangleInterpValue(rawptr_t output, const rawptr_t a, const rawptr_t b, const rawptr_t c, int size, float x, float y, float z);
+
+	// triangle setup: a float of the varyings as a + (b - a) * y + (c - a) * z over the triangle weights,
+	// which equals TriangleInterpValue as the weights sum to one. dy holds b - a and dz holds c - a
+	static void TrianglePlaneSetupValue(rawptr_t dy, rawptr_t dz, const rawptr_t a, const rawptr_t b, const rawptr_t c, int size);
+	static void TrianglePlaneValue(rawptr_t output, const rawptr_t a, const rawptr_t dy, const rawptr_t dz, int size, float y, float z);
 };
 
 class VaryingDataBuffer
@@ -36,23 +71,45 @@ class VaryingDataBuffer
 public:
 	VaryingDataBuffer() = default;
 
-	void InitVaryingDataBuffer(int varyingDataSize);
+	// varyingElements may be null, the whole struct is then perspective interpolated
+	void InitVaryingDataBuffer(int varyingDataSize, const std::vector<VaryingElement>* varyingElements = nullptr);
 	void InitVerticesVaryingData(int vertexCount);
 	VertexVaryingData& GetVertexVaryingData(int index);
 	void InitDynamicVaryingData();
 	rawptr_t CreateDynamicVaryingData();
 	void ResetDynamicVaryingData();
+	// planes of the triangles set up for a draw, kept until its tiles are rendered
+	void InitTrianglePlaneData();
+	rawptr_t CreateTrianglePlaneData();
+	void ResetTrianglePlaneData();
+	// the planes of the interpolated members, the flat and unused ones are skipped
+	void SetupTrianglePlaneData(rawptr_t planes, const Triangle<VertexVaryingData>& triangle) const;
 	void InitPixelVaryingData(int slot);
 	VertexVaryingData& GetPixelVaryingData(int slot);
 
 	int GetVaryingDataSize() const;
 
 private:
+	friend struct VertexVaryingData;
+
+	// consecutive members of the same qualifier
+	struct VaryingSpan
+	{
+		int offset;
+		int size;
+		VaryingElement::Qualifier qualifier;
+	};
+
 	int varyingDataSize = 0;
+	const std::vector<VaryingElement>* varyingElements = nullptr;
+	std::vector<VaryingSpan> varyingSpans;
+	bool hasNoPerspective = false;
+	bool hasFlat = false;
 	std::vector<VertexVaryingData> vertexVaryingData;
 	std::vector<VertexVaryingData> pixelVaryingData;
 	Buffer vertexVaryingDataBuffer;
 	Buffer dynamicVaryingDataBuffer;
+	Buffer trianglePlaneDataBuffer;
 	Buffer pixelVaryingDataBuffer;
 };
 
@@ -0,0 +1,61 @@
+#ifndef _SOFTRENDER_VISIBILITY_BUFFER_H_
+#define _SOFTRENDER_VISIBILITY_BUFFER_H_
+
+#include "base/header.h"
+
+namespace sr
+{
+
+class VisibilityBuffer;
+typedef std::shared_ptr<VisibilityBuffer> VisibilityBufferPtr;
+
+// the draw and triangle that won the depth test of every pixel in a visibility pass
+class VisibilityBuffer
+{
+public:
+	static const uint32_t INVALID_ID = 0xFFFFFFFF;
+	static const int TRIANGLE_BITS = 20;
+	static const int MAX_DRAW_COUNT = (1 << (32 - TRIANGLE_BITS)) - 1;
+	static const int MAX_TRIANGLE_COUNT = (1 << TRIANGLE_BITS);
+
+	VisibilityBuffer(int width, int height) : width(width), height(height), ids(width * height, INVALID_ID)
+	{
+	}
+
+	static uint32_t MakeID(int draw, int triangle)
+	{
+		assert(draw >= 0 && draw < MAX_DRAW_COUNT);
+		assert(triangle >= 0 && triangle < MAX_TRIANGLE_COUNT);
+		return ((uint32_t)draw << TRIANGLE_BITS) | (uint32_t)triangle;
+	}
+
+	static int GetDraw(uint32_t id) { return (int)(id >> TRIANGLE_BITS); }
+	static int GetTriangle(uint32_t id) { return (int)(id & (MAX_TRIANGLE_COUNT - 1)); }
+
+	void Clear()
+	{
+		std::fill(ids.begin(), ids.end(), INVALID_ID);
+	}
+
+	uint32_t GetID(int x, int y) const
+	{
+		return ids[y * width + x];
+	}
+
+	void SetID(int x, int y, uint32_t id)
+	{
+		ids[y * width + x] = id;
+	}
+
+	int GetWidth() const { return width; }
+	int GetHeight() const { return height; }
+
+private:
+	int width;
+	int height;
+	std::vector<uint32_t> ids;
+};
+
+} // namespace sr
+
+#endif // !_SOFTRENDER_VISIBILITY_BUFFER_H_
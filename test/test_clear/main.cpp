@@ -0,0 +1,181 @@
+#include "softrender.h"
+#include "object_utilities.h"
+using namespace sr;
+
+// headless: draws the same frames into a target the fast clears of SoftRender::Clear leave pending
+// and into one written through Fill and SetPixel, and compares their pixels. the target size isn't
+// a multiple of the tile size, and the rect clear covers some tiles whole and cuts the others
+
+struct Vertex
+{
+	Vector3 position;
+	Vector3 normal;
+
+	static const std::vector<Mesh::VertexElement>& elements()
+	{
+		static std::vector<Mesh::VertexElement> _elements
+		{
+			Mesh::VertexElement_Position,
+			Mesh::VertexElement_Normal,
+		};
+
+		return _elements;
+	}
+};
+
+struct V2F
+{
+	Vector4 position;
+	Vector3 normal;
+
+	static const std::vector<VaryingElement>& varyings()
+	{
+		static std::vector<VaryingElement> _varyings
+		{
+			VaryingElement::Unused<Vector4>(),
+			VaryingElement::Perspective<Vector3>(),
+		};
+
+		return _varyings;
+	}
+};
+
+struct NormalShader : Shader<Vertex, V2F>
+{
+	NormalShader()
+	{
+		objectUniformUsage = ObjectUniforms::Usage_MVP;
+	}
+
+	V2F vert(const Vertex& input) override
+	{
+		V2F output;
+		output.position = _MATRIX_MVP.MultiplyPoint(input.position);
+		output.normal = _Object2World.MultiplyVector(input.normal);
+		return output;
+	}
+
+	void frag(const V2F& input) override
+	{
+		Vector3 normal = input.normal.Normalize();
+		SV_Target0 = Color(1.f, normal.x * 0.5f + 0.5f, normal.y * 0.5f + 0.5f, normal.z * 0.5f + 0.5f);
+	}
+};
+
+const int width = 300;
+const int height = 200;
+const Color backgroundColor = Color(1.f, 0.19f, 0.3f, 0.47f);
+const Color rectColor = Color(1.f, 0.6f, 0.2f, 0.1f);
+const float rectDepth = 0.9f;
+// inclusive, the tiles (1, 1) and (2, 1) are covered whole
+const int rectMinX = 40, rectMinY = 30, rectMaxX = 250, rectMaxY = 170;
+
+MeshPtr cube;
+std::shared_ptr<NormalShader> shader;
+
+void DrawCubes(float angle)
+{
+	SoftRender::SetShader(shader);
+	SoftRender::renderData.AssetVerticesIndicesBuffer<Vertex>(*cube);
+	for (int i = 0; i < 9; ++i)
+	{
+		Vector3 position((i % 3 - 1) * 2.5f, (i / 3 - 1) * 1.5f, (float)(i % 2));
+		SoftRender::modelMatrix = Matrix4x4::TRS(position, Quaternion(Vector3(angle, angle * 2.f, 0.f)), Vector3::one);
+		SoftRender::Draw<NormalShader>();
+	}
+}
+
+// the frame of the fast cleared target
+void RenderCleared(bool isRectCleared)
+{
+	SoftRender::Clear(true, true, backgroundColor);
+	DrawCubes(30.f);
+	if (!isRectCleared) return;
+
+	SoftRender::Clear(rectMinX, rectMinY, rectMaxX, rectMaxY, true, true, rectColor, rectDepth);
+	DrawCubes(60.f);
+}
+
+// the same frame with every cleared pixel written on the spot. the clears are still issued for
+// the HiZ and occluder bookkeeping of SoftRender, and resolved before the pixels are overwritten
+void RenderFilled(bool isRectCleared)
+{
+	BitmapPtr colorBuffer = SoftRender::GetRenderTarget()->GetColorBuffer();
+	DepthStencilBufferPtr depthStencilBuffer = SoftRender::GetDepthStencilBuffer();
+
+	SoftRender::Clear(true, true, backgroundColor);
+	colorBuffer->Fill(backgroundColor);
+	depthStencilBuffer->Fill(Color(1.f, 1.f, 1.f, 1.f));
+	DrawCubes(30.f);
+	if (!isRectCleared) return;
+
+	SoftRender::Clear(rectMinX, rectMinY, rectMaxX, rectMaxY, true, true, rectColor, rectDepth);
+	colorBuffer->ResolveClears();
+	depthStencilBuffer->ResolveClears();
+	uint32_t depthValue = DepthStencilBuffer::FormatType::Pack(rectDepth, 0);
+	for (int y = rectMinY; y <= rectMaxY; ++y)
+	{
+		for (int x = rectMinX; x <= rectMaxX; ++x)
+		{
+			colorBuffer->SetPixel(x, y, rectColor);
+			uint32_t& pixel = *(uint32_t*)depthStencilBuffer->GetPixelAddress(x, y);
+			pixel = depthValue | (pixel & DepthStencilBuffer::FormatType::STENCIL_MASK);
+		}
+	}
+	DrawCubes(60.f);
+}
+
+// the pixels where the color or the depth stencil of the two targets differ
+int CountDifferences(RenderTexturePtr a, RenderTexturePtr b)
+{
+	int count = 0;
+	for (int y = 0; y < height; ++y)
+	{
+		for (int x = 0; x < width; ++x)
+		{
+			Color colorA = a->GetColorBuffer()->GetPixel(x, y);
+			Color colorB = b->GetColorBuffer()->GetPixel(x, y);
+			if (memcmp(&colorA, &colorB, sizeof(Color)) != 0
+				|| a->GetDepthStencilBuffer()->GetValue(x, y) != b->GetDepthStencilBuffer()->GetValue(x, y))
+			{
+				++count;
+			}
+		}
+	}
+	return count;
+}
+
+int main(int argc, char *argv[])
+{
+	SoftRender::Initialize(width, height);
+
+	CameraPtr camera = CameraPtr(new Camera());
+	camera->SetPerspective(60.f, (float)width / height, 0.3f, 100.f);
+	camera->transform.position = Vector3(0.f, 0.f, -6.f);
+	SoftRender::camera = camera;
+
+	cube = CreateCube();
+	shader = std::make_shared<NormalShader>();
+
+	int failedCount = 0;
+	for (Bitmap::Layout layout : { Bitmap::Layout_Linear, Bitmap::Layout_Tiled })
+	{
+		for (bool isRectCleared : { false, true })
+		{
+			RenderTexturePtr cleared = std::make_shared<RenderTexture>(width, height, layout);
+			RenderTexturePtr filled = std::make_shared<RenderTexture>(width, height, layout);
+
+			// nothing is presented, the pixels the draws didn't touch are resolved when they're read
+			SoftRender::SetRenderTarget(cleared);
+			RenderCleared(isRectCleared);
+			SoftRender::SetRenderTarget(filled);
+			RenderFilled(isRectCleared);
+
+			int differences = CountDifferences(cleared, filled);
+			printf("%s layout, %s: %d pixels differ\n", layout == Bitmap::Layout_Linear ? "linear" : "tiled",
+				isRectCleared ? "rect clear" : "clear", differences);
+			if (differences != 0) ++failedCount;
+		}
+	}
+	return failedCount == 0 ? 0 : 1;
+}
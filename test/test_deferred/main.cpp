@@ -49,6 +49,21 @@ struct V2F
 	Vector3 tSpace1;
 	Vector3 tSpace2;
 	Vector2 texcoord;
+
+	static const std::vector<VaryingElement>& varyings()
+	{
+		static std::vector<VaryingElement> _varyings
+		{
+			VaryingElement::Unused<Vector4>(),
+			VaryingElement::Perspective<Vector3>(),
+			VaryingElement::Perspective<Vector3>(),
+			VaryingElement::Perspective<Vector3>(),
+			VaryingElement::Perspective<Vector3>(),
+			VaryingElement::Perspective<Vector2>()
+		};
+
+		return _varyings;
+	}
 };
 
 struct GBufferPass : Shader<Vertex, V2F>
@@ -56,6 +71,11 @@ struct GBufferPass : Shader<Vertex, V2F>
 	Texture2DPtr diffuseMap;
 	Texture2DPtr normalMap;
 
+	GBufferPass()
+	{
+		objectUniformUsage = ObjectUniforms::Usage_MVP;
+	}
+
 	V2F vert(const Vertex& input) override
 	{
 		V2F output;
@@ -105,6 +125,16 @@ struct LightVertex
 struct LightV2F
 {
 	Vector4 position;
+
+	static const std::vector<VaryingElement>& varyings()
+	{
+		static std::vector<VaryingElement> _varyings
+		{
+			VaryingElement::Unused<Vector4>()
+		};
+
+		return _varyings;
+	}
 };
 
 struct LightShadeV2F
@@ -119,6 +149,13 @@ struct LightShadePass : Shader<LightVertex, LightShadeV2F>
 	Texture2DPtr specularGBuffer;
 	Texture2DPtr normalGBuffer;
 	Texture2DPtr _CameraDepthTexture;
+	// the lights of the pixel's cluster, or else the light of the draw
+	bool isClustered = true;
+
+	LightShadePass()
+	{
+		objectUniformUsage = ObjectUniforms::Usage_MVP | ObjectUniforms::Usage_MV;
+	}
 
 	LightShadeV2F vert(const LightVertex& input) override
 	{
@@ -141,16 +178,37 @@ struct LightShadePass : Shader<LightVertex, LightShadeV2F>
 		lightInput.shininess = 10.f;
 		Vector3 worldNormal = UnpackNormal(Tex2D(*normalGBuffer, screenCoord));
 		float depth = Tex2D(*_CameraDepthTexture, screenCoord).a;
+		// background
+		if (depth >= 1.f)
+		{
+			SV_Target0 = Color::clear;
+			return;
+		}
 		Vector3 viewPos = input.ray * (depth * _ZBufferParams.x / input.ray.z);
 		Vector3 worldPos = _CameraToWorld.MultiplyPoint(viewPos).xyz;
 		Vector3 worldView = (_WorldSpaceCameraPos - worldPos).Normalize();
 
-		Vector3 lightDir;
-		Color lightColor;
-		InitLightArgs(worldPos, lightDir, lightColor);
-
+		// the clusters of the light grid hold the lights whose range reaches the pixel. the interpolated
+		// screen coordinate may land just off the screen on either side
+		int x = Mathf::Clamp(Mathf::FloorToInt(screenCoord.x * _ScreenParams.x), 0, (int)_ScreenParams.x - 1);
+		int y = Mathf::Clamp(Mathf::FloorToInt(screenCoord.y * _ScreenParams.y), 0, (int)_ScreenParams.y - 1);
 		Color fragColor = Color::clear;
-		fragColor.rgb = ShaderF::LightingBlinnPhong(lightInput, worldNormal, lightDir, lightColor.rgb, worldView);
+		if (!isClustered)
+		{
+			Vector3 lightDir;
+			Color lightColor;
+			InitLightArgs(worldPos, lightDir, lightColor);
+			fragColor.rgb = ShaderF::LightingBlinnPhong(lightInput, worldNormal, lightDir, lightColor.rgb, worldView);
+			SV_Target0 = fragColor;
+			return;
+		}
+		for (int index : _LightGrid->GetLights(x, y, depth))
+		{
+			Vector3 lightDir;
+			Color lightColor;
+			InitLightArgs(_LightGrid->GetLight(index), worldPos, lightDir, lightColor);
+			fragColor.rgb += ShaderF::LightingBlinnPhong(lightInput, worldNormal, lightDir, lightColor.rgb, worldView);
+		}
 		SV_Target0 = fragColor;
 	}
 };
@@ -164,9 +222,26 @@ TransformController cameraCtrl;
 std::shared_ptr<GBufferPass> gbufferPass;
 std::shared_ptr<Shader<LightVertex, LightV2F>> lightPrePass;
 std::shared_ptr<LightShadePass> lightShadePass;
-LightPtr light;
-std::vector<std::pair<Color, float>> lightColorIntensity;
+PipelineStatePtr gbufferState;
+PipelineStatePtr lightShadeState;
+PipelineStatePtr lightInsideState;
+PipelineStatePtr lightPreState;
+PipelineStatePtr lightVolumeState;
+PipelineStatePtr lightMarkState;
+PipelineStatePtr lightMarkedState;
+std::vector<LightPtr> lights;
 MeshPtr pointLightVolume;
+
+// L switches between the ways of shading the lights
+enum LightMode
+{
+	LightMode_Clustered, // one pass over the screen with the lights of every pixel's cluster
+	LightMode_Volumes, // a stencil marked volume per light, skipped when a query finds no scene inside it
+	LightMode_TwoSided, // the volume marked in one pass counting its faces behind the scene
+	LightModeCount
+};
+LightMode lightMode = LightMode_Clustered;
+bool isLightModeKeyDown = false;
 MeshPtr plane;
 MeshPtr cube;
 BitmapPtr diffuseGBuffer;
@@ -181,16 +256,18 @@ void Start()
 	camera->transform.rotation = Quaternion(Vector3(30.f, 45.f, 0.f));
 	SoftRender::camera = camera;
 
-	pointLightVolume = LoadMesh("resources/point_light_volume.obj");
-
-	light = std::make_shared<Light>();
-	light->type = Light::LightType_Point;
-	light->Initilize();
-	SoftRender::light = light;
 	for (int i = 0; i < n * n; ++i)
 	{
-		lightColorIntensity.emplace_back(Color(1, Mathf::Random(0.f, 1.f), Mathf::Random(0.f, 1.f), Mathf::Random(0.f, 1.f)), Mathf::Random(4.f, 5.f));
+		LightPtr light = std::make_shared<Light>();
+		light->type = Light::LightType_Point;
+		light->color = Color(1, Mathf::Random(0.f, 1.f), Mathf::Random(0.f, 1.f), Mathf::Random(0.f, 1.f));
+		light->intensity = Mathf::Random(4.f, 5.f);
+		light->range = 5.f; //20.f
+		light->transform.position = Vector3((i / n) * 2.f, lightH, (i % n) * 2.f);
+		light->Initilize();
+		lights.push_back(light);
 	}
+	pointLightVolume = LoadMesh("resources/point_light_volume.obj");
 
 	diffuseGBuffer = SoftRender::GetRenderTarget()->CreateGBuffer(0, Bitmap::BitmapType_RGB24);
 	specularGBuffer = SoftRender::GetRenderTarget()->CreateGBuffer(1, Bitmap::BitmapType_RGB24);
@@ -209,12 +286,141 @@ void Start()
 	lightShadePass->specularGBuffer->filterMode = Texture2D::FilterMode_Point;
 	lightShadePass->normalGBuffer = Texture2D::CreateWithBitmap(normalGBuffer);
 	lightShadePass->normalGBuffer->filterMode = Texture2D::FilterMode_Point;
-	auto& linearDepthBuffer = SoftRender::GetRenderTarget()->GetDepthBuffer();
+	BitmapPtr linearDepthBuffer = SoftRender::GetRenderTarget()->GetDepthStencilBuffer();
 	lightShadePass->_CameraDepthTexture = Texture2D::CreateWithBitmap(linearDepthBuffer);
 	lightShadePass->_CameraDepthTexture->filterMode = Texture2D::FilterMode_Point;
 
 	plane = CreatePlane();
 	cube = CreateCube();
+
+	RenderState state;
+	state.alphaBlend = false;
+	state.stencilOn = false;
+	state.cull = RenderState::CullType_Back;
+	state.zTest = RenderState::ZTestType_LEqual;
+	state.zWrite = true;
+	gbufferState = PipelineState::Create(state);
+
+	// one pass over the screen adding the lights of every pixel's cluster
+	state.alphaBlend = true;
+	state.blender.SetColorBlendMode(Blender::BlendMode_One, Blender::BlendMode_One);
+	state.blender.SetAlphaBlendMode(Blender::BlendMode_Zero, Blender::BlendMode_One);
+	state.zWrite = false;
+	state.cull = RenderState::CullType_Off;
+	state.zTest = RenderState::ZTestType_Always;
+	lightShadeState = PipelineState::Create(state);
+
+	// inside the light volume: its back faces in front of the scene
+	state.cull = RenderState::CullType_Front;
+	state.zTest = RenderState::ZTestType_GEqual;
+	lightInsideState = PipelineState::Create(state);
+
+	// marks the pixels with scene in front of the volume's back faces
+	state.stencilOn = true;
+	state.stencilComp = RenderState::StencilComparison_Always;
+	state.stencilOp = RenderState::StencilOperation_Replace;
+	state.stencilRefValue = 0xff;
+	state.blender.SetColorBlendMode(Blender::BlendMode_Zero, Blender::BlendMode_One);
+	lightPreState = PipelineState::Create(state);
+
+	// shades the marked pixels behind the volume's front faces
+	state.stencilComp = RenderState::StencilComparison_Equal;
+	state.stencilOp = RenderState::StencilOperation_Zero;
+	state.blender.SetColorBlendMode(Blender::BlendMode_One, Blender::BlendMode_One);
+	state.cull = RenderState::CullType_Back;
+	state.zTest = RenderState::ZTestType_LEqual;
+	lightVolumeState = PipelineState::Create(state);
+
+	// one pass over both faces: a back face behind the scene counts up and a front face behind it
+	// counts down, leaving the pixels with scene inside the volume nonzero. it holds when the near
+	// plane cuts the front faces. the top bit is kept out of the count
+	state.stencilOp = RenderState::StencilOperation_Keep;
+	state.stencilZFailOp = RenderState::StencilOperation_DecrWrap;
+	state.twoSidedStencil = true;
+	state.stencilCompBack = RenderState::StencilComparison_Always;
+	state.stencilOpBack = RenderState::StencilOperation_Keep;
+	state.stencilZFailOpBack = RenderState::StencilOperation_IncrWrap;
+	state.stencilComp = RenderState::StencilComparison_Always;
+	state.stencilWriteMask = 0x7f;
+	state.blender.SetColorBlendMode(Blender::BlendMode_Zero, Blender::BlendMode_One);
+	state.cull = RenderState::CullType_Off;
+	state.zTest = RenderState::ZTestType_LEqual;
+	lightMarkState = PipelineState::Create(state);
+
+	// shades the counted pixels under the volume's back faces and clears their count
+	state.twoSidedStencil = false;
+	state.stencilComp = RenderState::StencilComparison_NotEqual;
+	state.stencilRefValue = 0x00;
+	state.stencilReadMask = 0x7f;
+	state.stencilOp = RenderState::StencilOperation_Zero;
+	state.stencilZFailOp = RenderState::StencilOperation_Keep;
+	state.blender.SetColorBlendMode(Blender::BlendMode_One, Blender::BlendMode_One);
+	state.cull = RenderState::CullType_Front;
+	state.zTest = RenderState::ZTestType_Always;
+	lightMarkedState = PipelineState::Create(state);
+}
+
+void DrawLightVolumes()
+{
+	lightShadePass->isClustered = false;
+	SoftRender::renderData.AssetVerticesIndicesBuffer<LightVertex>(*pointLightVolume);
+	for (const LightPtr& light : lights)
+	{
+		SoftRender::light = light;
+		SoftRender::modelMatrix = Matrix4x4::TRS(light->transform.position, Quaternion::identity, Vector3::one * light->range);
+
+		// the near plane cuts the volume, its front faces don't bound the lit pixels
+		float viewDepth = camera->viewMatrix().MultiplyPoint3x4(light->transform.position).z;
+		if (viewDepth - light->range < camera->zNear())
+		{
+			SoftRender::SetPipelineState(lightInsideState);
+			SoftRender::SetShader(lightShadePass);
+			SoftRender::Draw<LightShadePass>();
+			continue;
+		}
+
+		SoftRender::ClearStencilBuffer(0x00);
+		SoftRender::SetPipelineState(lightPreState);
+		SoftRender::SetShader(lightPrePass);
+		SoftRender::BeginQuery();
+		SoftRender::Draw<Shader<LightVertex, LightV2F> >();
+		// nothing of the scene is inside the light volume
+		if (SoftRender::EndQuery() == 0) continue;
+
+		SoftRender::SetPipelineState(lightVolumeState);
+		SoftRender::SetShader(lightShadePass);
+		SoftRender::Draw<LightShadePass>();
+	}
+	SoftRender::light = nullptr;
+}
+
+void DrawTwoSidedLightVolumes()
+{
+	lightShadePass->isClustered = false;
+	SoftRender::renderData.AssetVerticesIndicesBuffer<LightVertex>(*pointLightVolume);
+	// the shading pass puts back the zero every marking pass starts from
+	SoftRender::ClearStencilBuffer(0x00);
+	for (const LightPtr& light : lights)
+	{
+		SoftRender::light = light;
+		SoftRender::modelMatrix = Matrix4x4::TRS(light->transform.position, Quaternion::identity, Vector3::one * light->range);
+
+		// outside the volume no face passing the depth test means the scene hides all of it,
+		// inside it the counted pixels are behind the back faces alone
+		float viewDepth = camera->viewMatrix().MultiplyPoint3x4(light->transform.position).z;
+		bool isInside = viewDepth - light->range < camera->zNear();
+
+		SoftRender::SetPipelineState(lightMarkState);
+		SoftRender::SetShader(lightPrePass);
+		if (!isInside) SoftRender::BeginQuery();
+		SoftRender::Draw<Shader<LightVertex, LightV2F> >();
+		if (!isInside && SoftRender::EndQuery() == 0) continue;
+
+		SoftRender::SetPipelineState(lightMarkedState);
+		SoftRender::SetShader(lightShadePass);
+		SoftRender::Draw<LightShadePass>();
+	}
+	SoftRender::light = nullptr;
 }
 
 void Update()
@@ -222,27 +428,22 @@ void Update()
 	cameraCtrl.MouseRotate(camera->transform);
 	cameraCtrl.KeyMove(camera->transform);
 
-	SoftRender::Clear(true, true, Color::clear);
+	// the bound g-buffers are cleared with the color buffer
 	SoftRender::GetRenderTarget()->SetGBuffer(0, diffuseGBuffer);
-	diffuseGBuffer->Fill(Color::clear);
 	SoftRender::GetRenderTarget()->SetGBuffer(1, specularGBuffer);
-	specularGBuffer->Fill(Color::clear);
 	SoftRender::GetRenderTarget()->SetGBuffer(2, normalGBuffer);
-	normalGBuffer->Fill(Color::clear);
-
-	// GBuffer Pass
-	SoftRender::renderState.alphaBlend = false;
-	SoftRender::renderState.stencilOn = false;
-	SoftRender::renderState.cull = RenderState::CullType_Back;
-	SoftRender::renderState.zTest = RenderState::ZTestType_LEqual;
-	SoftRender::renderState.zWrite = true;
+	SoftRender::Clear(true, true, Color::clear);
+
+	// GBuffer Pass, every pixel is shaded once by the surface in front
+	SoftRender::BeginVisibilityPass();
+	SoftRender::SetPipelineState(gbufferState);
 	SoftRender::SetShader(gbufferPass);
 	SoftRender::renderData.AssetVerticesIndicesBuffer<Vertex>(*plane);
 	objectTrans.position = Vector3(0.f, planeH, 0.f);
 	objectTrans.rotation = Quaternion(Vector3(90.f, 0.f, 0.f));
 	objectTrans.scale = Vector3::one * 100.f;
 	SoftRender::modelMatrix = objectTrans.localToWorldMatrix();
-	SoftRender::Submit();
+	SoftRender::Draw<GBufferPass>();
 	SoftRender::renderData.AssetVerticesIndicesBuffer<Vertex>(*cube);
 	for (int i = 0; i < n * n; ++i)
 	{
@@ -250,69 +451,39 @@ void Update()
 		objectTrans.rotation = Quaternion::identity;
 		objectTrans.scale = Vector3::one;
 		SoftRender::modelMatrix = objectTrans.localToWorldMatrix();
-		SoftRender::Submit();
+		SoftRender::Draw<GBufferPass>();
 	}
+	SoftRender::EndVisibilityPass();
 
 	SoftRender::GetRenderTarget()->SetGBuffer(0, nullptr);
 	SoftRender::GetRenderTarget()->SetGBuffer(1, nullptr);
 	SoftRender::GetRenderTarget()->SetGBuffer(2, nullptr);
 
-	// Light Pass
-	SoftRender::renderData.AssetVerticesIndicesBuffer<LightVertex>(*pointLightVolume);
+	bool isLightModeKey = app->GetInput()->GetKey(GLFW_KEY_L);
+	if (isLightModeKey && !isLightModeKeyDown) lightMode = (LightMode)((lightMode + 1) % LightModeCount);
+	isLightModeKeyDown = isLightModeKey;
 
-	for (int i = 0; i < n * n; ++i)
+	// Light Pass
+	if (lightMode == LightMode_Clustered)
 	{
-		light->color = lightColorIntensity[i].first;
-		light->intensity = lightColorIntensity[i].second;
-		light->range = 5.f; //20.f
-		light->transform.position = Vector3((i / n) * 2.f, lightH, (i % n) * 2.f);
-		light->transform.scale = Vector3::one * light->range;
-		SoftRender::modelMatrix = light->transform.localToWorldMatrix();
-		Vector3 lightInCameraSpace = (camera->viewMatrix() * SoftRender::modelMatrix).MultiplyPoint3x4(light->transform.position);
-		if (lightInCameraSpace.z - light->range < camera->zNear())
-		{
-			SoftRender::renderState.stencilOn = false;
-			SoftRender::renderState.alphaBlend = true;
-			SoftRender::renderState.blender.SetColorBlendMode(Blender::BlendMode_One, Blender::BlendMode_One);
-			SoftRender::renderState.blender.SetAlphaBlendMode(Blender::BlendMode_Zero, Blender::BlendMode_One);
-			SoftRender::renderState.zWrite = false;
-			SoftRender::renderState.cull = RenderState::CullType_Front;
-			SoftRender::renderState.zTest = RenderState::ZTestType_GEqual;
-			SoftRender::SetShader(lightShadePass);
-			SoftRender::Submit();
-		}
-		else
-		{
-			SoftRender::ClearStencilBuffer(0x00);
-			SoftRender::renderState.stencilOn = true;
-			SoftRender::renderState.stencilComp = RenderState::StencilComparison_Always;
-			SoftRender::renderState.stencilOp = RenderState::StencilOperation_Replace;
-			SoftRender::renderState.stencilRefValue = 0xff;
-			SoftRender::renderState.alphaBlend = true;
-			SoftRender::renderState.blender.SetColorBlendMode(Blender::BlendMode_Zero, Blender::BlendMode_One);
-			SoftRender::renderState.blender.SetAlphaBlendMode(Blender::BlendMode_Zero, Blender::BlendMode_One);
-			SoftRender::renderState.zWrite = false;
-			SoftRender::renderState.cull = RenderState::CullType_Front;
-			SoftRender::renderState.zTest = RenderState::ZTestType_GEqual;
-			SoftRender::SetShader(lightPrePass);
-			SoftRender::Submit();
-
-			// Shade Pass
-			SoftRender::renderState.stencilOn = true;
-			SoftRender::renderState.stencilComp = RenderState::StencilComparison_Equal;
-			SoftRender::renderState.stencilOp = RenderState::StencilOperation_Zero;
-			SoftRender::renderState.stencilRefValue = 0xff;
-			SoftRender::renderState.alphaBlend = true;
-			SoftRender::renderState.blender.SetColorBlendMode(Blender::BlendMode_One, Blender::BlendMode_One);
-			SoftRender::renderState.blender.SetAlphaBlendMode(Blender::BlendMode_Zero, Blender::BlendMode_One);
-			SoftRender::renderState.zWrite = false;
-			SoftRender::renderState.cull = RenderState::CullType_Back;
-			SoftRender::renderState.zTest = RenderState::ZTestType_LEqual;
-			SoftRender::SetShader(lightShadePass);
-			SoftRender::Submit();
-		}
+		// the lights are culled against the depth of the GBuffer pass
+		lightShadePass->isClustered = true;
+		SoftRender::BuildLightGrid(lights);
+		SoftRender::SetPipelineState(lightShadeState);
+		SoftRender::SetShader(lightShadePass);
+		SoftRender::renderData.AssetVerticesIndicesBuffer<LightVertex>(*plane);
+		SoftRender::modelMatrix = camera->GetFullScreenQuadMatrix();
+		SoftRender::Draw<LightShadePass>();
+	}
+	else if (lightMode == LightMode_Volumes)
+	{
+		DrawLightVolumes();
+	}
+	else
+	{
+		DrawTwoSidedLightVolumes();
 	}
-	
+
 	SoftRender::Present();
 
 	if (app->GetInput()->GetKey(GLFW_KEY_ENTER))
@@ -320,8 +491,7 @@ void Update()
 		diffuseGBuffer->SaveToFile("gbuffer0.png");
 		specularGBuffer->SaveToFile("gbuffer1.png");
 		normalGBuffer->SaveToFile("gbuffer2.png");
-		SoftRender::GetStencilBuffer()->SaveToFile("stencil.png");
-		SoftRender::GetRenderTarget()->GetDepthBuffer()->SaveToFile("depth.tiff");
+		SoftRender::GetRenderTarget()->GetDepthStencilBuffer()->SaveToFile("depth.tiff");
 		SoftRender::GetRenderTarget()->GetColorBuffer()->SaveToFile("result.png");
 	}
 	app->SetTitle(std::to_string(app->GetDeltaTime()).c_str());
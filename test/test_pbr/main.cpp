@@ -46,6 +46,21 @@ struct V2F
 	Vector3 tspace1;
 	Vector3 tspace2;
 	Vector3 worldPos;
+
+	static const std::vector<VaryingElement>& varyings()
+	{
+		static std::vector<VaryingElement> _varyings
+		{
+			VaryingElement::Unused<Vector4>(),
+			VaryingElement::Perspective<Vector2>(),
+			VaryingElement::Perspective<Vector3>(),
+			VaryingElement::Perspective<Vector3>(),
+			VaryingElement::Perspective<Vector3>(),
+			VaryingElement::Perspective<Vector3>()
+		};
+
+		return _varyings;
+	}
 };
 
 struct MainShader : Shader<Vertex, V2F>
@@ -74,32 +89,45 @@ struct MainShader : Shader<Vertex, V2F>
 
 	void frag(const V2F& input) override
 	{
-		PBSInput pbsInput;
-		pbsInput.albedo = Tex2D(*albedoMap, input.texcoord).rgb;
+		Shade<PBSInput, PBSLight>(input.texcoord, input.tspace0, input.tspace1, input.tspace2, input.worldPos, SV_Target0);
+	}
+
+	void fragQuad(const Quad<V2F*>& quad, uint8_t laneMask) override
+	{
+		Shade<PBSInputx4, PBSLightx4>(Gather(quad, &V2F::texcoord), Gather(quad, &V2F::tspace0), Gather(quad, &V2F::tspace1),
+			Gather(quad, &V2F::tspace2), Gather(quad, &V2F::worldPos), SV_Target0x4);
+	}
+
+	// a pixel with the scalar types, or the four of a quad with the x4 ones
+	template<typename PBSInputType, typename PBSLightType, typename Vector2Type, typename Vector3Type, typename ColorType>
+	void Shade(const Vector2Type& texcoord, const Vector3Type& tspace0, const Vector3Type& tspace1, const Vector3Type& tspace2,
+		const Vector3Type& worldPos, ColorType& fragColor)
+	{
+		PBSInputType pbsInput;
+		pbsInput.albedo = Tex2D(*albedoMap, texcoord).rgb;
 
-		Vector3 normal = UnpackNormal(Tex2D(*normalMap, input.texcoord));
-		pbsInput.normal.x = input.tspace0.Dot(normal);
-		pbsInput.normal.y = input.tspace1.Dot(normal);
-		pbsInput.normal.z = input.tspace2.Dot(normal);
+		Vector3Type normal = UnpackNormal(Tex2D(*normalMap, texcoord));
+		pbsInput.normal.x = tspace0.Dot(normal);
+		pbsInput.normal.y = tspace1.Dot(normal);
+		pbsInput.normal.z = tspace2.Dot(normal);
 
-		Vector3 param = Tex2D(*paramMap, input.texcoord).rgb;
+		Vector3Type param = Tex2D(*paramMap, texcoord).rgb;
 		pbsInput.roughness = param.x;
 		pbsInput.metallic = param.y;
 		pbsInput.PBSSetup();
 
-		Vector3 lightDir;
-		Color lightColor;
-		InitLightArgs(input.worldPos, lightDir, lightColor);
-		PBSLight pbsLight;
+		Vector3Type lightDir;
+		ColorType lightColor;
+		InitLightArgs(worldPos, lightDir, lightColor);
+		PBSLightType pbsLight;
 		pbsLight.color = lightColor.rgb;
 		pbsLight.dir = lightDir;
 
-		Vector3 viewDir = (_WorldSpaceCameraPos - input.worldPos).Normalize();
+		Vector3Type viewDir = (Vector3Type(_WorldSpaceCameraPos) - worldPos).Normalize();
 
-		Color fragColor = Color::white * 0.1f;
+		fragColor = ColorType(Color::white * 0.1f);
 		fragColor.rgb += PBSF::BRDF1(pbsInput, pbsInput.normal, viewDir, pbsLight);
 		fragColor.rgb += PBSF::ApproximateSpecularIBL(*envMap, pbsInput.specColor, pbsInput.normal, viewDir, pbsInput.roughness);
-		SV_Target0 = fragColor;
 	}
 };
 
@@ -129,25 +157,34 @@ void MainLoop()
 		SoftRender::light = light;
 
 		shader = std::make_shared<MainShader>();
-		shader->albedoMap = Texture2D::LoadTexture("resources/pbr/knife_albedo.png");
-		shader->normalMap = Texture2D::LoadTexture("resources/pbr/knife_normal.png");
-		shader->paramMap = Texture2D::LoadTexture("resources/pbr/knife_param.png");
-
 		shader->envMap = CubemapPtr(new Cubemap());
-		auto latlong = Texture2D::LoadTexture("resources/pbr/envmap.png");
-		std::vector<BitmapPtr> mipmaps;
+
+		// decode the images on the job system while the mesh is loaded here
+		TaskGroup loading;
+		loading.Run([] { shader->albedoMap = Texture2D::LoadTexture("resources/pbr/knife_albedo.png"); });
+		loading.Run([] { shader->normalMap = Texture2D::LoadTexture("resources/pbr/knife_normal.png"); });
+		loading.Run([] { shader->paramMap = Texture2D::LoadTexture("resources/pbr/knife_param.png"); });
+
+		Texture2DPtr latlong;
+		loading.Run([&latlong] { latlong = Texture2D::LoadTexture("resources/pbr/envmap.png"); });
+		std::vector<BitmapPtr> mipmaps(10);
 		for (int i = 1; i <= 10; ++i)
 		{
-			char path[256];
-			sprintf(path, "resources/pbr/envmap_mip%d.png", i);
-			mipmaps.push_back(Texture2D::LoadTexture(path)->GetBitmap(0));
+			loading.Run([&mipmaps, i]
+			{
+				char path[256];
+				sprintf(path, "resources/pbr/envmap_mip%d.png", i);
+				mipmaps[i - 1] = Texture2D::LoadTexture(path)->GetBitmap(0);
+			});
 		}
-		latlong->SetMipmaps(mipmaps);
-		shader->envMap->InitWithLatlong(latlong);
 
 		auto mesh = LoadMesh("resources/pbr/knife.obj");
 		mesh->CalculateTangents();
 		SoftRender::renderData.AssetVerticesIndicesBuffer<Vertex>(*mesh);
+
+		loading.Wait();
+		latlong->SetMipmaps(mipmaps);
+		shader->envMap->InitWithLatlong(latlong);
 		objectTrans.rotation = Quaternion(Vector3(0.f, -110.f, -20.f));
 	}
 
@@ -159,7 +196,7 @@ void MainLoop()
 	objectTrans.scale = Vector3::one * 2.f;
 	SoftRender::modelMatrix = objectTrans.localToWorldMatrix();
 	SoftRender::SetShader(shader);
-	SoftRender::Submit();
+	SoftRender::Draw<MainShader>();
 
     SoftRender::Present();
 }
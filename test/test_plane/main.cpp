@@ -46,58 +46,33 @@ struct V2F
 	Vector3 tspace0;
 	Vector3 tspace1;
 	Vector3 tspace2;
-};
-
-struct ForwardBaseShader : Shader<Vertex, V2F>
-{
-	Texture2DPtr diffuseMap;
-	Texture2DPtr normalMap;
-
-	V2F vert(const Vertex& input) override
-	{
-		V2F output;
-		output.position = _MATRIX_MVP.MultiplyPoint(input.position);
-		output.worldPos = _Object2World.MultiplyPoint3x4(input.position);
-		output.texcoord = input.texcoord * 2.f;
-		Vector3 normal = _Object2World.MultiplyVector(input.normal).Normalize();
-		Vector3 tangent = _Object2World.MultiplyVector(input.tangent.xyz).Normalize();
-		Vector3 bitangent = normal.Cross(tangent) * input.tangent.w;
-		output.tspace0 = Vector3(tangent.x, bitangent.x, normal.x);
-		output.tspace1 = Vector3(tangent.y, bitangent.y, normal.y);
-		output.tspace2 = Vector3(tangent.z, bitangent.z, normal.z);
-		return output;
-	}
 
-	void frag(const V2F& input) override
+	static const std::vector<VaryingElement>& varyings()
 	{
-		LightInput lightInput;
-		lightInput.ambient = Color::white * 0.18f;
-		lightInput.diffuse = Tex2D(*diffuseMap, input.texcoord);
-		lightInput.specular = Color::white;
-		lightInput.shininess = 10.f;
-
-		Vector3 normal = UnpackNormal(Tex2D(*normalMap, input.texcoord));
-		Vector3 worldNormal = Vector3::up;
-		worldNormal.x = input.tspace0.Dot(normal);
-		worldNormal.y = input.tspace1.Dot(normal);
-		worldNormal.z = input.tspace2.Dot(normal);
-
-		Vector3 lightDir;
-		Color lightColor;
-		InitLightArgs(input.worldPos, lightDir, lightColor);
+		static std::vector<VaryingElement> _varyings
+		{
+			VaryingElement::Unused<Vector4>(),
+			VaryingElement::Perspective<Vector3>(),
+			VaryingElement::Perspective<Vector2>(),
+			VaryingElement::Perspective<Vector3>(),
+			VaryingElement::Perspective<Vector3>(),
+			VaryingElement::Perspective<Vector3>()
+		};
 
-		Vector3 viewDir = (_WorldSpaceCameraPos - input.worldPos).Normalize();
-		Color fragColor;
-		fragColor.rgb = ShaderF::LightingPhong(lightInput, worldNormal, lightDir, lightColor.rgb, viewDir);
-		SV_Target0 = fragColor;
+		return _varyings;
 	}
 };
 
-struct ForwardAdditionShader : Shader<Vertex, V2F>
+struct ForwardShader : Shader<Vertex, V2F>
 {
 	Texture2DPtr diffuseMap;
 	Texture2DPtr normalMap;
 
+	ForwardShader()
+	{
+		objectUniformUsage = ObjectUniforms::Usage_MVP;
+	}
+
 	V2F vert(const Vertex& input) override
 	{
 		V2F output;
@@ -127,14 +102,14 @@ struct ForwardAdditionShader : Shader<Vertex, V2F>
 		worldNormal.y = input.tspace1.Dot(normal);
 		worldNormal.z = input.tspace2.Dot(normal);
 
-		Color fragColor;
-
-		Vector3 lightDir;
-		Color lightColor;
-		InitLightArgs(input.worldPos, lightDir, lightColor);
-
 		Vector3 viewDir = (_WorldSpaceCameraPos - input.worldPos).Normalize();
-		fragColor.rgb = ShaderF::LightingPhong(lightInput, worldNormal, lightDir, lightColor.rgb, viewDir);
+		Color fragColor;
+		fragColor.rgb = lightInput.ambient.rgb * lightInput.diffuse.rgb;
+		lightInput.ambient = Color::black;
+		ForEachLight(input.worldPos, [&](const Vector3& lightDir, const Color& lightColor)
+		{
+			fragColor.rgb += ShaderF::LightingPhong(lightInput, worldNormal, lightDir, lightColor.rgb, viewDir);
+		});
 		SV_Target0 = fragColor;
 	}
 };
@@ -145,8 +120,7 @@ void MainLoop()
 	static Transform objectTrans;
 	static Transform cameraTrans;
 	static TransformController objectCtrl;
-	static std::shared_ptr<ForwardBaseShader> forwardBaseShader;
-	static std::shared_ptr<ForwardAdditionShader> forwardAdditionShader;
+	static std::shared_ptr<ForwardShader> forwardShader;
 	static LightPtr lightRed;
 	static LightPtr lightBlue;
 	static MeshPtr mesh;
@@ -188,14 +162,13 @@ void MainLoop()
 		lightBlue->phi = 45.f;
 		lightBlue->Initilize();
 
-		forwardBaseShader = std::make_shared<ForwardBaseShader>();
-		forwardBaseShader->diffuseMap = Texture2D::LoadTexture("resources/bric.tga");
-		forwardBaseShader->diffuseMap->GenerateMipmaps();
-		forwardBaseShader->normalMap = Texture2D::LoadTexture("resources/bric_n.tga");
-		forwardBaseShader->normalMap->GenerateMipmaps();
-		forwardAdditionShader = std::make_shared<ForwardAdditionShader>();
-		forwardAdditionShader->diffuseMap = forwardBaseShader->diffuseMap;
-		forwardAdditionShader->normalMap = forwardBaseShader->normalMap;
+		SoftRender::lights = { lightRed, lightBlue };
+
+		forwardShader = std::make_shared<ForwardShader>();
+		forwardShader->diffuseMap = Texture2D::LoadTexture("resources/bric.tga");
+		forwardShader->diffuseMap->GenerateMipmaps();
+		forwardShader->normalMap = Texture2D::LoadTexture("resources/bric_n.tga");
+		forwardShader->normalMap->GenerateMipmaps();
 
 		mesh = CreatePlane();
 		mesh->CalculateTangents();
@@ -207,17 +180,10 @@ void MainLoop()
 	SoftRender::modelMatrix = objectTrans.localToWorldMatrix();
 	SoftRender::renderData.AssetVerticesIndicesBuffer<Vertex>(*mesh);
 
-	SoftRender::light = lightRed;
+	// both lights in one pass
 	SoftRender::renderState.alphaBlend = false;
-	SoftRender::SetShader(forwardBaseShader);
-	SoftRender::Submit();
-
-	SoftRender::light = lightBlue;
-	SoftRender::renderState.alphaBlend = true;
-	SoftRender::renderState.blender.SetColorBlendMode(Blender::BlendMode_One, Blender::BlendMode_One);
-	SoftRender::renderState.blender.SetAlphaBlendMode(Blender::BlendMode_One, Blender::BlendMode_One);
-	SoftRender::SetShader(forwardAdditionShader);
-	SoftRender::Submit();
+	SoftRender::SetShader(forwardShader);
+	SoftRender::Draw<ForwardShader>();
 
 	SoftRender::Present();
 }